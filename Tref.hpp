@@ -25,6 +25,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <string_view>
 #include <tuple>
 #include <type_traits>
@@ -46,6 +47,7 @@ namespace tref {
 namespace imp {
 
 using namespace std;
+using namespace std::literals;
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -83,6 +85,22 @@ using member_t = typename member_pointer_trait<T>::member_t;
 template <class T>
 using enclosing_class_t = typename member_pointer_trait<T>::enclosing_class_t;
 
+// Offset of the data member in T, computed without constructing the object.
+// T defaults to the class declaring the member, pass the derived class for
+// the inherited members, e.g. offset_of<Derived>(&Base::x), since the base
+// may not be at offset 0 of the derived class.
+template <class T = void, class C, class M>
+size_t offset_of(M C::*ptr) {
+  using Obj = conditional_t<is_void_v<T>, C, T>;
+  static_assert(is_base_of_v<C, Obj>);
+  alignas(Obj) static char buf[sizeof(Obj)];
+  auto obj = reinterpret_cast<Obj*>(buf);
+  return static_cast<size_t>(reinterpret_cast<char*>(&(obj->*ptr)) - buf);
+}
+
+// Cache line size assumed by the layout optimizations.
+constexpr size_t cache_line_size = 64;
+
 // function trait
 
 template <typename T>
@@ -102,6 +120,39 @@ struct func_trait<R (C::*)(A...)> {
   using ret_t = R;
 };
 
+template <typename R, typename C, typename... A>
+struct func_trait<R (C::*)(A...) const noexcept>
+    : func_trait<R (C::*)(A...) const> {};
+
+template <typename R, typename C, typename... A>
+struct func_trait<R (C::*)(A...) noexcept> : func_trait<R (C::*)(A...)> {};
+
+template <typename R, typename... A>
+struct func_trait<R (*)(A...)> {
+  using args_t = tuple<A...>;
+  static constexpr auto args_count = sizeof...(A);
+  using ret_t = R;
+};
+
+template <typename R, typename... A>
+struct func_trait<R (*)(A...) noexcept> : func_trait<R (*)(A...)> {};
+
+// Signature of the reflected member or static function, empty for others.
+template <typename T,
+          bool = is_member_function_pointer_v<T> ||
+                 is_function_v<remove_pointer_t<T>>>
+struct func_field_trait {
+  static constexpr auto is_func_v = false;
+};
+
+template <typename T>
+struct func_field_trait<T, true> {
+  static constexpr auto is_func_v = true;
+  using args_t = typename func_trait<T>::args_t;
+  using ret_t = typename func_trait<T>::ret_t;
+  static constexpr auto args_count = func_trait<T>::args_count;
+};
+
 // function overloading helper
 
 template <typename... Args>
@@ -123,6 +174,103 @@ struct Overload {
 template <typename... Args>
 constexpr Overload<Args...> overload_v{};
 
+// compile-time type name
+
+template <typename T>
+constexpr string_view raw_type_name() {
+#ifdef _MSC_VER
+  return __FUNCSIG__;
+#else
+  return __PRETTY_FUNCTION__;
+#endif
+}
+
+constexpr auto type_name_prefix = raw_type_name<int>().rfind("int");
+constexpr auto type_name_suffix =
+    raw_type_name<int>().size() - type_name_prefix - 3;
+
+template <size_t N>
+struct FixedString {
+  char   data[N + 1]{};
+  size_t size = 0;
+
+  constexpr string_view view() const { return {data, size}; }
+};
+
+constexpr bool is_ident_char(char c) {
+  return c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z');
+}
+
+// strip the elaborated type specifiers emitted by MSVC, e.g. "struct A<class
+// B>" => "A<B>".
+template <typename T>
+constexpr auto make_type_name() {
+  constexpr auto raw = raw_type_name<T>();
+  constexpr auto name = raw.substr(
+      type_name_prefix, raw.size() - type_name_prefix - type_name_suffix);
+
+  FixedString<name.size()> ret{};
+  for (size_t i = 0; i < name.size();) {
+    if (i == 0 || !is_ident_char(name[i - 1])) {
+      auto skipped = false;
+      for (auto kw : {"struct "sv, "class "sv, "union "sv, "enum "sv}) {
+        if (name.substr(i, kw.size()) == kw) {
+          i += kw.size();
+          skipped = true;
+          break;
+        }
+      }
+      if (skipped)
+        continue;
+    }
+    ret.data[ret.size++] = name[i++];
+  }
+  return ret;
+}
+
+template <typename T>
+constexpr auto type_name_storage = make_type_name<T>();
+
+// Fully qualified name of any type, including the template arguments, e.g.
+// "ns::Data<int, void>".
+// NOTE: spelling of builtin types is compiler specific(e.g. "unsigned long"
+// vs "long unsigned int").
+template <typename T>
+constexpr string_view type_name_v = type_name_storage<T>.view();
+
+constexpr uint64_t fnv1a_64(string_view s) {
+  uint64_t h = 14695981039346656037ull;
+  for (auto c : s) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Stable 64-bit id of type, i.e. the hash of its fully qualified name.
+template <typename T>
+constexpr uint64_t type_id_v = fnv1a_64(type_name_v<T>);
+
+// Non-owning view of contiguous elements.
+template <typename T>
+struct Span {
+  T*     ptr = nullptr;
+  size_t count = 0;
+
+  constexpr Span() = default;
+  constexpr Span(T* p, size_t n) : ptr{p}, count{n} {}
+  template <typename C, typename = decltype(declval<C&>().data())>
+  constexpr Span(C& c) : ptr{c.data()}, count{c.size()} {}
+
+  constexpr T*     data() const { return ptr; }
+  constexpr size_t size() const { return count; }
+  constexpr bool   empty() const { return count == 0; }
+  constexpr T*     begin() const { return ptr; }
+  constexpr T*     end() const { return ptr + count; }
+  constexpr T&     operator[](size_t i) const { return ptr[i]; }
+};
+
 template <typename... Meta>
 struct Metas : Meta... {
   constexpr explicit Metas(Meta... m) : Meta(m)... {}
@@ -318,12 +466,16 @@ constexpr auto has_base_class_v =
 
 // Meta for Member
 
+// Functions also have is_func_v, args_t, ret_t and args_count, see
+// func_field_trait.
 template <typename T, typename Meta>
-struct FieldInfo {
+struct FieldInfo : func_field_trait<T> {
   using enclosing_class_t = imp::enclosing_class_t<T>;
   using member_t = imp::member_t<T>;
 
   static constexpr auto is_member_v = !is_same_v<enclosing_class_t, void>;
+  static constexpr auto is_data_member_v =
+      is_member_v && !is_function_v<member_t>;
 
   int         index;
   string_view name;
@@ -347,11 +499,23 @@ struct ClassInfo {
 
   string_view name;
   size_t      size;
+  size_t      align;
   Type<Base>  base;
   Meta        meta;
 
+  // name with template arguments & the id hashed from it, use them to
+  // distinguish the template instances.
+  string_view full_name;
+  uint64_t    id;
+
   constexpr ClassInfo(T*, string_view n, size_t sz, Type<Base> b, Meta&& m)
-      : name{n}, size{sz}, base{b}, meta{move(m)} {
+      : name{n},
+        size{sz},
+        align{alignof(T)},
+        base{b},
+        meta{move(m)},
+        full_name{type_name_v<T>},
+        id{type_id_v<T>} {
     if constexpr (!is_same_v<Base, DummyBase>) {
       static_assert(is_base_of_v<Base, class_t>, "invalid base class");
     }
@@ -413,6 +577,32 @@ struct ClassInfo {
   }
 };
 
+// Collect the FieldInfo of all data members into a tuple, members of base
+// class come first.
+
+template <class C, size_t... Is>
+constexpr auto level_data_fields(index_sequence<Is...>) {
+  return tuple_cat([] {
+    constexpr auto f = get<1>(get_state<C, FieldTag, Is + 1>());
+    if constexpr (decltype(f)::is_data_member_v) {
+      return tuple{f};
+    } else {
+      return tuple<>{};
+    }
+  }()...);
+}
+
+template <class T>
+constexpr auto data_fields() {
+  constexpr auto cnt = ZTrefStateCnt(T, FieldTag);
+  constexpr auto own = level_data_fields<T>(make_index_sequence<cnt>{});
+  if constexpr (has_base_class_v<T>) {
+    return tuple_cat(data_fields<ZTrefBaseOf(T)>(), own);
+  } else {
+    return own;
+  }
+}
+
 #define ZTrefClassMetaImp(T, Base, meta)                              \
   constexpr auto _tref_class_info(ZTrefRemoveParen(T)**) {            \
     return tref::imp::ClassInfo{                                      \
@@ -622,6 +812,11 @@ constexpr auto enum_info() {
   return _tref_enum_info((T**)0);
 }
 
+// The enum items are reflected, i.e. enum_info<T>() is available.
+template <typename T>
+constexpr bool is_reflected_enum_v =
+    !is_same_v<decltype(_tref_enum_info((T**)0)), void*>;
+
 // Use it out of class.
 #define ZTrefEnum(T, ...) ZTrefEnumWithMeta(T, nullptr, __VA_ARGS__)
 #define ZTrefEnumWithMeta(T, meta, ...) \
@@ -759,8 +954,10 @@ struct Flags {
 #define TrefHasTref ZTrefHasTref
 #define TrefVersion ZTrefVersion
 
+using imp::cache_line_size;
 using imp::class_info;
 using imp::ClassInfo;
+using imp::data_fields;
 using imp::enclosing_class_t;
 using imp::FieldInfo;
 using imp::func_trait;
@@ -768,7 +965,11 @@ using imp::has_base_class_v;
 using imp::is_reflected_v;
 using imp::member_t;
 using imp::Metas;
+using imp::offset_of;
 using imp::overload_v;
+using imp::Span;
+using imp::type_id_v;
+using imp::type_name_v;
 
 #define TrefType ZTrefType
 #define TrefTypeWithMeta ZTrefTypeWithMeta
@@ -793,6 +994,7 @@ using imp::overload_v;
 /// enum
 
 using imp::enum_info;
+using imp::is_reflected_enum_v;
 using imp::enum_to_string;
 using imp::Flags;
 using imp::string_to_enum;
@@ -0,0 +1,1082 @@
+// Tref: Apache Arrow IPC export & import of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_ARROW_H
+#define TREF_ARROW_H
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Tref.hpp"
+
+// NOTE: little-endian hosts only, as the Arrow data is written in host order.
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// flatbuffers
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Minimal flatbuffers builder: the object tree is described first and then
+// serialized front to back, children after their parents so the unsigned
+// offsets always point forward.
+struct FbObject {
+  enum Kind { Table, Vector, Structs, String } kind = Table;
+
+  struct Field {
+    uint16_t slot;
+    uint8_t  size;  // 0 for child object.
+    uint64_t scalar;
+    size_t   child;
+  };
+
+  vector<Field>    fields;    // of table.
+  vector<FbObject> children;  // of table & vector.
+  string           bytes;     // of structs & string.
+  uint32_t         count = 0;
+
+  template <typename S>
+  FbObject& scalar(uint16_t slot, S v) {
+    uint64_t u = 0;
+    memcpy(&u, &v, sizeof(S));
+    fields.push_back({slot, static_cast<uint8_t>(sizeof(S)), u, 0});
+    return *this;
+  }
+
+  FbObject& child(uint16_t slot, FbObject o) {
+    fields.push_back({slot, 0, 0, children.size()});
+    children.push_back(move(o));
+    return *this;
+  }
+
+  static FbObject vector_of(vector<FbObject> items) {
+    FbObject o;
+    o.kind = Vector;
+    o.count = static_cast<uint32_t>(items.size());
+    o.children = move(items);
+    return o;
+  }
+
+  // Vector of structs of 8 bytes alignment.
+  static FbObject structs(const void* data, size_t size, size_t count) {
+    FbObject o;
+    o.kind = Structs;
+    o.bytes.assign(static_cast<const char*>(data), size * count);
+    o.count = static_cast<uint32_t>(count);
+    return o;
+  }
+
+  static FbObject string_of(string_view s) {
+    FbObject o;
+    o.kind = String;
+    o.bytes = string{s};
+    return o;
+  }
+};
+
+inline void fb_align(string& b, size_t a) {
+  b.resize((b.size() + a - 1) / a * a);
+}
+
+template <typename S>
+void fb_put(string& b, S v) {
+  b.append(reinterpret_cast<const char*>(&v), sizeof(S));
+}
+
+template <typename S>
+void fb_set(string& b, size_t pos, S v) {
+  memcpy(&b[pos], &v, sizeof(S));
+}
+
+// @return position of the object.
+inline size_t fb_write(string& b, const FbObject& o) {
+  switch (o.kind) {
+    case FbObject::Table: {
+      uint16_t slots = 0;
+      for (auto& f : o.fields)
+        slots = max<uint16_t>(slots, f.slot + 1);
+      fb_align(b, 2);
+      auto vt = b.size();
+      b.resize(vt + 4 + slots * 2);
+      fb_set<uint16_t>(b, vt, static_cast<uint16_t>(4 + slots * 2));
+
+      fb_align(b, 4);
+      auto t = b.size();
+      fb_put<int32_t>(b, static_cast<int32_t>(t - vt));
+      vector<pair<size_t, size_t>> refs;
+      for (auto& f : o.fields) {
+        fb_align(b, f.size ? f.size : 4);
+        fb_set<uint16_t>(b, vt + 4 + f.slot * 2,
+                         static_cast<uint16_t>(b.size() - t));
+        if (f.size) {
+          b.append(reinterpret_cast<const char*>(&f.scalar), f.size);
+        } else {
+          refs.push_back({b.size(), f.child});
+          fb_put<uint32_t>(b, 0);
+        }
+      }
+      fb_set<uint16_t>(b, vt + 2, static_cast<uint16_t>(b.size() - t));
+      for (auto& [at, c] : refs) {
+        auto pos = fb_write(b, o.children[c]);
+        fb_set<uint32_t>(b, at, static_cast<uint32_t>(pos - at));
+      }
+      return t;
+    }
+    case FbObject::Vector: {
+      fb_align(b, 4);
+      auto p = b.size();
+      fb_put<uint32_t>(b, o.count);
+      b.resize(b.size() + o.count * 4);
+      for (size_t i = 0; i < o.count; i++) {
+        auto at = p + 4 + i * 4;
+        auto pos = fb_write(b, o.children[i]);
+        fb_set<uint32_t>(b, at, static_cast<uint32_t>(pos - at));
+      }
+      return p;
+    }
+    case FbObject::Structs: {
+      // the elements after the length are 8 bytes aligned.
+      fb_align(b, 4);
+      if (b.size() % 8 == 0)
+        fb_put<uint32_t>(b, 0);
+      auto p = b.size();
+      fb_put<uint32_t>(b, o.count);
+      b += o.bytes;
+      return p;
+    }
+    default: {
+      fb_align(b, 4);
+      auto p = b.size();
+      fb_put<uint32_t>(b, static_cast<uint32_t>(o.bytes.size()));
+      b += o.bytes;
+      b += '\0';
+      return p;
+    }
+  }
+}
+
+// Serialize the root table, padded to 8 bytes.
+inline string fb_finish(const FbObject& root) {
+  string b(4, '\0');
+  fb_set<uint32_t>(b, 0, static_cast<uint32_t>(fb_write(b, root)));
+  fb_align(b, 8);
+  return b;
+}
+
+// Bounds checked reader of flatbuffers tables.
+class FbTable {
+ public:
+  FbTable() = default;
+  FbTable(string_view buf, size_t pos) : buf_{buf}, pos_{pos} {
+    int32_t soff = 0;
+    auto    vt = read(pos, soff) ? static_cast<int64_t>(pos) - soff : -1;
+    if (vt < 0 || !read(static_cast<size_t>(vt), vtsize_))
+      buf_ = {};
+    vt_ = static_cast<size_t>(vt);
+  }
+
+  bool valid() const { return !buf_.empty(); }
+
+  template <typename S>
+  S get(uint16_t slot, S def = {}) const {
+    auto p = field(slot);
+    S    v = def;
+    if (p)
+      read(p, v);
+    return v;
+  }
+
+  FbTable table(uint16_t slot) const {
+    auto p = deref(slot);
+    return p ? FbTable{buf_, p} : FbTable{};
+  }
+
+  string_view str(uint16_t slot) const {
+    auto     p = deref(slot);
+    uint32_t n = 0;
+    if (!p || !read(p, n) || p + 4 + n > buf_.size())
+      return {};
+    return buf_.substr(p + 4, n);
+  }
+
+  // @return count of the elements, p is set to the first element.
+  uint32_t vec(uint16_t slot, size_t& p, size_t elem_size) const {
+    p = deref(slot);
+    uint32_t n = 0;
+    if (!p || !read(p, n) || p + 4 + size_t{n} * elem_size > buf_.size())
+      return 0;
+    p += 4;
+    return n;
+  }
+
+  // Element i of the vector of tables.
+  FbTable at(size_t p, uint32_t i) const {
+    uint32_t off = 0;
+    p += i * 4;
+    return read(p, off) ? FbTable{buf_, p + off} : FbTable{};
+  }
+
+  template <typename S>
+  bool read(size_t p, S& v) const {
+    return read_at(buf_, p, v);
+  }
+
+ private:
+  template <typename S>
+  static bool read_at(string_view b, size_t p, S& v) {
+    if (p + sizeof(S) > b.size())
+      return false;
+    memcpy(&v, b.data() + p, sizeof(S));
+    return true;
+  }
+
+  size_t field(uint16_t slot) const {
+    uint16_t off = 0;
+    if (!valid() || 4u + slot * 2u >= vtsize_ || !read(vt_ + 4 + slot * 2, off))
+      return 0;
+    return off ? pos_ + off : 0;
+  }
+
+  size_t deref(uint16_t slot) const {
+    auto     p = field(slot);
+    uint32_t off = 0;
+    return p && read(p, off) ? p + off : 0;
+  }
+
+  string_view buf_;
+  size_t      pos_ = 0;
+  size_t      vt_ = 0;
+  uint16_t    vtsize_ = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// arrow format
+//
+//////////////////////////////////////////////////////////////////////////
+
+enum class ArrowFormat { Stream, File };
+
+// Type ids of the Arrow schema.
+enum ArrowType : uint8_t {
+  ArrowNull = 1,
+  ArrowInt = 2,
+  ArrowFloat = 3,
+  ArrowBinary = 4,
+  ArrowUtf8 = 5,
+  ArrowBool = 6,
+  ArrowDecimal = 7,
+  ArrowDate = 8,
+  ArrowTime = 9,
+  ArrowTimestamp = 10,
+  ArrowInterval = 11,
+  ArrowList = 12,
+  ArrowStruct = 13,
+  ArrowFixedSizeBinary = 15,
+  ArrowFixedSizeList = 16,
+  ArrowMap = 17,
+  ArrowDuration = 18,
+  ArrowLargeBinary = 19,
+  ArrowLargeUtf8 = 20,
+  ArrowLargeList = 21,
+};
+
+enum ArrowHeader : uint8_t {
+  ArrowSchemaHeader = 1,
+  ArrowDictionaryHeader = 2,
+  ArrowRecordBatchHeader = 3,
+};
+
+constexpr int16_t arrow_version = 4;  // V5
+constexpr char    arrow_magic[] = "ARROW1";
+
+struct ArrowNode {
+  int64_t length;
+  int64_t null_count;
+};
+
+struct ArrowBuffer {
+  int64_t offset;
+  int64_t length;
+};
+
+struct ArrowBlock {
+  int64_t offset;
+  int32_t meta_length;
+  int32_t pad;
+  int64_t body_length;
+};
+
+// Body of a record batch, buffers are padded to 8 bytes.
+struct ArrowBody {
+  string              data;
+  vector<ArrowNode>   nodes;
+  vector<ArrowBuffer> buffers;
+
+  void add(const void* p, size_t n) {
+    buffers.push_back({static_cast<int64_t>(data.size()),
+                       static_cast<int64_t>(n)});
+    data.append(static_cast<const char*>(p), n);
+    fb_align(data, 8);
+  }
+
+  // validity bitmap can be omitted if there is no null.
+  void add_empty() {
+    buffers.push_back({static_cast<int64_t>(data.size()), 0});
+  }
+
+  FbObject record_batch(size_t rows) const {
+    FbObject r;
+    r.scalar<int64_t>(0, static_cast<int64_t>(rows))
+        .child(1, FbObject::structs(nodes.data(), sizeof(ArrowNode),
+                                    nodes.size()))
+        .child(2, FbObject::structs(buffers.data(), sizeof(ArrowBuffer),
+                                    buffers.size()));
+    return r;
+  }
+};
+
+inline FbObject arrow_message(ArrowHeader type, FbObject header, size_t body) {
+  FbObject m;
+  m.scalar<int16_t>(0, arrow_version)
+      .scalar<uint8_t>(1, type)
+      .child(2, move(header))
+      .scalar<int64_t>(3, static_cast<int64_t>(body));
+  return m;
+}
+
+template <typename M>
+constexpr auto is_arrow_string_v =
+    is_same_v<M, string> || is_same_v<M, string_view>;
+
+template <typename M>
+constexpr auto is_arrow_dict_v = [] {
+  if constexpr (is_enum_v<M>)
+    return is_reflected_enum_v<M>;
+  else
+    return false;
+}();
+
+template <typename M>
+constexpr auto is_arrow_field_v = is_arithmetic_v<M> || is_enum_v<M> ||
+                                  is_arrow_string_v<M> ||
+                                  (is_class_v<M> && is_reflected_v<M>);
+
+// @param f: [](auto info) for fields can be mapped to Arrow.
+template <typename M, typename F>
+void each_arrow_field(F&& f) {
+  apply(
+      [&](auto... fs) {
+        (
+            [&](auto info) {
+              if constexpr (is_arrow_field_v<
+                                typename decltype(info)::member_t>)
+                f(info);
+            }(fs),
+            ...);
+      },
+      data_fields<M>());
+}
+
+inline FbObject arrow_int_type(int bits, bool is_signed) {
+  FbObject t;
+  t.scalar<int32_t>(0, bits).scalar<uint8_t>(1, is_signed);
+  return t;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// writing
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Schema field of M, dictionaries are numbered in the pre-order.
+template <typename M>
+FbObject arrow_schema_field(string_view name, int64_t& dict_id) {
+  FbObject f, type;
+  uint8_t  type_id;
+  vector<FbObject> children;
+
+  if constexpr (is_same_v<M, bool>) {
+    type_id = ArrowBool;
+  } else if constexpr (is_floating_point_v<M>) {
+    type_id = ArrowFloat;
+    type.scalar<int16_t>(0, sizeof(M) == 4 ? 1 : 2);
+  } else if constexpr (is_integral_v<M>) {
+    type_id = ArrowInt;
+    type = arrow_int_type(sizeof(M) * 8, is_signed_v<M>);
+  } else if constexpr (is_arrow_dict_v<M>) {
+    type_id = ArrowUtf8;
+    FbObject dict;
+    dict.scalar<int64_t>(0, dict_id++).child(1, arrow_int_type(32, true));
+    f.child(4, move(dict));
+  } else if constexpr (is_enum_v<M>) {
+    using U = underlying_type_t<M>;
+    type_id = ArrowInt;
+    type = arrow_int_type(sizeof(U) * 8, is_signed_v<U>);
+  } else if constexpr (is_arrow_string_v<M>) {
+    type_id = ArrowUtf8;
+  } else {
+    type_id = ArrowStruct;
+    each_arrow_field<M>([&](auto info) {
+      using C = typename decltype(info)::member_t;
+      children.push_back(arrow_schema_field<C>(info.name, dict_id));
+    });
+  }
+  f.child(0, FbObject::string_of(name))
+      .scalar<uint8_t>(1, 1)
+      .scalar<uint8_t>(2, type_id)
+      .child(3, move(type))
+      .child(5, FbObject::vector_of(move(children)));
+  return f;
+}
+
+template <typename T>
+FbObject arrow_schema() {
+  vector<FbObject> fields;
+  int64_t          dict_id = 0;
+  each_arrow_field<T>([&](auto info) {
+    using M = typename decltype(info)::member_t;
+    fields.push_back(arrow_schema_field<M>(info.name, dict_id));
+  });
+  FbObject s;
+  s.scalar<int16_t>(0, 0).child(1, FbObject::vector_of(move(fields)));
+  return s;
+}
+
+template <typename S>
+void arrow_add_strings(ArrowBody& body, size_t n, S&& str_at) {
+  vector<int32_t> offsets(n + 1);
+  string          chars;
+  for (size_t i = 0; i < n; i++) {
+    string_view s = str_at(i);
+    chars.append(s.data(), s.size());
+    offsets[i + 1] = static_cast<int32_t>(chars.size());
+  }
+  body.add_empty();
+  body.add(offsets.data(), offsets.size() * 4);
+  body.add(chars.data(), chars.size());
+}
+
+// @param f: [](int64_t id, const ArrowBody& dictionary)
+template <typename M, typename F>
+void arrow_each_dictionary(F&& f, int64_t& dict_id) {
+  if constexpr (is_arrow_dict_v<M>) {
+    constexpr auto items = enum_info<M>().items;
+    ArrowBody body;
+    body.nodes.push_back({static_cast<int64_t>(items.size()), 0});
+    arrow_add_strings(body, items.size(),
+                      [&](size_t i) { return items[i].name; });
+    f(dict_id++, body);
+  } else if constexpr (is_class_v<M> && !is_arrow_string_v<M>) {
+    each_arrow_field<M>([&](auto info) {
+      arrow_each_dictionary<typename decltype(info)::member_t>(f, dict_id);
+    });
+  }
+}
+
+// Append the buffers of the field at base of each row to the body.
+template <typename M>
+void arrow_write_column(ArrowBody&  body,
+                        const char* base,
+                        size_t      stride,
+                        size_t      n) {
+  auto at = [&](size_t i) -> const M& {
+    return *reinterpret_cast<const M*>(base + i * stride);
+  };
+  body.nodes.push_back({static_cast<int64_t>(n), 0});
+
+  if constexpr (is_same_v<M, bool>) {
+    string bits((n + 7) / 8, '\0');
+    for (size_t i = 0; i < n; i++)
+      bits[i / 8] |= static_cast<char>(at(i) << (i % 8));
+    body.add_empty();
+    body.add(bits.data(), bits.size());
+  } else if constexpr (is_arrow_dict_v<M>) {
+    constexpr auto items = enum_info<M>().items;
+    vector<int32_t> idx(n);
+    for (size_t i = 0; i < n; i++) {
+      for (int32_t k = 0; k < static_cast<int32_t>(items.size()); k++) {
+        if (items[k].value == at(i)) {
+          idx[i] = k;
+          break;
+        }
+      }
+    }
+    body.add_empty();
+    body.add(idx.data(), n * 4);
+  } else if constexpr (is_arithmetic_v<M> || is_enum_v<M>) {
+    vector<M> vals(n);
+    for (size_t i = 0; i < n; i++)
+      vals[i] = at(i);
+    body.add_empty();
+    body.add(vals.data(), n * sizeof(M));
+  } else if constexpr (is_arrow_string_v<M>) {
+    arrow_add_strings(body, n, [&](size_t i) { return string_view{at(i)}; });
+  } else {
+    body.add_empty();
+    each_arrow_field<M>([&](auto info) {
+      using C = typename decltype(info)::member_t;
+      auto p = n ? reinterpret_cast<const char*>(&(at(0).*info.value)) : base;
+      arrow_write_column<C>(body, p, stride, n);
+    });
+  }
+}
+
+// Write the objects as record batches of the Arrow IPC stream or file format.
+// Arithmetic, string, reflected enum(dictionary of item names) & reflected
+// class(struct) fields are mapped, others are skipped.
+template <typename T>
+class ArrowWriter {
+ public:
+  explicit ArrowWriter(ostream& out, ArrowFormat fmt = ArrowFormat::Stream)
+      : out_{out}, fmt_{fmt} {}
+  ArrowWriter(const ArrowWriter&) = delete;
+  ArrowWriter& operator=(const ArrowWriter&) = delete;
+  ~ArrowWriter() { close(); }
+
+  // Write the rows as one record batch.
+  void write(Span<const T> rows) {
+    begin();
+    ArrowBody body;
+    each_arrow_field<T>([&](auto info) {
+      using M = typename decltype(info)::member_t;
+      auto p = rows.empty()
+                   ? nullptr
+                   : reinterpret_cast<const char*>(&(rows[0].*info.value));
+      arrow_write_column<M>(body, p, sizeof(T), rows.size());
+    });
+    batches_.push_back(message(ArrowRecordBatchHeader,
+                               body.record_batch(rows.size()), body.data));
+  }
+
+  // Write the end of stream & the footer of file.
+  void close() {
+    if (closed_)
+      return;
+    begin();
+    closed_ = true;
+    put<uint32_t>(0xFFFFFFFF);
+    put<uint32_t>(0);
+    if (fmt_ == ArrowFormat::File) {
+      FbObject footer;
+      footer.scalar<int16_t>(0, arrow_version)
+          .child(1, arrow_schema<T>())
+          .child(2, FbObject::structs(dicts_.data(), sizeof(ArrowBlock),
+                                      dicts_.size()))
+          .child(3, FbObject::structs(batches_.data(), sizeof(ArrowBlock),
+                                      batches_.size()));
+      auto fb = fb_finish(footer);
+      write_bytes(fb.data(), fb.size());
+      put<int32_t>(static_cast<int32_t>(fb.size()));
+      write_bytes(arrow_magic, 6);
+    }
+    out_.flush();
+  }
+
+ private:
+  template <typename S>
+  void put(S v) {
+    write_bytes(&v, sizeof(S));
+  }
+
+  void write_bytes(const void* p, size_t n) {
+    out_.write(static_cast<const char*>(p), static_cast<streamsize>(n));
+    pos_ += n;
+  }
+
+  ArrowBlock message(ArrowHeader type, FbObject header, const string& body) {
+    auto       fb = fb_finish(arrow_message(type, move(header), body.size()));
+    ArrowBlock b{static_cast<int64_t>(pos_),
+                 static_cast<int32_t>(fb.size() + 8), 0,
+                 static_cast<int64_t>(body.size())};
+    put<uint32_t>(0xFFFFFFFF);
+    put<int32_t>(static_cast<int32_t>(fb.size()));
+    write_bytes(fb.data(), fb.size());
+    write_bytes(body.data(), body.size());
+    return b;
+  }
+
+  // Write the magic, schema & dictionaries before the first batch.
+  void begin() {
+    if (started_)
+      return;
+    started_ = true;
+    if (fmt_ == ArrowFormat::File)
+      write_bytes("ARROW1\0\0", 8);
+    message(ArrowSchemaHeader, arrow_schema<T>(), {});
+
+    int64_t dict_id = 0;
+    each_arrow_field<T>([&](auto info) {
+      using M = typename decltype(info)::member_t;
+      auto add = [&](int64_t id, const ArrowBody& body) {
+        FbObject d;
+        d.scalar<int64_t>(0, id).child(
+            1, body.record_batch(static_cast<size_t>(body.nodes[0].length)));
+        dicts_.push_back(message(ArrowDictionaryHeader, move(d), body.data));
+      };
+      arrow_each_dictionary<M>(add, dict_id);
+    });
+  }
+
+  ostream&           out_;
+  ArrowFormat        fmt_;
+  size_t             pos_ = 0;
+  bool               started_ = false;
+  bool               closed_ = false;
+  vector<ArrowBlock> dicts_;
+  vector<ArrowBlock> batches_;
+};
+
+template <typename T>
+void write_arrow(ostream&      out,
+                 Span<const T> rows,
+                 ArrowFormat   fmt = ArrowFormat::Stream) {
+  ArrowWriter<T> w{out, fmt};
+  w.write(rows);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// reading
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field of the schema read, with the index of its node & first buffer in the
+// record batches.
+struct ArrowField {
+  string             name;
+  uint8_t            type = 0;
+  int                bits = 0;  // of int & float.
+  bool               is_signed = true;
+  int64_t            dict_id = -1;
+  int                index_bits = 32;
+  bool               index_signed = true;
+  size_t             node = 0;
+  size_t             buffer = 0;
+  vector<ArrowField> children;
+};
+
+// Nodes & buffers are addressed in the message, which may be unaligned.
+struct ArrowBatch {
+  string_view body;
+  const char* nodes;
+  size_t      node_count;
+  const char* buffers;
+  size_t      buffer_count;
+
+  bool node(size_t i, ArrowNode& n) const {
+    if (i >= node_count)
+      return false;
+    memcpy(&n, nodes + i * sizeof(n), sizeof(n));
+    return true;
+  }
+
+  // @return empty if out of range.
+  string_view buffer(size_t i) const {
+    if (i >= buffer_count)
+      return {};
+    ArrowBuffer b;
+    memcpy(&b, buffers + i * sizeof(b), sizeof(b));
+    if (b.offset < 0 || b.length < 0 ||
+        static_cast<uint64_t>(b.offset) > body.size() ||
+        static_cast<uint64_t>(b.length) >
+            body.size() - static_cast<size_t>(b.offset))
+      return {};
+    return body.substr(static_cast<size_t>(b.offset),
+                       static_cast<size_t>(b.length));
+  }
+};
+
+class ArrowReaderBase {
+ protected:
+  bool fail(string msg) {
+    if (error_.empty())
+      error_ = move(msg);
+    return false;
+  }
+
+  bool parse_field(const FbTable& t, ArrowField& f, size_t& node,
+                   size_t& buffer) {
+    if (!t.valid())
+      return fail("invalid field");
+    f.name = string{t.str(0)};
+    f.type = t.get<uint8_t>(2);
+    auto type = t.table(3);
+    if (f.type == ArrowInt) {
+      f.bits = type.get<int32_t>(0);
+      f.is_signed = type.get<uint8_t>(1);
+    } else if (f.type == ArrowFloat) {
+      f.bits = type.get<int16_t>(0) == 2 ? 64 : type.get<int16_t>(0) ? 32 : 16;
+    }
+    if (auto d = t.table(4); d.valid()) {
+      f.dict_id = d.get<int64_t>(0);
+      auto it = d.table(1);
+      f.index_bits = it.get<int32_t>(0, 32);
+      f.index_signed = it.valid() ? it.get<uint8_t>(1) : true;
+      if (f.index_bits != 8 && f.index_bits != 16 && f.index_bits != 32 &&
+          f.index_bits != 64)
+        return fail("invalid dictionary index width of field " + f.name);
+    }
+
+    f.node = node++;
+    f.buffer = buffer;
+    switch (f.dict_id >= 0 ? uint8_t{ArrowInt} : f.type) {
+      case ArrowNull: break;
+      case ArrowStruct: buffer += 1; break;
+      case ArrowFixedSizeList: buffer += 1; break;
+      case ArrowBinary:
+      case ArrowUtf8:
+      case ArrowLargeBinary:
+      case ArrowLargeUtf8: buffer += 3; break;
+      case ArrowInt:
+      case ArrowFloat:
+      case ArrowBool:
+      case ArrowDecimal:
+      case ArrowDate:
+      case ArrowTime:
+      case ArrowTimestamp:
+      case ArrowInterval:
+      case ArrowList:
+      case ArrowFixedSizeBinary:
+      case ArrowMap:
+      case ArrowDuration:
+      case ArrowLargeList: buffer += 2; break;
+      default: return fail("unsupported type of field " + f.name);
+    }
+
+    size_t   p = 0;
+    uint32_t n = t.vec(5, p, 4);
+    for (uint32_t i = 0; i < n; i++) {
+      f.children.emplace_back();
+      if (!parse_field(t.at(p, i), f.children.back(), node, buffer))
+        return false;
+    }
+    return true;
+  }
+
+  bool parse_batch(const FbTable& r, string_view body, ArrowBatch& b) {
+    size_t p = 0;
+    b.body = body;
+    b.node_count = r.vec(1, p, sizeof(ArrowNode));
+    b.nodes = buf_.data() + p;
+    b.buffer_count = r.vec(2, p, sizeof(ArrowBuffer));
+    b.buffers = buf_.data() + p;
+    if (r.table(3).valid())
+      return fail("compressed batch is not supported");
+    return true;
+  }
+
+  bool parse_dictionary(const FbTable& d, string_view body) {
+    auto       id = d.get<int64_t>(0);
+    ArrowBatch b;
+    if (!parse_batch(d.table(1), body, b))
+      return false;
+    auto offsets = b.buffer(1), chars = b.buffer(2);
+    auto n = d.table(1).get<int64_t>(0);
+    if (b.node_count != 1 || b.buffer_count != 3 || n < 0 ||
+        offsets.size() < static_cast<size_t>(n + 1) * 4)
+      return fail("only utf8 dictionaries are supported");
+
+    auto& dict = dicts_[id];
+    if (!d.get<uint8_t>(2))
+      dict.clear();
+    for (int64_t i = 0; i < n; i++) {
+      int32_t s, e;
+      memcpy(&s, offsets.data() + i * 4, 4);
+      memcpy(&e, offsets.data() + i * 4 + 4, 4);
+      if (s < 0 || e < s || static_cast<size_t>(e) > chars.size())
+        return fail("invalid dictionary");
+      dict.push_back(string{chars.substr(s, e - s)});
+    }
+    return true;
+  }
+
+  // Read the next message.
+  // @return false at the end of stream.
+  bool next(FbTable& msg, string_view& body) {
+    if (pos_ + 8 > buf_.size())
+      return false;
+    uint32_t len;
+    memcpy(&len, buf_.data() + pos_, 4);
+    pos_ += 4;
+    if (len == 0xFFFFFFFF) {
+      memcpy(&len, buf_.data() + pos_, 4);
+      pos_ += 4;
+    }
+    if (len == 0 || pos_ + len > buf_.size())
+      return false;
+
+    // tables read the whole buffer, to address the structs by position.
+    uint32_t root;
+    memcpy(&root, buf_.data() + pos_, 4);
+    msg = FbTable{buf_, pos_ + root};
+    if (!msg.valid())
+      return fail("invalid message");
+    pos_ += len;
+    auto body_len = static_cast<size_t>(msg.get<int64_t>(3));
+    if (pos_ + body_len > buf_.size())
+      return fail("truncated body");
+    body = buf_.substr(pos_, body_len);
+    pos_ += body_len;
+    return true;
+  }
+
+  string_view                     buf_;
+  size_t                          pos_ = 0;
+  string                          error_;
+  vector<ArrowField>              schema_;
+  map<int64_t, vector<string>>    dicts_;
+};
+
+template <typename S, typename M>
+void arrow_read_values(string_view src,
+                       string_view valid,
+                       char*       base,
+                       size_t      stride,
+                       size_t      n) {
+  for (size_t i = 0; i < n; i++) {
+    if (!valid.empty() && !((valid[i / 8] >> (i % 8)) & 1))
+      continue;
+    S v;
+    memcpy(&v, src.data() + i * sizeof(S), sizeof(S));
+    *reinterpret_cast<M*>(base + i * stride) = static_cast<M>(v);
+  }
+}
+
+// Read the objects from the Arrow IPC stream or file, fields are matched by
+// names, the fields not found or nulls are left with the default values.
+template <typename T>
+class ArrowReader : ArrowReaderBase {
+ public:
+  // @param data: the whole stream or file, should be kept during reading.
+  explicit ArrowReader(string_view data) {
+    buf_ = data;
+    if (data.substr(0, 6) == string_view{arrow_magic, 6})
+      pos_ = 8;
+  }
+
+  // Append the rows of all the batches.
+  // @return false if failed, see error().
+  bool read(vector<T>& rows) {
+    FbTable     msg;
+    string_view body;
+    while (next(msg, body)) {
+      auto header = msg.table(2);
+      switch (msg.get<uint8_t>(1)) {
+        case ArrowSchemaHeader: {
+          size_t p = 0, node = 0, buffer = 0;
+          auto   n = header.vec(1, p, 4);
+          schema_.assign(n, {});
+          for (uint32_t i = 0; i < n; i++) {
+            if (!parse_field(header.at(p, i), schema_[i], node, buffer))
+              return false;
+          }
+          break;
+        }
+        case ArrowDictionaryHeader:
+          if (!parse_dictionary(header, body))
+            return false;
+          break;
+        case ArrowRecordBatchHeader: {
+          ArrowBatch b;
+          auto       n = header.get<int64_t>(0);
+          if (n < 0 || !parse_batch(header, body, b))
+            return fail("invalid record batch");
+          // values take a bit at least except of null columns, checked
+          // before the rows are allocated.
+          auto has_data = any_of(schema_.begin(), schema_.end(), [](auto& f) {
+            return f.type != ArrowNull || f.dict_id >= 0;
+          });
+          if (has_data && static_cast<uint64_t>(n) / 8 > body.size())
+            return fail("invalid record batch");
+          auto old = rows.size();
+          rows.resize(old + static_cast<size_t>(n));
+          if (n && !read_fields<T>(reinterpret_cast<char*>(&rows[old]),
+                                   sizeof(T), static_cast<size_t>(n), schema_,
+                                   b))
+            return false;
+          break;
+        }
+        default: break;
+      }
+    }
+    return error_.empty();
+  }
+
+  const string& error() const { return error_; }
+
+ private:
+  template <typename M>
+  bool read_fields(char*                     base,
+                   size_t                    stride,
+                   size_t                    n,
+                   const vector<ArrowField>& fields,
+                   const ArrowBatch&         b) {
+    auto ok = true;
+    each_arrow_field<M>([&](auto info) {
+      using C = typename decltype(info)::member_t;
+      for (auto& f : fields) {
+        if (ok && f.name == info.name) {
+          auto p = reinterpret_cast<char*>(
+              &(reinterpret_cast<M*>(base)->*info.value));
+          ok = read_column<C>(p, stride, n, f, b);
+        }
+      }
+    });
+    return ok;
+  }
+
+  template <typename M>
+  bool read_column(char*             base,
+                   size_t            stride,
+                   size_t            n,
+                   const ArrowField& f,
+                   const ArrowBatch& b) {
+    ArrowNode node;
+    if (!b.node(f.node, node))
+      return fail("missing node of field " + f.name);
+    if (node.length < static_cast<int64_t>(n))
+      return fail("short column of field " + f.name);
+    auto valid = b.buffer(f.buffer);
+    if (!valid.empty() && valid.size() * 8 < n)
+      return fail("short validity of field " + f.name);
+    auto at = [&](size_t i) -> M& {
+      return *reinterpret_cast<M*>(base + i * stride);
+    };
+    auto is_null = [&](size_t i) {
+      return !valid.empty() && !((valid[i / 8] >> (i % 8)) & 1);
+    };
+
+    if (f.dict_id >= 0) {
+      if constexpr (is_arrow_dict_v<M> || is_same_v<M, string>) {
+        auto it = dicts_.find(f.dict_id);
+        auto idx = b.buffer(f.buffer + 1);
+        auto width = static_cast<size_t>(f.index_bits / 8);
+        if (it == dicts_.end() || idx.size() / width < n)
+          return fail("missing dictionary of field " + f.name);
+        auto& dict = it->second;
+        for (size_t i = 0; i < n; i++) {
+          if (is_null(i))
+            continue;
+          uint64_t u = 0;
+          memcpy(&u, idx.data() + i * width, width);
+          auto k = static_cast<int64_t>(u);
+          if (f.index_signed && width < 8) {
+            auto sign = uint64_t{1} << (width * 8 - 1);
+            k = static_cast<int64_t>((u ^ sign) - sign);
+          }
+          if (k < 0 || static_cast<size_t>(k) >= dict.size())
+            return fail("invalid dictionary index of field " + f.name);
+          if constexpr (is_arrow_dict_v<M>)
+            at(i) = string_to_enum(dict[k], at(i));
+          else
+            at(i) = dict[k];
+        }
+        return true;
+      }
+    } else if (f.type == ArrowBool) {
+      if constexpr (is_arithmetic_v<M>) {
+        auto bits = b.buffer(f.buffer + 1);
+        if (bits.size() * 8 < n)
+          return fail("short column of field " + f.name);
+        for (size_t i = 0; i < n; i++) {
+          if (!is_null(i))
+            at(i) = static_cast<M>((bits[i / 8] >> (i % 8)) & 1);
+        }
+        return true;
+      }
+    } else if (f.type == ArrowInt || f.type == ArrowFloat) {
+      if constexpr (is_arithmetic_v<M> ||
+                    (is_enum_v<M> && !is_arrow_dict_v<M>)) {
+        auto vals = b.buffer(f.buffer + 1);
+        if (vals.size() * 8 < n * f.bits)
+          return fail("short column of field " + f.name);
+        auto read = [&](auto s) {
+          arrow_read_values<decltype(s), M>(vals, valid, base, stride, n);
+          return true;
+        };
+        auto fp = f.type == ArrowFloat;
+        switch (f.bits) {
+          case 8: return f.is_signed ? read(int8_t{}) : read(uint8_t{});
+          case 16: return f.is_signed ? read(int16_t{}) : read(uint16_t{});
+          case 32:
+            return fp ? read(float{})
+                      : f.is_signed ? read(int32_t{}) : read(uint32_t{});
+          case 64:
+            return fp ? read(double{})
+                      : f.is_signed ? read(int64_t{}) : read(uint64_t{});
+          default: return fail("unsupported width of field " + f.name);
+        }
+      }
+    } else if (f.type == ArrowUtf8) {
+      if constexpr (is_same_v<M, string>) {
+        auto offsets = b.buffer(f.buffer + 1), chars = b.buffer(f.buffer + 2);
+        if (offsets.size() < (n + 1) * 4)
+          return fail("short column of field " + f.name);
+        for (size_t i = 0; i < n; i++) {
+          int32_t s, e;
+          memcpy(&s, offsets.data() + i * 4, 4);
+          memcpy(&e, offsets.data() + i * 4 + 4, 4);
+          if (s < 0 || e < s || static_cast<size_t>(e) > chars.size())
+            return fail("invalid string of field " + f.name);
+          if (!is_null(i))
+            at(i).assign(chars.data() + s, static_cast<size_t>(e - s));
+        }
+        return true;
+      }
+    } else if (f.type == ArrowStruct) {
+      if constexpr (is_class_v<M> && is_reflected_v<M>)
+        return read_fields<M>(base, stride, n, f.children, b);
+    }
+    return fail("type mismatch of field " + f.name);
+  }
+};
+
+// @return false if failed, the error is set if not null.
+template <typename T>
+bool read_arrow(string_view data, vector<T>& rows, string* error = nullptr) {
+  ArrowReader<T> r{data};
+  auto           ok = r.read(rows);
+  if (!ok && error)
+    *error = r.error();
+  return ok;
+}
+
+}  // namespace imp
+
+using imp::ArrowFormat;
+using imp::ArrowReader;
+using imp::ArrowWriter;
+using imp::read_arrow;
+using imp::write_arrow;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,433 @@
+// Tref: batch kernels over arrays of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_BATCH_H
+#define TREF_BATCH_H
+#pragma once
+
+#include "Tref.hpp"
+#include "TrefSoa.hpp"
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// field traits
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field meta: valid range of the field, used by clamp_by_meta.
+// Any meta with minV & maxV members is accepted as well.
+template <typename T>
+struct MetaRange {
+  T minV, maxV;
+};
+
+template <typename M, typename = void>
+struct has_range_meta : false_type {};
+
+template <typename M>
+struct has_range_meta<
+    M,
+    void_t<decltype(declval<M>().minV), decltype(declval<M>().maxV)>>
+    : true_type {};
+
+template <typename T>
+constexpr auto is_blendable_v = is_arithmetic_v<T> && !is_same_v<T, bool>;
+
+// Accessor of the object itself.
+struct LeafSelf {
+  template <typename V>
+  V& operator()(V& v) const {
+    return v;
+  }
+};
+
+// Apply f to the fields of reflected type recursively, once per field rather
+// than once per object, so the kernels run one tight loop over the array for
+// each field.
+// @param f: [](auto info, auto leaf), leaf(obj) is the field of obj.
+template <typename T, typename F, typename G = LeafSelf>
+void each_leaf_field(F& f, G leaf_of_t = {}) {
+  apply(
+      [&](auto... info) {
+        (
+            [&] {
+              using M = typename decltype(info)::member_t;
+              auto leaf = [leaf_of_t, ptr = info.value](auto& obj) -> auto& {
+                return leaf_of_t(obj).*ptr;
+              };
+              if constexpr (is_reflected_v<M>) {
+                each_leaf_field<M>(f, leaf);
+              } else {
+                f(info, leaf);
+              }
+            }(),
+            ...);
+      },
+      data_fields<T>());
+}
+
+// If all the leaf fields are of type S and T has no padding, arrays of T can
+// be processed as plain arrays of S.
+template <typename T, typename S>
+constexpr bool all_leaves_are() {
+  if constexpr (is_reflected_v<T>) {
+    return apply(
+        [](auto... info) {
+          return (all_leaves_are<typename decltype(info)::member_t, S>() &&
+                  ...);
+        },
+        data_fields<T>());
+  } else {
+    return is_same_v<T, S>;
+  }
+}
+
+template <typename T>
+constexpr size_t leaf_count() {
+  if constexpr (is_reflected_v<T>) {
+    return apply(
+        [](auto... info) {
+          return (leaf_count<typename decltype(info)::member_t>() + ... + 0);
+        },
+        data_fields<T>());
+  } else {
+    return 1;
+  }
+}
+
+template <typename T, typename S>
+constexpr bool is_flat_of_v = is_trivially_copyable_v<T> &&
+                              all_leaves_are<T, S>() &&
+                              sizeof(T) == leaf_count<T>() * sizeof(S);
+
+//////////////////////////////////////////////////////////////////////////
+//
+// flat kernels
+//
+//////////////////////////////////////////////////////////////////////////
+
+inline void lerp_flat(const float* a,
+                      const float* b,
+                      float        t,
+                      float*       out,
+                      size_t       n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  auto t8 = _mm256_set1_ps(t);
+  for (; i + 8 <= n; i += 8) {
+    auto va = _mm256_loadu_ps(a + i);
+    auto d = _mm256_sub_ps(_mm256_loadu_ps(b + i), va);
+#if defined(__FMA__)
+    _mm256_storeu_ps(out + i, _mm256_fmadd_ps(d, t8, va));
+#else
+    _mm256_storeu_ps(out + i, _mm256_add_ps(va, _mm256_mul_ps(d, t8)));
+#endif
+  }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+  auto t4 = _mm_set1_ps(t);
+  for (; i + 4 <= n; i += 4) {
+    auto va = _mm_loadu_ps(a + i);
+    auto d = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+    _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(d, t4)));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+inline void lerp_flat(const double* a,
+                      const double* b,
+                      double        t,
+                      double*       out,
+                      size_t        n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  auto t4 = _mm256_set1_pd(t);
+  for (; i + 4 <= n; i += 4) {
+    auto va = _mm256_loadu_pd(a + i);
+    auto d = _mm256_sub_pd(_mm256_loadu_pd(b + i), va);
+    _mm256_storeu_pd(out + i, _mm256_add_pd(va, _mm256_mul_pd(d, t4)));
+  }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+  auto t2 = _mm_set1_pd(t);
+  for (; i + 2 <= n; i += 2) {
+    auto va = _mm_loadu_pd(a + i);
+    auto d = _mm_sub_pd(_mm_loadu_pd(b + i), va);
+    _mm_storeu_pd(out + i, _mm_add_pd(va, _mm_mul_pd(d, t2)));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+inline void axpy_flat(float alpha, const float* x, float* y, size_t n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  auto a8 = _mm256_set1_ps(alpha);
+  for (; i + 8 <= n; i += 8) {
+    auto vx = _mm256_loadu_ps(x + i);
+    auto vy = _mm256_loadu_ps(y + i);
+#if defined(__FMA__)
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a8, vx, vy));
+#else
+    _mm256_storeu_ps(y + i, _mm256_add_ps(vy, _mm256_mul_ps(a8, vx)));
+#endif
+  }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+  auto a4 = _mm_set1_ps(alpha);
+  for (; i + 4 <= n; i += 4) {
+    auto vx = _mm_loadu_ps(x + i);
+    auto vy = _mm_loadu_ps(y + i);
+    _mm_storeu_ps(y + i, _mm_add_ps(vy, _mm_mul_ps(a4, vx)));
+  }
+#endif
+  for (; i < n; i++)
+    y[i] += alpha * x[i];
+}
+
+inline void axpy_flat(double alpha, const double* x, double* y, size_t n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  auto a4 = _mm256_set1_pd(alpha);
+  for (; i + 4 <= n; i += 4) {
+    auto vx = _mm256_loadu_pd(x + i);
+    auto vy = _mm256_loadu_pd(y + i);
+    _mm256_storeu_pd(y + i, _mm256_add_pd(vy, _mm256_mul_pd(a4, vx)));
+  }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+  auto a2 = _mm_set1_pd(alpha);
+  for (; i + 2 <= n; i += 2) {
+    auto vx = _mm_loadu_pd(x + i);
+    auto vy = _mm_loadu_pd(y + i);
+    _mm_storeu_pd(y + i, _mm_add_pd(vy, _mm_mul_pd(a2, vx)));
+  }
+#endif
+  for (; i < n; i++)
+    y[i] += alpha * x[i];
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// field-wise kernels
+//
+//////////////////////////////////////////////////////////////////////////
+
+// out[i] = a[i] + (b[i] - a[i]) * t for the field selected by leaf, copied
+// from a if not arithmetic.
+template <typename L, typename T>
+void lerp_leaf(L leaf, const T* a, const T* b, double t, T* out, size_t n) {
+  using M = remove_reference_t<decltype(leaf(*out))>;
+  if constexpr (is_floating_point_v<M>) {
+    auto s = static_cast<M>(t);
+    for (size_t i = 0; i < n; i++) {
+      auto x = leaf(a[i]);
+      leaf(out[i]) = x + (leaf(b[i]) - x) * s;
+    }
+  } else if constexpr (is_blendable_v<M>) {
+    for (size_t i = 0; i < n; i++) {
+      auto x = static_cast<double>(leaf(a[i]));
+      leaf(out[i]) = static_cast<M>(x + (leaf(b[i]) - x) * t);
+    }
+  } else {
+    for (size_t i = 0; i < n; i++)
+      leaf(out[i]) = leaf(a[i]);
+  }
+}
+
+// y[i] += alpha * x[i] for the field selected by leaf if arithmetic.
+template <typename L, typename T>
+void axpy_leaf(L leaf, double alpha, const T* x, T* y, size_t n) {
+  using M = remove_reference_t<decltype(leaf(*y))>;
+  if constexpr (is_floating_point_v<M>) {
+    auto s = static_cast<M>(alpha);
+    for (size_t i = 0; i < n; i++)
+      leaf(y[i]) += s * leaf(x[i]);
+  } else if constexpr (is_blendable_v<M>) {
+    for (size_t i = 0; i < n; i++)
+      leaf(y[i]) = static_cast<M>(leaf(y[i]) + alpha * leaf(x[i]));
+  }
+}
+
+// out = a + (b - a) * t for the arithmetic fields(nested reflected types
+// included), other fields are copied from a.
+// Types made of floats or doubles only are run as plain arrays by the SIMD
+// kernels, the others by one strided loop per field.
+template <typename T>
+void lerp(const T* a, const T* b, double t, T* out, size_t n) {
+  if constexpr (is_flat_of_v<T, float>) {
+    lerp_flat(reinterpret_cast<const float*>(a),
+              reinterpret_cast<const float*>(b), static_cast<float>(t),
+              reinterpret_cast<float*>(out), n * leaf_count<T>());
+  } else if constexpr (is_flat_of_v<T, double>) {
+    lerp_flat(reinterpret_cast<const double*>(a),
+              reinterpret_cast<const double*>(b), t,
+              reinterpret_cast<double*>(out), n * leaf_count<T>());
+  } else if constexpr (is_reflected_v<T>) {
+    auto f = [&](auto, auto leaf) { lerp_leaf(leaf, a, b, t, out, n); };
+    each_leaf_field<T>(f);
+  } else {
+    lerp_leaf(LeafSelf{}, a, b, t, out, n);
+  }
+}
+
+// y += alpha * x for the arithmetic fields(nested reflected types included).
+template <typename T>
+void axpy(double alpha, const T* x, T* y, size_t n) {
+  if constexpr (is_flat_of_v<T, float>) {
+    axpy_flat(static_cast<float>(alpha), reinterpret_cast<const float*>(x),
+              reinterpret_cast<float*>(y), n * leaf_count<T>());
+  } else if constexpr (is_flat_of_v<T, double>) {
+    axpy_flat(alpha, reinterpret_cast<const double*>(x),
+              reinterpret_cast<double*>(y), n * leaf_count<T>());
+  } else if constexpr (is_reflected_v<T>) {
+    auto f = [&](auto, auto leaf) { axpy_leaf(leaf, alpha, x, y, n); };
+    each_leaf_field<T>(f);
+  } else {
+    axpy_leaf(LeafSelf{}, alpha, x, y, n);
+  }
+}
+
+// Clamp the arithmetic fields having a range meta(e.g. MetaRange).
+template <typename T>
+void clamp_by_meta(T* objs, size_t n) {
+  auto f = [&](auto info, auto leaf) {
+    using M = remove_reference_t<decltype(leaf(*objs))>;
+    if constexpr (is_blendable_v<M> && has_range_meta<decltype(info.meta)>{}) {
+      auto lo = static_cast<M>(info.meta.minV);
+      auto hi = static_cast<M>(info.meta.maxV);
+      for (size_t i = 0; i < n; i++) {
+        auto& v = leaf(objs[i]);
+        v = v < lo ? lo : (hi < v ? hi : v);
+      }
+    }
+  };
+  each_leaf_field<T>(f);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// column kernels
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T, size_t... Is>
+void lerp_columns(const SoaVector<T>& a,
+                  const SoaVector<T>& b,
+                  double              t,
+                  SoaVector<T>&       out,
+                  index_sequence<Is...>) {
+  (
+      [&] {
+        if constexpr (SoaVector<T>::template is_cold_v<Is>) {
+          for (size_t i = 0; i < a.size(); i++)
+            lerp(&a.template at<Is>(i), &b.template at<Is>(i), t,
+                 &out.template at<Is>(i), 1);
+        } else {
+          lerp(a.template column_at<Is>().data(),
+               b.template column_at<Is>().data(), t,
+               out.template column_at<Is>().data(), a.size());
+        }
+      }(),
+      ...);
+}
+
+template <typename T, size_t... Is>
+void axpy_columns(double              alpha,
+                  const SoaVector<T>& x,
+                  SoaVector<T>&       y,
+                  index_sequence<Is...>) {
+  (
+      [&] {
+        if constexpr (SoaVector<T>::template is_cold_v<Is>) {
+          for (size_t i = 0; i < x.size(); i++)
+            axpy(alpha, &x.template at<Is>(i), &y.template at<Is>(i), 1);
+        } else {
+          axpy(alpha, x.template column_at<Is>().data(),
+               y.template column_at<Is>().data(), x.size());
+        }
+      }(),
+      ...);
+}
+
+// Same as lerp of arrays, column by column: the columns of floats or doubles
+// are contiguous so always run by the SIMD kernels.
+// @param out: of the same size as a & b, e.g. a copy of a.
+template <typename T>
+void lerp(const SoaVector<T>& a,
+          const SoaVector<T>& b,
+          double              t,
+          SoaVector<T>&       out) {
+  lerp_columns(a, b, t, out,
+               make_index_sequence<SoaVector<T>::column_count()>{});
+}
+
+// Same as axpy of arrays, column by column.
+// @param y: of the same size as x.
+template <typename T>
+void axpy(double alpha, const SoaVector<T>& x, SoaVector<T>& y) {
+  axpy_columns(alpha, x, y,
+               make_index_sequence<SoaVector<T>::column_count()>{});
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// transpose
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Append the objects column by column, one strided loop per field.
+template <typename T>
+void to_soa(const T* objs, size_t n, SoaVector<T>& out) {
+  out.reserve(out.size() + n);
+  out.append(objs, n);
+}
+
+// Copy the elements column by column, one strided loop per field.
+// @param out: at least soa.size() elements.
+template <typename T>
+void to_aos(const SoaVector<T>& soa, T* out) {
+  soa.copy_to(out);
+}
+
+}  // namespace imp
+
+using imp::axpy;
+using imp::clamp_by_meta;
+using imp::is_flat_of_v;
+using imp::lerp;
+using imp::MetaRange;
+using imp::to_aos;
+using imp::to_soa;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,291 @@
+// Tref: polymorphic deep clone of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_CLONE_H
+#define TREF_CLONE_H
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+
+#include "Tref.hpp"
+#include "TrefFactory.hpp"
+
+namespace tref {
+namespace imp {
+
+// The dynamic type is looked up in Base & its reflected subclasses, no
+// virtual clone() is needed.
+// A class deeply copyable(no unique_ptr inside, as far as the reflection
+// sees) is cloned by its copy constructor, which copies trivially copyable
+// members & vectors of them by memcpy. The others are default constructed,
+// then their reflected fields are cloned one by one:
+// - trivially copyable: memcpy, copyable: assignment.
+// - unique_ptr: the pointee is cloned, by its dynamic type if reflected.
+// - containers with emplace_back & C arrays: element by element.
+// - reflected classes: recursively.
+// Fields not reflected keep the default values in the latter case.
+// shared_ptr is copyable so the pointee is shared, not cloned.
+
+//////////////////////////////////////////////////////////////////////////
+//
+// fields
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct is_clone_unique_ptr : false_type {};
+
+template <typename T, typename D>
+struct is_clone_unique_ptr<unique_ptr<T, D>> : true_type {};
+
+template <typename T>
+struct is_clone_pair : false_type {};
+
+template <typename A, typename B>
+struct is_clone_pair<pair<A, B>> : true_type {};
+
+template <typename T, typename = void>
+struct has_clone_value_type : false_type {};
+
+template <typename T>
+struct has_clone_value_type<T, void_t<typename T::value_type>> : true_type {};
+
+template <typename T, typename = void>
+struct has_clone_reserve : false_type {};
+
+template <typename T>
+struct has_clone_reserve<T, void_t<decltype(declval<T&>().reserve(0))>>
+    : true_type {};
+
+template <typename T, typename = void>
+struct has_emplace_back : false_type {};
+
+template <typename T>
+struct has_emplace_back<T, void_t<decltype(declval<T&>().emplace_back())>>
+    : true_type {};
+
+template <typename M>
+constexpr bool clone_copyable();
+
+template <typename T>
+constexpr bool clone_copyable_fields() {
+  return apply(
+      [](auto... fs) {
+        return (clone_copyable<typename decltype(fs)::member_t>() && ...);
+      },
+      data_fields<T>());
+}
+
+// Copyable without dropping unique_ptr, i.e. by the copy constructor.
+template <typename M>
+constexpr bool clone_copyable() {
+  if constexpr (is_trivially_copyable_v<M>) {
+    return true;
+  } else if constexpr (is_clone_unique_ptr<M>::value || is_array_v<M>) {
+    return false;
+  } else if constexpr (is_clone_pair<M>::value) {
+    return clone_copyable<remove_const_t<typename M::first_type>>() &&
+           clone_copyable<typename M::second_type>();
+  } else if constexpr (is_reflected_v<M>) {
+    return is_copy_constructible_v<M> && clone_copyable_fields<M>();
+  } else if constexpr (has_clone_value_type<M>::value) {
+    return is_copy_constructible_v<M> &&
+           clone_copyable<typename M::value_type>();
+  } else {
+    return is_copy_constructible_v<M>;
+  }
+}
+
+template <typename Base>
+unique_ptr<Base> clone(const Base& obj);
+
+template <typename T>
+void clone_fields(T& dst, const T& src);
+
+template <typename M>
+void clone_field(M& dst, const M& src) {
+  if constexpr (is_trivially_copyable_v<M>) {
+    memcpy(static_cast<void*>(&dst), &src, sizeof(M));
+  } else if constexpr (clone_copyable<M>() && is_copy_assignable_v<M>) {
+    dst = src;
+  } else if constexpr (is_clone_unique_ptr<M>::value) {
+    using E = typename M::element_type;
+    if (!src) {
+      dst.reset();
+    } else if constexpr (is_reflected_v<E> && is_polymorphic_v<E>) {
+      dst = clone(*src);
+    } else if constexpr (clone_copyable<E>()) {
+      dst = make_unique<E>(*src);
+    } else {
+      dst = make_unique<E>();
+      clone_field(*dst, *src);
+    }
+  } else if constexpr (is_array_v<M>) {
+    for (size_t i = 0; i < extent_v<M>; i++)
+      clone_field(dst[i], src[i]);
+  } else if constexpr (has_emplace_back<M>::value) {
+    dst.clear();
+    if constexpr (has_clone_reserve<M>::value)
+      dst.reserve(src.size());
+    for (auto& e : src) {
+      dst.emplace_back();
+      clone_field(dst.back(), e);
+    }
+  } else if constexpr (is_reflected_v<M>) {
+    clone_fields(dst, src);
+  } else {
+    static_assert(is_copy_assignable_v<M>, "the field can not be cloned");
+    dst = src;
+  }
+}
+
+// Clone the reflected fields of src into dst.
+template <typename T>
+void clone_fields(T& dst, const T& src) {
+  apply(
+      [&](auto... fs) {
+        (
+            [&] {
+              using M = typename decltype(fs)::member_t;
+              if constexpr (!is_const_v<M>)
+                clone_field(dst.*(fs.value), src.*(fs.value));
+            }(),
+            ...);
+      },
+      data_fields<T>());
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// dynamic types
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename Base>
+struct CloneEntry {
+  size_t size;
+  size_t align;
+  Base* (*clone_new)(const Base& src);
+  Base* (*clone_to)(void* mem, const Base& src);
+  void (*destroy)(void*);  // nullptr for trivially destructible type.
+};
+
+template <typename S>
+constexpr bool is_clonable_v =
+    !is_abstract_v<S> &&
+    (clone_copyable<S>() ? is_copy_constructible_v<S>
+                         : is_default_constructible_v<S>);
+
+template <typename Base, typename S>
+Base* clone_new(const Base& src) {
+  auto& s = static_cast<const S&>(src);
+  if constexpr (clone_copyable<S>()) {
+    return new S(s);
+  } else {
+    auto d = new S();
+    clone_fields(*d, s);
+    return d;
+  }
+}
+
+template <typename Base, typename S>
+Base* clone_to(void* mem, const Base& src) {
+  auto& s = static_cast<const S&>(src);
+  if constexpr (clone_copyable<S>()) {
+    return new (mem) S(s);
+  } else {
+    auto d = new (mem) S();
+    clone_fields(*d, s);
+    return d;
+  }
+}
+
+// Entries of Base & its reflected subclasses by their type_index.
+template <typename Base>
+const unordered_map<type_index, CloneEntry<Base>>& clone_entries() {
+  static const auto entries = [] {
+    unordered_map<type_index, CloneEntry<Base>> r;
+    auto                                        add = [&](auto info) {
+      using S = typename decltype(info)::class_t;
+      if constexpr (is_clonable_v<S>) {
+        CloneEntry<Base> e{sizeof(S), alignof(S), &clone_new<Base, S>,
+                           &clone_to<Base, S>, nullptr};
+        if constexpr (!is_trivially_destructible_v<S>)
+          e.destroy = [](void* p) { static_cast<S*>(p)->~S(); };
+        r.emplace(typeid(S), e);
+      }
+    };
+    add(class_info<Base>());
+    class_info<Base>().each_subclass([&](auto info, int) {
+      add(info);
+      return true;
+    });
+    return r;
+  }();
+  return entries;
+}
+
+template <typename Base>
+const CloneEntry<Base>* find_clone_entry(const Base& obj) {
+  auto& entries = clone_entries<Base>();
+  auto  it = entries.find(is_polymorphic_v<Base> ? type_index{typeid(obj)}
+                                                 : type_index{typeid(Base)});
+  return it == entries.end() ? nullptr : &it->second;
+}
+
+// Deep copy of the object by its dynamic type.
+// @return nullptr if the dynamic type is not Base or a reflected subclass,
+//   or can not be constructed.
+template <typename Base>
+unique_ptr<Base> clone(const Base& obj) {
+  auto e = find_clone_entry(obj);
+  if (!e)
+    return nullptr;
+  return unique_ptr<Base>{e->clone_new(obj)};
+}
+
+// Same as clone() but the object is put in the arena & destroyed by its
+// reset(), fields owned by unique_ptr are still on the heap.
+template <typename Base>
+Base* clone(const Base& obj, Arena& arena) {
+  auto e = find_clone_entry(obj);
+  if (!e)
+    return nullptr;
+  auto mem = arena.allocate(e->size, e->align);
+  auto r = e->clone_to(mem, obj);
+  if (e->destroy)
+    arena.on_reset(mem, e->destroy);
+  return r;
+}
+
+}  // namespace imp
+
+using imp::clone;
+using imp::clone_fields;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,301 @@
+// Tref: compact reflection by shared runtime descriptor tables.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_COMPACT_H
+#define TREF_COMPACT_H
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// class_info<T>().each_field(f) instantiates f & the iteration for every
+// class, per call site. The descriptor of a class is built once by
+// type_desc<T>(), the visitors below are instantiated per call site only,
+// so generic code(serializers, editors, ...) written against the
+// descriptors costs the same code size for any count of classes.
+// Use TrefSize.py to find the classes & call sites worth converting.
+
+enum class FieldKind : uint8_t {
+  Bool,
+  Int,
+  UInt,
+  Float,
+  Enum,
+  String,
+  Object,  // reflected class, see FieldDesc::type.
+  Other,
+};
+
+struct TypeDesc;
+
+struct FieldDesc {
+  string_view     name;
+  uint32_t        offset;
+  uint32_t        size;
+  FieldKind       kind;
+  uint64_t        type_id;  // type_id_v of the member type.
+  const TypeDesc* type;     // of Object fields.
+
+  void*       get(void* obj) const { return static_cast<char*>(obj) + offset; }
+  const void* get(const void* obj) const {
+    return static_cast<const char*>(obj) + offset;
+  }
+};
+
+struct TypeDesc {
+  using Getter = const TypeDesc& (*)();
+
+  string_view           name;
+  size_t                size;
+  size_t                align;
+  uint64_t              id;
+  const TypeDesc*       base;
+  size_t                base_offset;  // of the base subobject in this class.
+  Span<const FieldDesc> fields;       // declared by this class.
+  Span<const Getter>    subclasses;   // direct ones.
+
+  // Same order as class_info<T>().each_field, i.e. the fields of this class
+  // first, then those of the base classes. The fields of the base classes
+  // are passed with their offsets in this class, so field.get() takes an
+  // object of this class.
+  // @param f: [](const FieldDesc& field, int level) -> bool, return false to
+  // stop the iterating.
+  template <typename F>
+  bool each_field(F&& f, int level = 0) const {
+    size_t offset = 0;
+    for (auto t = this; t; offset += t->base_offset, t = t->base, level++) {
+      for (auto& field : t->fields) {
+        auto moved = field;
+        moved.offset += static_cast<uint32_t>(offset);
+        if (!f(static_cast<const FieldDesc&>(moved), level))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // Iterate through the subclasses recursively.
+  // @param f: [](const TypeDesc& type, int level) -> bool, return false to
+  // stop the iterating.
+  template <typename F>
+  bool each_subclass(F&& f, int level = 0) const {
+    for (auto get : subclasses) {
+      auto& sub = get();
+      if (!f(sub, level) || !sub.each_subclass(f, level + 1))
+        return false;
+    }
+    return true;
+  }
+
+  // Field of this class or the base classes, with its offset in this class.
+  // @return empty if not found.
+  optional<FieldDesc> find_field(string_view field_name) const {
+    optional<FieldDesc> r;
+    each_field([&](const FieldDesc& field, int) {
+      if (field.name == field_name)
+        r = field;
+      return !r;
+    });
+    return r;
+  }
+
+  bool is_base_of(const TypeDesc& sub) const {
+    for (auto t = &sub; t; t = t->base) {
+      if (t == this)
+        return true;
+    }
+    return false;
+  }
+};
+
+template <typename T>
+const TypeDesc& type_desc();
+
+template <typename M>
+constexpr FieldKind field_kind() {
+  if constexpr (is_same_v<M, bool>)
+    return FieldKind::Bool;
+  else if constexpr (is_enum_v<M>)
+    return FieldKind::Enum;
+  else if constexpr (is_floating_point_v<M>)
+    return FieldKind::Float;
+  else if constexpr (is_integral_v<M>)
+    return is_signed_v<M> ? FieldKind::Int : FieldKind::UInt;
+  else if constexpr (is_same_v<M, string> || is_same_v<M, string_view>)
+    return FieldKind::String;
+  else if constexpr (is_reflected_v<M>)
+    return FieldKind::Object;
+  else
+    return FieldKind::Other;
+}
+
+// The descriptors are constant initialized data, linked by their addresses,
+// only the offsets of the fields & base are set at runtime by type_desc<T>().
+template <typename T>
+struct TypeDescData;
+
+template <typename Info>
+constexpr FieldDesc make_field_desc(Info info) {
+  using M = typename Info::member_t;
+  const TypeDesc* type = nullptr;
+  if constexpr (is_reflected_v<M>)
+    type = &TypeDescData<M>::desc;
+  return {info.name, 0, sizeof(M), field_kind<M>(), type_id_v<M>, type};
+}
+
+// Count of the data fields declared by T, which are the last ones of
+// data_fields<T>().
+template <typename T>
+constexpr size_t own_field_count_v = [] {
+  size_t n = 0;
+  apply(
+      [&](auto... fs) {
+        ((n += is_same_v<typename decltype(fs)::enclosing_class_t, T>), ...);
+      },
+      data_fields<T>());
+  return n;
+}();
+
+template <typename T, size_t... Is>
+constexpr array<FieldDesc, sizeof...(Is)> make_field_descs(
+    index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  constexpr auto first = tuple_size_v<decltype(fields)> - sizeof...(Is);
+  (void)first;  // unused if T declares no field.
+  return {make_field_desc(get<first + Is>(fields))...};
+}
+
+template <typename T>
+constexpr auto subclass_getters() {
+  constexpr auto n = [] {
+    size_t r = 0;
+    class_info<T>().each_subclass([&](auto, int level) {
+      r += level == 0;
+      return true;
+    });
+    return r;
+  }();
+  array<TypeDesc::Getter, n> r{};
+  size_t                     i = 0;
+  class_info<T>().each_subclass([&](auto info, int level) {
+    if (level == 0)
+      r[i++] = &type_desc<typename decltype(info)::class_t>;
+    return true;
+  });
+  return r;
+}
+
+template <typename T>
+constexpr const TypeDesc* base_type_desc() {
+  if constexpr (has_base_class_v<T>)
+    return &TypeDescData<ZTrefBaseOf(T)>::desc;
+  else
+    return nullptr;
+}
+
+template <typename T>
+struct TypeDescData {
+  static constexpr auto count = own_field_count_v<T>;
+  static constexpr auto subclasses = subclass_getters<T>();
+
+  static inline array<FieldDesc, count> fields =
+      make_field_descs<T>(make_index_sequence<count>{});
+
+  static inline TypeDesc desc{
+      class_info<T>().name,
+      sizeof(T),
+      alignof(T),
+      type_id_v<T>,
+      base_type_desc<T>(),
+      0,
+      Span<const FieldDesc>{fields.data(), count},
+      Span<const TypeDesc::Getter>{subclasses.data(), subclasses.size()}};
+};
+
+template <typename T, size_t... Is>
+void set_field_offsets(index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  constexpr auto first = tuple_size_v<decltype(fields)> - sizeof...(Is);
+  auto&          descs = TypeDescData<T>::fields;
+  (void)first;  // unused if T declares no field.
+  ((descs[Is].offset =
+        static_cast<uint32_t>(offset_of<T>(get<first + Is>(fields).value))),
+   ...);
+}
+
+// Offset of the base subobject, which is not 0 when T adds a vptr to a
+// non-polymorphic base or has several bases.
+template <typename T>
+size_t base_subobject_offset() {
+  using Base = ZTrefBaseOf(T);
+  alignas(T) static char buf[sizeof(T)];
+  auto obj = reinterpret_cast<T*>(buf);
+  return static_cast<size_t>(
+      reinterpret_cast<char*>(static_cast<Base*>(obj)) - buf);
+}
+
+template <typename M>
+void prepare_type_desc() {
+  if constexpr (is_reflected_v<M>)
+    type_desc<M>();
+}
+
+// Descriptor of the reflected class, the offsets of its fields & the linked
+// classes(base & members) are set on the first call.
+template <typename T>
+const TypeDesc& type_desc() {
+  static_assert(is_reflected_v<T>);
+  static const bool ready = [] {
+    using Data = TypeDescData<T>;
+    set_field_offsets<T>(make_index_sequence<Data::count>{});
+    if constexpr (has_base_class_v<T>) {
+      Data::desc.base_offset = base_subobject_offset<T>();
+      type_desc<ZTrefBaseOf(T)>();
+    }
+    apply(
+        [](auto... fs) {
+          (prepare_type_desc<typename decltype(fs)::member_t>(), ...);
+        },
+        data_fields<T>());
+    return true;
+  }();
+  (void)ready;
+  return TypeDescData<T>::desc;
+}
+
+}  // namespace imp
+
+using imp::FieldDesc;
+using imp::FieldKind;
+using imp::type_desc;
+using imp::TypeDesc;
+
+}  // namespace tref
+#endif
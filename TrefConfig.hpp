@@ -0,0 +1,570 @@
+// Tref: compile time parsing of JSON/INI config into reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_CONFIG_H
+#define TREF_CONFIG_H
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// The config is parsed into a literal type, e.g.
+//   constexpr auto cfg = tref::config::json<ServerConfig>(R"({
+//     "port": 8080, "mode": "Fast", "limits": {"conns": 100}
+//   })");
+// Keys are the names of the reflected fields, missing keys keep the default
+// values, other mismatches fail the compilation with the error as the name
+// of the function called, e.g. config_error_unknown_key.
+//
+// Field types: bool, integers, floating points, enums(by item name),
+// string_view(points into the text, so no escapes), array<E, N>(exactly N
+// elements) and nested reflected classes.
+// INI: [section] selects a nested field, "a.b" for deeper ones, values are
+// not quoted except for strings with leading or trailing spaces, comments
+// start with ; or #.
+// Floating points are parsed by a constexpr routine which may differ from
+// strtod in the last bit for long mantissas.
+
+enum class ConfigError {
+  None,
+  Syntax,
+  UnknownKey,
+  TypeMismatch,
+  OutOfRange,
+  ArraySize,
+  UnsupportedType,
+};
+
+template <typename T>
+struct ConfigResult {
+  T           value{};
+  ConfigError error = ConfigError::None;
+  size_t      pos = 0;  // of the error in the text.
+
+  constexpr explicit operator bool() const {
+    return error == ConfigError::None;
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// reader
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct ConfigReader {
+  string_view text;
+  bool        ini = false;  // strings may be not quoted.
+  size_t      pos = 0;
+  ConfigError error = ConfigError::None;
+  size_t      error_pos = 0;
+
+  constexpr bool fail(ConfigError e) {
+    if (error == ConfigError::None) {
+      error = e;
+      error_pos = pos;
+    }
+    return false;
+  }
+
+  constexpr bool done() const { return pos >= text.size(); }
+  constexpr char peek() const { return done() ? 0 : text[pos]; }
+
+  constexpr void skip_space() {
+    while (!done() && (text[pos] == ' ' || text[pos] == '\t' ||
+                       text[pos] == '\n' || text[pos] == '\r'))
+      pos++;
+  }
+
+  constexpr bool eat(char c) {
+    skip_space();
+    if (peek() != c)
+      return false;
+    pos++;
+    return true;
+  }
+
+  constexpr bool expect(char c) { return eat(c) || fail(ConfigError::Syntax); }
+
+  constexpr bool quoted(string_view& s) {
+    skip_space();
+    if (peek() != '"')
+      return fail(ConfigError::TypeMismatch);
+    auto begin = ++pos;
+    while (!done() && text[pos] != '"') {
+      if (text[pos] == '\\')
+        return fail(ConfigError::UnsupportedType);
+      pos++;
+    }
+    if (done())
+      return fail(ConfigError::Syntax);
+    s = text.substr(begin, pos++ - begin);
+    return true;
+  }
+
+  // Number, true/false or an identifier.
+  constexpr string_view token() {
+    skip_space();
+    auto begin = pos;
+    while (!done()) {
+      auto c = text[pos];
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' ||
+          c == ']' || c == '}' || c == ':' || c == '"')
+        break;
+      pos++;
+    }
+    return text.substr(begin, pos - begin);
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// values
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct is_config_array : false_type {};
+
+template <typename E, size_t N>
+struct is_config_array<array<E, N>> : true_type {};
+
+constexpr bool config_is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+template <typename M>
+constexpr bool config_integer(ConfigReader& r, string_view s, M& v) {
+  using U = unsigned long long;
+  size_t i = 0;
+  bool   neg = false;
+  if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+    neg = s[0] == '-';
+    i++;
+  }
+  if (i == s.size())
+    return r.fail(ConfigError::TypeMismatch);
+  U limit = static_cast<U>(numeric_limits<M>::max()) + (neg ? 1 : 0);
+  if (neg && is_unsigned_v<M>)
+    limit = 0;
+  U n = 0;
+  for (; i < s.size(); i++) {
+    if (!config_is_digit(s[i]))
+      return r.fail(ConfigError::TypeMismatch);
+    U d = static_cast<U>(s[i] - '0');
+    if (d > limit || n > (limit - d) / 10)
+      return r.fail(ConfigError::OutOfRange);
+    n = n * 10 + d;
+  }
+  if (neg && n > 0)
+    v = static_cast<M>(-static_cast<long long>(n - 1) - 1);
+  else
+    v = static_cast<M>(n);
+  return true;
+}
+
+template <typename M>
+constexpr bool config_float(ConfigReader& r, string_view s, M& v) {
+  size_t i = 0;
+  bool   neg = false;
+  if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+    neg = s[0] == '-';
+    i++;
+  }
+  double mant = 0;
+  int    exp10 = 0;
+  bool   digits = false;
+  for (; i < s.size() && config_is_digit(s[i]); i++, digits = true)
+    mant = mant * 10 + (s[i] - '0');
+  if (i < s.size() && s[i] == '.') {
+    for (i++; i < s.size() && config_is_digit(s[i]); i++, digits = true) {
+      mant = mant * 10 + (s[i] - '0');
+      exp10--;
+    }
+  }
+  if (!digits)
+    return r.fail(ConfigError::TypeMismatch);
+  if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+    int e = 0;
+    if (!config_integer(r, s.substr(i + 1), e))
+      return false;
+    exp10 += e;
+    i = s.size();
+  }
+  if (i != s.size())
+    return r.fail(ConfigError::TypeMismatch);
+  if (exp10 > 308 || exp10 < -324)
+    return r.fail(ConfigError::OutOfRange);
+
+  double scale = 1;
+  for (int k = exp10 < 0 ? -exp10 : exp10; k > 0; k--)
+    scale *= 10;
+  double d = exp10 < 0 ? mant / scale : mant * scale;
+  if (d > static_cast<double>(numeric_limits<M>::max()))
+    return r.fail(ConfigError::OutOfRange);
+  v = static_cast<M>(neg ? -d : d);
+  return true;
+}
+
+// Parse the next token by parse(string_view), errors are reported at the
+// start of the token.
+template <typename F>
+constexpr bool config_token(ConfigReader& r, F parse) {
+  r.skip_space();
+  auto begin = r.pos;
+  auto t = r.token();
+  auto end = r.pos;
+  r.pos = begin;
+  bool ok = parse(t);
+  r.pos = end;
+  return ok;
+}
+
+template <typename M>
+constexpr bool config_value(ConfigReader& r, M& v);
+
+template <typename T, size_t... Is>
+constexpr bool config_field(ConfigReader& r,
+                            T&            obj,
+                            string_view   key,
+                            index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  bool           found = false, ok = false;
+  ((!found && get<Is>(fields).name == key
+        ? (found = true, ok = config_value(r, obj.*(get<Is>(fields).value)))
+        : false),
+   ...);
+  return found ? ok : r.fail(ConfigError::UnknownKey);
+}
+
+// Parse the value of the field by the name.
+template <typename T>
+constexpr bool config_field(ConfigReader& r, T& obj, string_view key) {
+  constexpr auto n = tuple_size_v<decltype(data_fields<T>())>;
+  return config_field(r, obj, key, make_index_sequence<n>{});
+}
+
+template <typename T>
+constexpr bool config_object(ConfigReader& r, T& obj) {
+  if (!r.expect('{'))
+    return false;
+  if (r.eat('}'))
+    return true;
+  do {
+    string_view key;
+    r.skip_space();
+    if (r.peek() != '"')
+      return r.fail(ConfigError::Syntax);
+    if (!r.quoted(key) || !r.expect(':') || !config_field(r, obj, key))
+      return false;
+  } while (r.eat(','));
+  return r.expect('}');
+}
+
+template <typename E, size_t N>
+constexpr bool config_array(ConfigReader& r, array<E, N>& v) {
+  if (!r.expect('['))
+    return false;
+  size_t n = 0;
+  if (!r.eat(']')) {
+    do {
+      if (n == N)
+        return r.fail(ConfigError::ArraySize);
+      if (!config_value(r, v[n++]))
+        return false;
+    } while (r.eat(','));
+    if (!r.expect(']'))
+      return false;
+  }
+  return n == N || r.fail(ConfigError::ArraySize);
+}
+
+template <typename M>
+constexpr bool config_value(ConfigReader& r, M& v) {
+  r.skip_space();
+  if constexpr (is_same_v<M, bool>) {
+    return config_token(r, [&](string_view t) {
+      v = t == "true";
+      return v || t == "false" || r.fail(ConfigError::TypeMismatch);
+    });
+  } else if constexpr (is_integral_v<M>) {
+    return config_token(r, [&](string_view t) {
+      return config_integer(r, t, v);
+    });
+  } else if constexpr (is_floating_point_v<M>) {
+    return config_token(r, [&](string_view t) {
+      return config_float(r, t, v);
+    });
+  } else if constexpr (is_enum_v<M>) {
+    if constexpr (is_reflected_enum_v<M>) {
+      auto match = [&](string_view name) {
+        for (auto& e : enum_info<M>().items) {
+          if (e.name == name) {
+            v = e.value;
+            return true;
+          }
+        }
+        return r.fail(ConfigError::OutOfRange);
+      };
+      if (r.peek() != '"')
+        return config_token(r, match);
+      auto        begin = r.pos;
+      string_view name;
+      if (!r.quoted(name))
+        return false;
+      auto end = r.pos;
+      r.pos = begin;
+      bool ok = match(name);
+      r.pos = end;
+      return ok;
+    } else {
+      return config_token(r, [&](string_view t) {
+        underlying_type_t<M> u{};
+        if (!config_integer(r, t, u))
+          return false;
+        v = static_cast<M>(u);
+        return true;
+      });
+    }
+  } else if constexpr (is_same_v<M, string_view>) {
+    if (r.ini && r.peek() != '"') {
+      v = r.text.substr(r.pos);
+      r.pos = r.text.size();
+      return true;
+    }
+    return r.quoted(v);
+  } else if constexpr (is_config_array<M>::value) {
+    return config_array(r, v);
+  } else if constexpr (is_reflected_v<M>) {
+    return config_object(r, v);
+  } else {
+    return r.fail(ConfigError::UnsupportedType);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// formats
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+constexpr ConfigResult<T> config_result(T& obj, const ConfigReader& r) {
+  ConfigResult<T> ret;
+  ret.value = obj;
+  ret.error = r.error;
+  ret.pos = r.error_pos;
+  return ret;
+}
+
+template <typename T>
+constexpr ConfigResult<T> config_parse_json(string_view text) {
+  T            obj{};
+  ConfigReader r{text};
+  if (config_object(r, obj)) {
+    r.skip_space();
+    if (!r.done())
+      r.fail(ConfigError::Syntax);
+  }
+  return config_result(obj, r);
+}
+
+constexpr string_view config_trim(string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() &&
+         (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// Parse the value of the field by the dotted path, e.g. "limits.conns".
+template <typename T>
+constexpr bool config_path(ConfigReader& r, T& obj, string_view path) {
+  auto dot = path.find('.');
+  if (dot == string_view::npos)
+    return config_field(r, obj, path);
+
+  constexpr auto fields = data_fields<T>();
+  auto           name = path.substr(0, dot);
+  bool           found = false, ok = false;
+  apply(
+      [&](auto... fs) {
+        ((!found && fs.name == name ? (found = true, ok = [&](auto& m) {
+           if constexpr (is_reflected_v<remove_reference_t<decltype(m)>>)
+             return config_path(r, m, path.substr(dot + 1));
+           else
+             return r.fail(ConfigError::TypeMismatch);
+         }(obj.*(fs.value))) : false),
+         ...);
+      },
+      fields);
+  return found ? ok : r.fail(ConfigError::UnknownKey);
+}
+
+template <typename T>
+constexpr ConfigResult<T> config_parse_ini(string_view text) {
+  T            obj{};
+  ConfigReader err{text};
+  string_view  section;
+  for (size_t begin = 0;
+       begin < text.size() && err.error == ConfigError::None;) {
+    auto end = text.find('\n', begin);
+    if (end == string_view::npos)
+      end = text.size();
+    auto line = config_trim(text.substr(begin, end - begin));
+    err.pos = static_cast<size_t>(line.data() - text.data());
+    begin = end + 1;
+
+    if (line.empty() || line[0] == ';' || line[0] == '#')
+      continue;
+    if (line[0] == '[') {
+      if (line.back() != ']')
+        err.fail(ConfigError::Syntax);
+      section = config_trim(line.substr(1, line.size() - 2));
+      continue;
+    }
+    auto eq = line.find('=');
+    if (eq == string_view::npos) {
+      err.fail(ConfigError::Syntax);
+      continue;
+    }
+
+    // The key is looked up as "section.key", by a reader of the value.
+    char path_buf[256]{};
+    auto key = config_trim(line.substr(0, eq));
+    if (section.size() + key.size() + 1 > sizeof(path_buf)) {
+      err.fail(ConfigError::UnknownKey);
+      continue;
+    }
+    size_t n = 0;
+    for (auto c : section)
+      path_buf[n++] = c;
+    if (!section.empty())
+      path_buf[n++] = '.';
+    for (auto c : key)
+      path_buf[n++] = c;
+
+    auto         value = config_trim(line.substr(eq + 1));
+    ConfigReader r{value, true};
+    if (config_path(r, obj, string_view{path_buf, n})) {
+      r.skip_space();
+      if (!r.done())
+        r.fail(ConfigError::Syntax);
+    }
+    if (r.error != ConfigError::None) {
+      err.pos = static_cast<size_t>(value.data() - text.data()) + r.error_pos;
+      err.fail(r.error);
+    }
+  }
+  return config_result(obj, err);
+}
+
+// Report the error & abort, the parse_* functions are for the errors to be
+// handled at runtime.
+[[noreturn]] inline void config_abort(const char* msg) {
+  fprintf(stderr, "tref: %s\n", msg);
+  abort();
+}
+
+// Not constexpr: reaching one of them at compile time fails the compilation
+// with its name in the diagnostics, at runtime the program is aborted.
+inline void config_error_syntax() {
+  config_abort("syntax error in config");
+}
+inline void config_error_unknown_key() {
+  config_abort("unknown key in config");
+}
+inline void config_error_type_mismatch() {
+  config_abort("type mismatch in config");
+}
+inline void config_error_out_of_range() {
+  config_abort("value out of range in config");
+}
+inline void config_error_array_size() {
+  config_abort("array size mismatch in config");
+}
+inline void config_error_unsupported_type() {
+  config_abort("unsupported field type or string escape in config");
+}
+
+template <typename T>
+constexpr T config_value_or_error(const ConfigResult<T>& r) {
+  switch (r.error) {
+    case ConfigError::None: break;
+    case ConfigError::Syntax: config_error_syntax(); break;
+    case ConfigError::UnknownKey: config_error_unknown_key(); break;
+    case ConfigError::TypeMismatch: config_error_type_mismatch(); break;
+    case ConfigError::OutOfRange: config_error_out_of_range(); break;
+    case ConfigError::ArraySize: config_error_array_size(); break;
+    case ConfigError::UnsupportedType:
+      config_error_unsupported_type();
+      break;
+  }
+  return r.value;
+}
+
+}  // namespace imp
+
+using imp::ConfigError;
+using imp::ConfigResult;
+
+namespace config {
+
+// Parse JSON text into T, errors fail the compilation in constant
+// expressions, or abort the program at runtime.
+template <typename T>
+constexpr T json(std::string_view text) {
+  return imp::config_value_or_error(imp::config_parse_json<T>(text));
+}
+
+// Parse INI text into T, errors fail the compilation in constant
+// expressions, or abort the program at runtime.
+template <typename T>
+constexpr T ini(std::string_view text) {
+  return imp::config_value_or_error(imp::config_parse_ini<T>(text));
+}
+
+// Parse JSON text into T, reporting the error.
+template <typename T>
+constexpr ConfigResult<T> parse_json(std::string_view text) {
+  return imp::config_parse_json<T>(text);
+}
+
+// Parse INI text into T, reporting the error.
+template <typename T>
+constexpr ConfigResult<T> parse_ini(std::string_view text) {
+  return imp::config_parse_ini<T>(text);
+}
+
+}  // namespace config
+
+}  // namespace tref
+#endif
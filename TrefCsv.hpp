@@ -0,0 +1,362 @@
+// Tref: parallel CSV/TSV reader for reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_CSV_H
+#define TREF_CSV_H
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefFile.hpp"
+
+namespace tref {
+namespace imp {
+
+// Rows are separated by "\n" or "\r\n", fields by the delimiter.
+// Quoted fields may contain delimiters and "" escaped quotes, but not line
+// breaks, so that the data can be split at any line break.
+// The 1st row is the header of field names, nested fields are named like
+// "pos.x", columns without a field are skipped.
+
+//////////////////////////////////////////////////////////////////////////
+//
+// columns
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct CsvOptions {
+  char     delimiter = 0;  // 0 for '\t' if found in the header, or ','.
+  unsigned threads = 0;    // 0 for the count of hardware threads.
+};
+
+struct CsvError {
+  size_t line;  // 1 based.
+  string column;
+};
+
+template <typename T>
+struct CsvResult {
+  vector<T>        rows;
+  vector<CsvError> errors;  // of the rows skipped, in the order of lines.
+  string           error;   // of the file or the header.
+
+  explicit operator bool() const { return error.empty(); }
+};
+
+template <typename M>
+constexpr auto is_csv_field_v =
+    is_arithmetic_v<M> || is_enum_v<M> || is_same_v<M, string>;
+
+inline string_view csv_trim(string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+template <typename M>
+bool csv_parse_number(string_view s, M& v) {
+  s = csv_trim(s);
+  if (!s.empty() && s[0] == '+')
+    s.remove_prefix(1);
+  auto r = from_chars(s.data(), s.data() + s.size(), v);
+  return r.ec == errc{} && r.ptr == s.data() + s.size();
+}
+
+template <typename M>
+bool csv_parse(string_view s, char* dst) {
+  auto& v = *reinterpret_cast<M*>(dst);
+  if constexpr (is_same_v<M, string>) {
+    v.assign(s.data(), s.size());
+  } else if constexpr (is_same_v<M, bool>) {
+    s = csv_trim(s);
+    v = s == "1" || s == "true" || s == "TRUE" || s == "True";
+    return v || s.empty() || s == "0" || s == "false" || s == "FALSE" ||
+           s == "False";
+  } else if constexpr (is_enum_v<M>) {
+    s = csv_trim(s);
+    if constexpr (is_reflected_enum_v<M>) {
+      constexpr auto items = enum_info<M>().items;
+      for (auto& e : items) {
+        if (e.name == s) {
+          v = e.value;
+          return true;
+        }
+      }
+    }
+    underlying_type_t<M> u;
+    if (!csv_parse_number(s, u))
+      return false;
+    v = static_cast<M>(u);
+  } else {
+    if (csv_trim(s).empty())
+      v = M{};
+    else
+      return csv_parse_number(s, v);
+  }
+  return true;
+}
+
+struct CsvColumn {
+  string name;
+  size_t offset;
+  bool (*parse)(string_view s, char* dst);
+};
+
+// Arithmetic, enum & string fields, nested reflected classes are flattened.
+template <typename C>
+void csv_columns(vector<CsvColumn>& cols,
+                 const string&      prefix = {},
+                 size_t             offset = 0) {
+  apply(
+      [&](auto... fs) {
+        (
+            [&](auto info) {
+              using M = typename decltype(info)::member_t;
+              auto name = prefix + string{info.name};
+              auto off = offset + offset_of<C>(info.value);
+              if constexpr (is_csv_field_v<M>)
+                cols.push_back({name, off, &csv_parse<M>});
+              else if constexpr (is_class_v<M> && is_reflected_v<M>)
+                csv_columns<M>(cols, name + ".", off);
+            }(fs),
+            ...);
+      },
+      data_fields<C>());
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// parser
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Take the next field of the line [p, end), p is moved after the delimiter.
+// Quoted fields are unescaped into the scratch string.
+// @param more: set to false for the last field of the line.
+inline string_view csv_next(const char*& p,
+                            const char*  end,
+                            char         delim,
+                            string&      scratch,
+                            bool&        more) {
+  auto quoted = p < end && *p == '"';
+  if (quoted) {
+    scratch.clear();
+    for (p++;;) {
+      auto q = static_cast<const char*>(memchr(p, '"', end - p));
+      scratch.append(p, q ? q : end);
+      p = q ? q + 1 : end;
+      if (!q || p == end || *p != '"')
+        break;
+      scratch.push_back('"');
+      p++;
+    }
+  }
+  auto e = static_cast<const char*>(memchr(p, delim, end - p));
+  auto n = static_cast<size_t>((e ? e : end) - p);
+  auto r = quoted ? string_view{scratch} : string_view{p, n};
+  more = e != nullptr;
+  p = e ? e + 1 : end;
+  return r;
+}
+
+inline const char* csv_line_end(const char* p, const char* end) {
+  auto e = static_cast<const char*>(memchr(p, '\n', end - p));
+  return e ? e : end;
+}
+
+template <typename T>
+struct CsvChunk {
+  const char*      begin;
+  const char*      end;
+  vector<T>        rows;
+  vector<CsvError> errors;  // lines are relative to the chunk.
+  size_t           lines = 0;
+};
+
+// Parse the lines of a chunk.
+// @param fields: column index to the parser, nullptr to skip the column.
+template <typename T>
+void csv_parse_chunk(CsvChunk<T>&             chunk,
+                     const vector<CsvColumn*>& fields,
+                     char                      delim,
+                     size_t                    avg_line) {
+  auto bytes = static_cast<size_t>(chunk.end - chunk.begin);
+  chunk.rows.reserve(bytes / max<size_t>(avg_line, 1) + 1);
+  string scratch;
+  for (auto p = chunk.begin; p < chunk.end;) {
+    auto e = csv_line_end(p, chunk.end);
+    auto next = e + (e < chunk.end);
+    chunk.lines++;
+    if (e > p && e[-1] == '\r')
+      e--;
+    if (e == p) {
+      p = next;
+      continue;
+    }
+    auto& row = chunk.rows.emplace_back();
+    auto  dst = reinterpret_cast<char*>(&row);
+    auto  more = true;
+    for (size_t i = 0; more && i < fields.size(); i++) {
+      auto s = csv_next(p, e, delim, scratch, more);
+      if (fields[i] && !fields[i]->parse(s, dst + fields[i]->offset)) {
+        chunk.errors.push_back({chunk.lines, fields[i]->name});
+        chunk.rows.pop_back();
+        break;
+      }
+    }
+    p = next;
+  }
+}
+
+// bytes per task at least.
+constexpr size_t csv_min_chunk = 1 << 20;
+
+// Parse CSV data, the lines are split into chunks parsed by multiple threads,
+// then the rows are merged in order.
+template <typename T>
+CsvResult<T> csv_parse_data(string_view data, CsvOptions opt = {}) {
+  CsvResult<T> r;
+  auto         p = data.data();
+  auto         end = p + data.size();
+  if (data.substr(0, 3) == "\xEF\xBB\xBF")
+    p += 3;
+
+  // map the header to the fields once.
+  auto e = csv_line_end(p, end);
+  auto body = e + (e < end);
+  if (e > p && e[-1] == '\r')
+    e--;
+  if (e == p) {
+    r.error = "missing header";
+    return r;
+  }
+  auto delim = opt.delimiter ? opt.delimiter
+                             : memchr(p, '\t', e - p) ? '\t' : ',';
+  vector<CsvColumn> cols;
+  csv_columns<T>(cols);
+  vector<CsvColumn*> fields;
+  string             scratch;
+  bool               matched = false;
+  for (auto more = true; more;) {
+    auto name = csv_trim(csv_next(p, e, delim, scratch, more));
+    auto it = find_if(cols.begin(), cols.end(),
+                      [&](auto& c) { return c.name == name; });
+    fields.push_back(it == cols.end() ? nullptr : &*it);
+    matched |= it != cols.end();
+  }
+  if (!matched) {
+    r.error = "no column matches the fields";
+    return r;
+  }
+
+  // split into line aligned chunks.
+  auto threads = opt.threads ? opt.threads
+                             : max(thread::hardware_concurrency(), 1u);
+  auto size = static_cast<size_t>(end - body);
+  auto step = max(csv_min_chunk, size / (threads * 4) + 1);
+  vector<CsvChunk<T>> chunks;
+  for (auto b = body; b < end;) {
+    auto c = csv_line_end(b + min(step, static_cast<size_t>(end - b)), end);
+    c += c < end;
+    auto& k = chunks.emplace_back();
+    k.begin = b;
+    k.end = c;
+    b = c;
+  }
+  auto sample = csv_line_end(body, min(end, body + 4096)) - body + 1;
+
+  atomic<size_t> next{0};
+  auto           work = [&] {
+    for (size_t c; (c = next.fetch_add(1)) < chunks.size();)
+      csv_parse_chunk(chunks[c], fields, delim, sample);
+  };
+  vector<thread> pool;
+  threads = static_cast<unsigned>(min<size_t>(threads, chunks.size()));
+  for (unsigned i = 1; i < threads; i++)
+    pool.emplace_back(work);
+  work();
+  for (auto& t : pool)
+    t.join();
+
+  // merge in order.
+  size_t rows = 0;
+  for (auto& c : chunks)
+    rows += c.rows.size();
+  r.rows.reserve(rows);
+  size_t line = 1;
+  for (auto& c : chunks) {
+    move(c.rows.begin(), c.rows.end(), back_inserter(r.rows));
+    vector<T>{}.swap(c.rows);
+    for (auto& err : c.errors)
+      r.errors.push_back({line + err.line, move(err.column)});
+    line += c.lines;
+  }
+  return r;
+}
+
+// Read a CSV file through a memory mapping.
+template <typename T>
+CsvResult<T> csv_read_file(const string& path, CsvOptions opt = {}) {
+  MappedFile f;
+  if (!f.open(path)) {
+    CsvResult<T> r;
+    r.error = "can not open: " + path;
+    return r;
+  }
+  return csv_parse_data<T>(f.view(), opt);
+}
+
+}  // namespace imp
+
+using imp::CsvError;
+using imp::CsvOptions;
+using imp::CsvResult;
+
+namespace csv {
+
+// Read the rows of a CSV/TSV file, rows failed to parse are skipped and
+// reported in the errors.
+template <typename T>
+CsvResult<T> read(const std::string& path, CsvOptions opt = {}) {
+  return imp::csv_read_file<T>(path, opt);
+}
+
+// Parse the rows from CSV/TSV data in memory.
+template <typename T>
+CsvResult<T> parse(std::string_view data, CsvOptions opt = {}) {
+  return imp::csv_parse_data<T>(data, opt);
+}
+
+}  // namespace csv
+
+}  // namespace tref
+#endif
@@ -0,0 +1,633 @@
+// Tref: entity component storage by archetype chunks of reflected components.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_ECS_H
+#define TREF_ECS_H
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// Entities with the same set of components(archetype) are stored together in
+// chunks of 16KB, each data field of the components in its own column, so
+// that a query touches only the columns it reads.
+// Components are reflected classes, default constructible. Fields trivially
+// copyable are moved by memcpy, the others by their move constructors.
+// Rows are kept dense: removing one moves the last row into its place.
+
+constexpr size_t ecs_chunk_bytes = 16 * 1024;
+
+struct EcsEntity {
+  uint32_t index = ~0u;
+  uint32_t generation = 0;
+
+  bool operator==(const EcsEntity& o) const {
+    return index == o.index && generation == o.generation;
+  }
+  bool operator!=(const EcsEntity& o) const { return !(*this == o); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// components
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct EcsField {
+  string_view name;
+  size_t      offset;  // in the component.
+  size_t      size;
+  size_t      align;
+
+  // nullptr for trivial operations.
+  void (*relocate_fn)(void* dst, void* src);  // move construct & destroy src.
+  void (*copy_fn)(void* dst, const void* src);
+  void (*assign_fn)(void* dst, const void* src);
+  void (*destroy_fn)(void* p);
+
+  void relocate(void* dst, void* src) const {
+    relocate_fn ? relocate_fn(dst, src) : void(memcpy(dst, src, size));
+  }
+  void copy(void* dst, const void* src) const {
+    copy_fn ? copy_fn(dst, src) : void(memcpy(dst, src, size));
+  }
+  void assign(void* dst, const void* src) const {
+    assign_fn ? assign_fn(dst, src) : void(memcpy(dst, src, size));
+  }
+  void destroy(void* p) const {
+    if (destroy_fn)
+      destroy_fn(p);
+  }
+};
+
+struct EcsComponent {
+  uint32_t         index;  // dense id given on the first use.
+  string_view      name;
+  size_t           size;
+  size_t           align;
+  vector<EcsField> fields;
+};
+
+inline uint32_t ecs_next_component_index() {
+  static atomic<uint32_t> next{0};
+  return next++;
+}
+
+template <typename M>
+EcsField make_ecs_field(string_view name, size_t offset) {
+  EcsField f{name,    offset,  sizeof(M), alignof(M),
+             nullptr, nullptr, nullptr,   nullptr};
+  if constexpr (!is_trivially_copyable_v<M>) {
+    f.relocate_fn = [](void* dst, void* src) {
+      auto s = static_cast<M*>(src);
+      new (dst) M(move(*s));
+      s->~M();
+    };
+    f.copy_fn = [](void* dst, const void* src) {
+      new (dst) M(*static_cast<const M*>(src));
+    };
+    f.assign_fn = [](void* dst, const void* src) {
+      *static_cast<M*>(dst) = *static_cast<const M*>(src);
+    };
+  }
+  if constexpr (!is_trivially_destructible_v<M>)
+    f.destroy_fn = [](void* p) { static_cast<M*>(p)->~M(); };
+  return f;
+}
+
+// Runtime description of the component, the fields in the order of
+// data_fields<C>().
+template <typename C>
+const EcsComponent& ecs_component() {
+  static_assert(is_reflected_v<C> && is_default_constructible_v<C>);
+  static const EcsComponent c = [] {
+    EcsComponent r{ecs_next_component_index(), class_info<C>().name,
+                   class_info<C>().size, alignof(C), {}};
+    apply(
+        [&](auto... fs) {
+          (r.fields.push_back(make_ecs_field<typename decltype(fs)::member_t>(
+               fs.name, offset_of<C>(fs.value))),
+           ...);
+        },
+        data_fields<C>());
+    return r;
+  }();
+  return c;
+}
+
+// Index of the field in data_fields<C>().
+template <typename C, auto Ptr>
+constexpr size_t ecs_field_index() {
+  size_t idx = ~size_t{0}, i = 0;
+  apply(
+      [&](auto... fs) {
+        (
+            [&] {
+              if constexpr (is_same_v<decltype(fs.value), decltype(Ptr)>) {
+                if (fs.value == Ptr)
+                  idx = i;
+              }
+              i++;
+            }(),
+            ...);
+      },
+      data_fields<C>());
+  return idx;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// archetype
+//
+//////////////////////////////////////////////////////////////////////////
+
+class EcsArchetype {
+ public:
+  struct Column {
+    const EcsField* field;
+    size_t          offset;  // in the chunk.
+  };
+
+  // @param components: sorted by index.
+  explicit EcsArchetype(vector<const EcsComponent*> components)
+      : components_{move(components)} {
+    for (auto c : components_) {
+      first_column_.push_back(columns_.size());
+      for (auto& f : c->fields)
+        columns_.push_back({&f, 0});
+    }
+    size_t row = sizeof(EcsEntity);
+    for (auto& c : columns_)
+      row += c.field->size;
+    capacity_ = max<size_t>(ecs_chunk_bytes / row, 1);
+    while (capacity_ > 1 && layout(capacity_) > ecs_chunk_bytes)
+      capacity_--;
+    chunk_bytes_ = max(layout(capacity_), ecs_chunk_bytes);
+  }
+
+  EcsArchetype(const EcsArchetype&) = delete;
+  EcsArchetype& operator=(const EcsArchetype&) = delete;
+
+  ~EcsArchetype() {
+    for (size_t r = 0; r < size_; r++) {
+      for (size_t i = 0; i < columns_.size(); i++)
+        columns_[i].field->destroy(at(r, i));
+    }
+    for (auto p : chunks_)
+      ::operator delete(p, align_val_t{cache_line_size});
+  }
+
+  const vector<const EcsComponent*>& components() const {
+    return components_;
+  }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }  // rows per chunk.
+  size_t chunk_count() const { return (size_ + capacity_ - 1) / capacity_; }
+  char*  chunk(size_t i) const { return chunks_[i]; }
+
+  // Rows in the chunk.
+  size_t chunk_size(size_t i) const {
+    return min(capacity_, size_ - i * capacity_);
+  }
+
+  // Position of the component, -1 if not found.
+  int find(const EcsComponent* c) const {
+    for (size_t i = 0; i < components_.size(); i++) {
+      if (components_[i] == c)
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
+
+  bool has(uint32_t component_index) const {
+    for (auto c : components_) {
+      if (c->index == component_index)
+        return true;
+    }
+    return false;
+  }
+
+  size_t first_column(size_t component) const {
+    return first_column_[component];
+  }
+  const Column& column(size_t i) const { return columns_[i]; }
+  size_t        column_count() const { return columns_.size(); }
+
+  char* at(size_t row, size_t column) const {
+    auto& c = columns_[column];
+    return chunks_[row / capacity_] + c.offset +
+           (row % capacity_) * c.field->size;
+  }
+
+  EcsEntity& entity(size_t row) const {
+    return reinterpret_cast<EcsEntity*>(chunks_[row / capacity_])[row %
+                                                                  capacity_];
+  }
+
+  // Append a row, the columns are left to be constructed by the caller.
+  size_t push(EcsEntity e) {
+    if (size_ == chunks_.size() * capacity_) {
+      chunks_.push_back(static_cast<char*>(
+          ::operator new(chunk_bytes_, align_val_t{cache_line_size})));
+    }
+    entity(size_) = e;
+    return size_++;
+  }
+
+  // Fill the row, whose columns are already destroyed or moved out, with the
+  // last row.
+  // @return the entity moved, or an invalid one.
+  EcsEntity fill_hole(size_t row) {
+    EcsEntity moved;
+    auto      last = size_ - 1;
+    if (row != last) {
+      for (size_t i = 0; i < columns_.size(); i++)
+        columns_[i].field->relocate(at(row, i), at(last, i));
+      moved = entity(row) = entity(last);
+    }
+    size_--;
+    if (chunks_.size() > chunk_count() + 1) {
+      ::operator delete(chunks_.back(), align_val_t{cache_line_size});
+      chunks_.pop_back();
+    }
+    return moved;
+  }
+
+ private:
+  // Assign the column offsets for the rows per chunk.
+  // @return bytes of the chunk.
+  size_t layout(size_t rows) {
+    size_t off = rows * sizeof(EcsEntity);
+    for (auto& c : columns_) {
+      off = (off + c.field->align - 1) / c.field->align * c.field->align;
+      c.offset = off;
+      off += rows * c.field->size;
+    }
+    return off;
+  }
+
+  vector<const EcsComponent*> components_;
+  vector<size_t>              first_column_;
+  vector<Column>              columns_;
+  vector<char*>               chunks_;
+  size_t                      capacity_ = 1;
+  size_t                      chunk_bytes_ = ecs_chunk_bytes;
+  size_t                      size_ = 0;
+};
+
+// Chunk seen by a query.
+class EcsChunk {
+ public:
+  EcsChunk(const EcsArchetype* a, size_t chunk)
+      : archetype_{a},
+        data_{a->chunk(chunk)},
+        size_{a->chunk_size(chunk)} {}
+
+  size_t size() const { return size_; }
+
+  Span<const EcsEntity> entities() const {
+    return {reinterpret_cast<const EcsEntity*>(data_), size_};
+  }
+
+  // Contiguous values of the field in the chunk, e.g. column<&Pos::x>().
+  // @param C: the component, for fields declared by its base class.
+  template <auto Ptr, typename C = enclosing_class_t<decltype(Ptr)>>
+  Span<member_t<decltype(Ptr)>> column() const {
+    using M = member_t<decltype(Ptr)>;
+    constexpr auto field = ecs_field_index<C, Ptr>();
+    static_assert(field != ~size_t{0}, "not a reflected data member of C");
+    auto comp = archetype_->find(&ecs_component<C>());
+    assert(comp >= 0 && "the component is not in the query");
+    auto& col = archetype_->column(archetype_->first_column(comp) + field);
+    return {reinterpret_cast<M*>(data_ + col.offset), size_};
+  }
+
+ private:
+  const EcsArchetype* archetype_;
+  char*               data_;
+  size_t              size_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// world
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Entities & their components.
+// NOTE: no entity can be created, destroyed or changed of components while
+// iterating the chunks.
+class EcsWorld {
+ public:
+  EcsWorld() { empty_ = archetype({}); }
+
+  EcsWorld(const EcsWorld&) = delete;
+  EcsWorld& operator=(const EcsWorld&) = delete;
+
+  // Create an entity with the components.
+  template <typename... C>
+  EcsEntity create(const C&... comps) {
+    EcsEntity e;
+    if (!free_.empty()) {
+      e.index = free_.back();
+      free_.pop_back();
+    } else {
+      e.index = static_cast<uint32_t>(records_.size());
+      records_.push_back({});
+    }
+    auto& rec = records_[e.index];
+    e.generation = rec.generation;
+    rec.archetype = empty_;
+    rec.row = empty_->push(e);
+    if constexpr (sizeof...(C) > 0)
+      add(e, comps...);
+    return e;
+  }
+
+  void destroy(EcsEntity e) {
+    assert(alive(e));
+    auto& rec = records_[e.index];
+    auto& a = *rec.archetype;
+    for (size_t i = 0; i < a.column_count(); i++)
+      a.column(i).field->destroy(a.at(rec.row, i));
+    fix_moved(a.fill_hole(rec.row), rec.row);
+    rec.archetype = nullptr;
+    rec.generation++;
+    free_.push_back(e.index);
+  }
+
+  bool alive(EcsEntity e) const {
+    return e.index < records_.size() && records_[e.index].archetype &&
+           records_[e.index].generation == e.generation;
+  }
+
+  size_t size() const { return records_.size() - free_.size(); }
+
+  // Add the components, or assign those already added.
+  template <typename... C>
+  void add(EcsEntity e, const C&... comps) {
+    static_assert(sizeof...(C) > 0);
+    assert(alive(e));
+    (register_component<C>(), ...);
+    auto&               rec = records_[e.index];
+    const EcsComponent* types[] = {&ecs_component<C>()...};
+    const void*         values[] = {&comps...};
+    bool had[] = {(rec.archetype->find(&ecs_component<C>()) >= 0)...};
+
+    auto key = key_of(*rec.archetype);
+    for (size_t i = 0; i < sizeof...(C); i++) {
+      if (!had[i])
+        key.push_back(types[i]->index);
+    }
+    if (key.size() != rec.archetype->components().size())
+      move_to(e, archetype(move(key)), types, values, sizeof...(C));
+    size_t i = 0;
+    ((had[i++] ? set(e, comps) : void()), ...);
+  }
+
+  template <typename C>
+  void remove(EcsEntity e) {
+    assert(alive(e));
+    auto& rec = records_[e.index];
+    auto  c = &ecs_component<C>();
+    if (rec.archetype->find(c) < 0)
+      return;
+    auto key = key_of(*rec.archetype);
+    key.erase(find(key.begin(), key.end(), c->index));
+    move_to(e, archetype(move(key)), nullptr, nullptr, 0);
+  }
+
+  template <typename C>
+  bool has(EcsEntity e) const {
+    return alive(e) &&
+           records_[e.index].archetype->find(&ecs_component<C>()) >= 0;
+  }
+
+  // Copy of the component gathered from the columns.
+  template <typename C>
+  C get(EcsEntity e) const {
+    C r;
+    each_column<C>(e, [&](const EcsField& f, char* col) {
+      f.assign(reinterpret_cast<char*>(&r) + f.offset, col);
+    });
+    return r;
+  }
+
+  template <typename C>
+  void set(EcsEntity e, const C& c) {
+    each_column<C>(e, [&](const EcsField& f, char* col) {
+      f.assign(col, reinterpret_cast<const char*>(&c) + f.offset);
+    });
+  }
+
+  // Reference to the field of the entity in its column, e.g.
+  //   world.field<&Pos::x>(e) += 1;
+  template <auto Ptr, typename C = enclosing_class_t<decltype(Ptr)>>
+  member_t<decltype(Ptr)>& field(EcsEntity e) {
+    constexpr auto idx = ecs_field_index<C, Ptr>();
+    static_assert(idx != ~size_t{0}, "not a reflected data member of C");
+    auto& rec = records_[e.index];
+    auto  comp = rec.archetype->find(&ecs_component<C>());
+    assert(alive(e) && comp >= 0);
+    auto col = rec.archetype->first_column(comp) + idx;
+    return *reinterpret_cast<member_t<decltype(Ptr)>*>(
+        rec.archetype->at(rec.row, col));
+  }
+
+  // Call f(EcsChunk& chunk) for the chunks of the entities having all the
+  // components.
+  template <typename... C, typename F>
+  void each_chunk(F&& f) const {
+    uint32_t ids[] = {ecs_component<C>().index..., 0};
+    for (auto& a : archetypes_) {
+      if (!matches(*a, ids, sizeof...(C)))
+        continue;
+      for (size_t i = 0; i < a->chunk_count(); i++) {
+        EcsChunk c{a.get(), i};
+        f(c);
+      }
+    }
+  }
+
+  // Same as each_chunk, the chunks are split among the threads.
+  // @param threads: 0 for the count of hardware threads.
+  template <typename... C, typename F>
+  void par_each_chunk(F&& f, unsigned threads = 0) const {
+    vector<EcsChunk> chunks;
+    each_chunk<C...>([&](EcsChunk& c) { chunks.push_back(c); });
+    if (!threads)
+      threads = max(thread::hardware_concurrency(), 1u);
+    threads = static_cast<unsigned>(min<size_t>(threads, chunks.size()));
+
+    atomic<size_t> next{0};
+    auto           work = [&] {
+      for (size_t i; (i = next++) < chunks.size();)
+        f(chunks[i]);
+    };
+    vector<thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+      pool.emplace_back(work);
+    work();
+    for (auto& t : pool)
+      t.join();
+  }
+
+  // Count of the entities having all the components.
+  template <typename... C>
+  size_t count() const {
+    size_t n = 0;
+    each_chunk<C...>([&](EcsChunk& c) { n += c.size(); });
+    return n;
+  }
+
+  size_t archetype_count() const { return archetypes_.size(); }
+
+ private:
+  struct Record {
+    EcsArchetype* archetype = nullptr;
+    size_t        row = 0;
+    uint32_t      generation = 0;
+  };
+
+  static vector<uint32_t> key_of(const EcsArchetype& a) {
+    vector<uint32_t> key;
+    for (auto c : a.components())
+      key.push_back(c->index);
+    return key;
+  }
+
+  static bool matches(const EcsArchetype& a, const uint32_t* ids, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      if (!a.has(ids[i]))
+        return false;
+    }
+    return true;
+  }
+
+  EcsArchetype* archetype(vector<uint32_t> key) {
+    sort(key.begin(), key.end());
+    auto& a = by_key_[key];
+    if (!a) {
+      vector<const EcsComponent*> comps;
+      for (auto id : key)
+        comps.push_back(components_[id]);
+      archetypes_.push_back(make_unique<EcsArchetype>(move(comps)));
+      a = archetypes_.back().get();
+    }
+    return a;
+  }
+
+  // Move the entity to the archetype, the components not in the current one
+  // are copied from the values.
+  void move_to(EcsEntity                  e,
+               EcsArchetype*              dst,
+               const EcsComponent* const* types,
+               const void* const*         values,
+               size_t                     n) {
+    auto& rec = records_[e.index];
+    auto& src = *rec.archetype;
+    auto  row = dst->push(e);
+    for (size_t ci = 0; ci < dst->components().size(); ci++) {
+      auto comp = dst->components()[ci];
+      auto from = src.find(comp);
+      auto value = values;
+      if (from < 0)
+        value = values + (find(types, types + n, comp) - types);
+      for (size_t fi = 0; fi < comp->fields.size(); fi++) {
+        auto& f = comp->fields[fi];
+        auto  p = dst->at(row, dst->first_column(ci) + fi);
+        if (from >= 0)
+          f.relocate(p, src.at(rec.row, src.first_column(from) + fi));
+        else
+          f.copy(p, static_cast<const char*>(*value) + f.offset);
+      }
+    }
+    for (size_t ci = 0; ci < src.components().size(); ci++) {
+      auto comp = src.components()[ci];
+      if (dst->find(comp) >= 0)
+        continue;
+      for (size_t fi = 0; fi < comp->fields.size(); fi++) {
+        comp->fields[fi].destroy(
+            src.at(rec.row, src.first_column(ci) + fi));
+      }
+    }
+    fix_moved(src.fill_hole(rec.row), rec.row);
+    rec.archetype = dst;
+    rec.row = row;
+  }
+
+  void fix_moved(EcsEntity moved, size_t row) {
+    if (moved.index != ~0u)
+      records_[moved.index].row = row;
+  }
+
+  template <typename C, typename F>
+  void each_column(EcsEntity e, F&& f) const {
+    assert(alive(e));
+    auto& rec = records_[e.index];
+    auto  comp = rec.archetype->find(&ecs_component<C>());
+    assert(comp >= 0 && "the entity has no such component");
+    auto first = rec.archetype->first_column(comp);
+    for (size_t i = 0; i < ecs_component<C>().fields.size(); i++) {
+      f(ecs_component<C>().fields[i],
+        rec.archetype->at(rec.row, first + i));
+    }
+  }
+
+  template <typename C>
+  void register_component() {
+    auto& c = ecs_component<C>();
+    if (components_.size() <= c.index)
+      components_.resize(c.index + 1);
+    components_[c.index] = &c;
+  }
+
+  vector<Record>                       records_;
+  vector<uint32_t>                     free_;
+  vector<const EcsComponent*>          components_;  // by index.
+  map<vector<uint32_t>, EcsArchetype*> by_key_;
+  vector<unique_ptr<EcsArchetype>>     archetypes_;
+  EcsArchetype*                        empty_;
+};
+
+}  // namespace imp
+
+using imp::ecs_chunk_bytes;
+using imp::EcsChunk;
+using imp::EcsEntity;
+using imp::EcsWorld;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,494 @@
+// Tref: dense containers keyed by reflected enums.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_ENUM_MAP_H
+#define TREF_ENUM_MAP_H
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <string_view>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// index
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Maps the values of a reflected enum to the dense slots 0..N-1 in item
+// order, N = enum_info<E>().items.size(). The table is built at compile
+// time:
+// - values 0..N-1 in item order: the value is the slot.
+// - values in a small range: a lookup table over the range.
+// - otherwise: binary search in the values sorted.
+// An item with the value of a previous item(alias) shares its slot, the
+// slot of the alias is left unused.
+template <typename E>
+struct EnumIndex {
+  static_assert(is_enum_v<E>);
+
+  static constexpr auto   info = enum_info<E>();
+  static constexpr size_t size = info.items.size();
+  static constexpr size_t npos = ~size_t(0);
+
+  static constexpr int64_t value_of(size_t i) {
+    return static_cast<int64_t>(info.items[i].value);
+  }
+
+  // Slot of the first item with the value of item i.
+  static constexpr size_t first_slot(size_t i) {
+    for (size_t j = 0; j < i; j++) {
+      if (value_of(j) == value_of(i))
+        return j;
+    }
+    return i;
+  }
+
+  static constexpr bool identity = [] {
+    for (size_t i = 0; i < size; i++) {
+      if (value_of(i) != static_cast<int64_t>(i))
+        return false;
+    }
+    return true;
+  }();
+
+  static constexpr bool has_alias = [] {
+    for (size_t i = 0; i < size; i++) {
+      if (first_slot(i) != i)
+        return true;
+    }
+    return false;
+  }();
+
+  static constexpr int64_t min_value = [] {
+    int64_t r = size ? value_of(0) : 0;
+    for (size_t i = 1; i < size; i++)
+      r = value_of(i) < r ? value_of(i) : r;
+    return r;
+  }();
+
+  static constexpr uint64_t range = [] {
+    int64_t r = min_value;
+    for (size_t i = 0; i < size; i++)
+      r = value_of(i) > r ? value_of(i) : r;
+    return static_cast<uint64_t>(r - min_value) + 1;
+  }();
+
+  static constexpr bool ranged = !identity && range <= size * 4 + 64;
+
+  static constexpr auto table = [] {
+    array<uint32_t, ranged ? range : 0> r{};
+    if constexpr (ranged) {
+      for (auto& s : r)
+        s = ~uint32_t(0);
+      for (size_t i = size; i-- > 0;)
+        r[value_of(i) - min_value] = static_cast<uint32_t>(first_slot(i));
+    }
+    return r;
+  }();
+
+  struct Sorted {
+    int64_t  value;
+    uint32_t slot;
+  };
+
+  static constexpr auto sorted = [] {
+    array<Sorted, ranged || identity ? 0 : size> r{};
+    if constexpr (!ranged && !identity) {
+      for (size_t i = 0; i < size; i++)
+        r[i] = {value_of(i), static_cast<uint32_t>(first_slot(i))};
+      // insertion sort, stable so the aliases come after their first item.
+      for (size_t i = 1; i < size; i++) {
+        for (size_t j = i; j > 0 && r[j].value < r[j - 1].value; j--) {
+          auto t = r[j];
+          r[j] = r[j - 1];
+          r[j - 1] = t;
+        }
+      }
+    }
+    return r;
+  }();
+
+  // @return npos if the value is not an item.
+  static constexpr size_t slot_of(E v) {
+    auto x = static_cast<int64_t>(v);
+    if constexpr (identity) {
+      return x >= 0 && static_cast<uint64_t>(x) < size ? size_t(x) : npos;
+    } else if constexpr (ranged) {
+      auto d = static_cast<uint64_t>(x - min_value);
+      return x >= min_value && d < range && table[d] != ~uint32_t(0)
+                 ? table[d]
+                 : npos;
+    } else {
+      size_t lo = 0, hi = size;
+      while (lo < hi) {
+        auto mid = (lo + hi) / 2;
+        if (sorted[mid].value < x)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return lo < size && sorted[lo].value == x ? sorted[lo].slot : npos;
+    }
+  }
+
+  static constexpr E value_at(size_t slot) { return info.items[slot].value; }
+
+  static constexpr string_view name_at(size_t slot) {
+    return info.items[slot].name;
+  }
+
+  // False for the unused slots of the aliases.
+  static constexpr bool used(size_t slot) {
+    if constexpr (has_alias)
+      return first_slot(slot) == slot;
+    else
+      return true;
+  }
+};
+
+// Dense slot of the reflected enum value, npos if not an item.
+template <typename E>
+constexpr size_t enum_slot(E v) {
+  return EnumIndex<E>::slot_of(v);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// enum_set
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Set of the items of a reflected enum, one bit per item.
+template <typename E>
+class enum_set {
+  using Index = EnumIndex<E>;
+  static constexpr size_t word_count = (Index::size + 63) / 64;
+
+ public:
+  class iterator {
+   public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = E;
+    using difference_type = ptrdiff_t;
+    using pointer = const E*;
+    using reference = E;
+
+    constexpr iterator(const enum_set* s, size_t slot) : set_{s}, slot_{slot} {
+      skip();
+    }
+    constexpr E         operator*() const { return Index::value_at(slot_); }
+    constexpr iterator& operator++() {
+      slot_++;
+      skip();
+      return *this;
+    }
+    constexpr bool operator==(const iterator& o) const {
+      return slot_ == o.slot_;
+    }
+    constexpr bool operator!=(const iterator& o) const { return !(*this == o); }
+
+   private:
+    constexpr void skip() {
+      while (slot_ < Index::size && !set_->test(slot_))
+        slot_++;
+    }
+
+    const enum_set* set_;
+    size_t          slot_;
+  };
+
+  constexpr enum_set() = default;
+  constexpr enum_set(initializer_list<E> items) {
+    for (auto e : items)
+      insert(e);
+  }
+
+  static constexpr enum_set all() {
+    enum_set r;
+    for (size_t i = 0; i < Index::size; i++) {
+      if (Index::used(i))
+        r.words_[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    return r;
+  }
+
+  // @return false if the value is not an item.
+  constexpr bool insert(E v) {
+    auto i = Index::slot_of(v);
+    if (i == Index::npos)
+      return false;
+    words_[i / 64] |= uint64_t(1) << (i % 64);
+    return true;
+  }
+
+  constexpr bool erase(E v) {
+    auto i = Index::slot_of(v);
+    if (i == Index::npos || !test(i))
+      return false;
+    words_[i / 64] &= ~(uint64_t(1) << (i % 64));
+    return true;
+  }
+
+  constexpr bool contains(E v) const {
+    auto i = Index::slot_of(v);
+    return i != Index::npos && test(i);
+  }
+
+  constexpr size_t size() const {
+    size_t n = 0;
+    for (auto w : words_) {
+      for (; w; w &= w - 1)
+        n++;
+    }
+    return n;
+  }
+
+  constexpr bool empty() const {
+    for (auto w : words_) {
+      if (w)
+        return false;
+    }
+    return true;
+  }
+
+  constexpr void clear() {
+    for (auto& w : words_)
+      w = 0;
+  }
+
+  constexpr iterator begin() const { return {this, 0}; }
+  constexpr iterator end() const { return {this, Index::size}; }
+
+  // In item order.
+  // @param f: [](E value, string_view name) -> bool, return false to stop the
+  // iterating.
+  template <typename F>
+  constexpr bool each(F&& f) const {
+    for (size_t i = 0; i < Index::size; i++) {
+      if (test(i) && !f(Index::value_at(i), Index::name_at(i)))
+        return false;
+    }
+    return true;
+  }
+
+  constexpr enum_set& operator|=(const enum_set& o) {
+    for (size_t i = 0; i < word_count; i++)
+      words_[i] |= o.words_[i];
+    return *this;
+  }
+  constexpr enum_set& operator&=(const enum_set& o) {
+    for (size_t i = 0; i < word_count; i++)
+      words_[i] &= o.words_[i];
+    return *this;
+  }
+  constexpr enum_set& operator-=(const enum_set& o) {
+    for (size_t i = 0; i < word_count; i++)
+      words_[i] &= ~o.words_[i];
+    return *this;
+  }
+  friend constexpr enum_set operator|(enum_set a, const enum_set& b) {
+    return a |= b;
+  }
+  friend constexpr enum_set operator&(enum_set a, const enum_set& b) {
+    return a &= b;
+  }
+  friend constexpr enum_set operator-(enum_set a, const enum_set& b) {
+    return a -= b;
+  }
+  friend constexpr bool operator==(const enum_set& a, const enum_set& b) {
+    for (size_t i = 0; i < word_count; i++) {
+      if (a.words_[i] != b.words_[i])
+        return false;
+    }
+    return true;
+  }
+  friend constexpr bool operator!=(const enum_set& a, const enum_set& b) {
+    return !(a == b);
+  }
+
+ private:
+  constexpr bool test(size_t slot) const {
+    return (words_[slot / 64] >> (slot % 64)) & 1;
+  }
+
+  array<uint64_t, word_count> words_{};
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// enum_map
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename E, typename V>
+struct EnumMapEntry {
+  E           key;
+  string_view name;
+  V&          value;
+};
+
+// A value for every item of a reflected enum, stored in an array in item
+// order, i.e. a lookup is an index computation, no hashing or allocation.
+template <typename E, typename V>
+class enum_map {
+  using Index = EnumIndex<E>;
+
+ public:
+  template <typename Map, typename Value>
+  class basic_iterator {
+   public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = EnumMapEntry<E, Value>;
+    using difference_type = ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    constexpr basic_iterator(Map* m, size_t slot) : map_{m}, slot_{slot} {
+      skip();
+    }
+    constexpr EnumMapEntry<E, Value> operator*() const {
+      return {Index::value_at(slot_), Index::name_at(slot_),
+              map_->values_[slot_]};
+    }
+    constexpr basic_iterator& operator++() {
+      slot_++;
+      skip();
+      return *this;
+    }
+    constexpr bool operator==(const basic_iterator& o) const {
+      return slot_ == o.slot_;
+    }
+    constexpr bool operator!=(const basic_iterator& o) const {
+      return !(*this == o);
+    }
+
+   private:
+    constexpr void skip() {
+      while (slot_ < Index::size && !Index::used(slot_))
+        slot_++;
+    }
+
+    Map*   map_;
+    size_t slot_;
+  };
+
+  using iterator = basic_iterator<enum_map, V>;
+  using const_iterator = basic_iterator<const enum_map, const V>;
+
+  constexpr enum_map() = default;
+  constexpr explicit enum_map(const V& v) { fill(v); }
+
+  // The value must be an item.
+  constexpr V& operator[](E v) {
+    auto i = Index::slot_of(v);
+    assert(i != Index::npos && "the value is not an item of the enum");
+    return values_[i];
+  }
+  constexpr const V& operator[](E v) const {
+    auto i = Index::slot_of(v);
+    assert(i != Index::npos && "the value is not an item of the enum");
+    return values_[i];
+  }
+
+  // nullptr if the value is not an item.
+  constexpr V* find(E v) {
+    auto i = Index::slot_of(v);
+    return i == Index::npos ? nullptr : &values_[i];
+  }
+  constexpr const V* find(E v) const {
+    auto i = Index::slot_of(v);
+    return i == Index::npos ? nullptr : &values_[i];
+  }
+
+  constexpr void fill(const V& v) {
+    for (auto& e : values_)
+      e = v;
+  }
+
+  // Count of the items, aliases excluded.
+  static constexpr size_t size() {
+    size_t n = 0;
+    for (size_t i = 0; i < Index::size; i++)
+      n += Index::used(i);
+    return n;
+  }
+
+  constexpr iterator       begin() { return {this, 0}; }
+  constexpr iterator       end() { return {this, Index::size}; }
+  constexpr const_iterator begin() const { return {this, 0}; }
+  constexpr const_iterator end() const { return {this, Index::size}; }
+
+  // In item order.
+  // @param f: [](E key, string_view name, V& value) -> bool, return false to
+  // stop the iterating.
+  template <typename F>
+  constexpr bool each(F&& f) {
+    for (size_t i = 0; i < Index::size; i++) {
+      if (Index::used(i) &&
+          !f(Index::value_at(i), Index::name_at(i), values_[i]))
+        return false;
+    }
+    return true;
+  }
+  template <typename F>
+  constexpr bool each(F&& f) const {
+    for (size_t i = 0; i < Index::size; i++) {
+      if (Index::used(i) &&
+          !f(Index::value_at(i), Index::name_at(i), values_[i]))
+        return false;
+    }
+    return true;
+  }
+
+  friend constexpr bool operator==(const enum_map& a, const enum_map& b) {
+    for (size_t i = 0; i < Index::size; i++) {
+      if (Index::used(i) && !(a.values_[i] == b.values_[i]))
+        return false;
+    }
+    return true;
+  }
+  friend constexpr bool operator!=(const enum_map& a, const enum_map& b) {
+    return !(a == b);
+  }
+
+ private:
+  array<V, Index::size> values_{};
+};
+
+}  // namespace imp
+
+using imp::enum_map;
+using imp::enum_set;
+using imp::enum_slot;
+using imp::EnumIndex;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,249 @@
+// Tref: arena backed factory for reflected class hierarchies.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_FACTORY_H
+#define TREF_FACTORY_H
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Arena
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Bump allocator: memory is only released all at once by reset().
+// NOTE: not thread safe, use one arena per thread.
+class Arena {
+ public:
+  explicit Arena(size_t chunk_size = 64 * 1024) : chunkSize_{chunk_size} {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena() { release(); }
+
+  void* allocate(size_t size, size_t align) {
+    if (auto p = bump(size, align))
+      return p;
+    // the oversized block takes a dedicated chunk.
+    auto cap = size + align > chunkSize_ ? size + align : chunkSize_;
+    chunks_.push_back(Chunk{make_unique<max_align_t[]>(
+                                (cap + sizeof(max_align_t) - 1) /
+                                sizeof(max_align_t)),
+                            cap});
+    cur_ = chunks_.size() - 1;
+    used_ = 0;
+    return bump(size, align);
+  }
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    auto p = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    if constexpr (!is_trivially_destructible_v<T>) {
+      dtors_.push_back({p, [](void* o) { static_cast<T*>(o)->~T(); }});
+    }
+    return p;
+  }
+
+  // Register a destructor to be called by reset(), for objects constructed by
+  // placement new into allocate().
+  void on_reset(void* obj, void (*dtor)(void*)) {
+    dtors_.push_back({obj, dtor});
+  }
+
+  // Destroy all the objects in reverse order of creation, the chunks are kept
+  // for reusing.
+  void reset() {
+    for (auto i = dtors_.rbegin(); i != dtors_.rend(); ++i)
+      i->second(i->first);
+    dtors_.clear();
+    cur_ = 0;
+    used_ = 0;
+  }
+
+  // Like reset() but also give the memory back to the system.
+  void release() {
+    reset();
+    chunks_.clear();
+  }
+
+  size_t capacity() const {
+    size_t n = 0;
+    for (auto& c : chunks_)
+      n += c.size;
+    return n;
+  }
+
+ private:
+  struct Chunk {
+    unique_ptr<max_align_t[]> mem;
+    size_t                    size;
+  };
+
+  void* bump(size_t size, size_t align) {
+    for (; cur_ < chunks_.size(); cur_++, used_ = 0) {
+      void* p = reinterpret_cast<char*>(chunks_[cur_].mem.get()) + used_;
+      auto  left = chunks_[cur_].size - used_;
+      if (std::align(align, size, p, left)) {
+        used_ = chunks_[cur_].size - left + size;
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  size_t                               chunkSize_;
+  vector<Chunk>                        chunks_;
+  size_t                               cur_ = 0;
+  size_t                               used_ = 0;
+  vector<pair<void*, void (*)(void*)>> dtors_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Factory
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename Base>
+struct FactoryEntry {
+  string_view name;
+  string_view full_name;
+  uint64_t    id;
+  size_t      size;
+  size_t      align;
+  Base* (*construct)(void*);
+  void (*destroy)(void*);  // nullptr for trivially destructible type.
+
+  // objects created since last reset.
+  size_t count = 0;
+};
+
+// Create the objects of Base and all its reflected subclasses into an arena,
+// the objects are freed all at once by reset().
+// Types are looked up by the fully qualified name, the short name(if not
+// ambiguous) or the type id.
+// NOTE: not thread safe, use one factory per thread.
+template <typename Base>
+class Factory {
+ public:
+  using Entry = FactoryEntry<Base>;
+
+  explicit Factory(size_t chunk_size = 64 * 1024) : arena_{chunk_size} {
+    add(class_info<Base>());
+    class_info<Base>().each_subclass([&](auto info, int) {
+      add(info);
+      return true;
+    });
+
+    for (size_t i = 0; i < entries_.size(); i++) {
+      index_.emplace(entries_[i].id, i);
+    }
+    // short names are only usable when not ambiguous.
+    unordered_map<uint64_t, int> shortNames;
+    for (auto& e : entries_) {
+      shortNames[fnv1a_64(e.name)]++;
+    }
+    for (size_t i = 0; i < entries_.size(); i++) {
+      auto h = fnv1a_64(entries_[i].name);
+      if (shortNames[h] == 1)
+        index_.emplace(h, i);
+    }
+  }
+
+  // @return nullptr if the type is not found.
+  Base* create(string_view name) { return create(fnv1a_64(name)); }
+
+  Base* create(uint64_t id) {
+    auto it = index_.find(id);
+    if (it == index_.end())
+      return nullptr;
+    auto& e = entries_[it->second];
+    auto  mem = arena_.allocate(e.size, e.align);
+    auto  obj = e.construct(mem);
+    // the Base subobject may not be at offset 0 of the object.
+    if (e.destroy)
+      arena_.on_reset(mem, e.destroy);
+    e.count++;
+    return obj;
+  }
+
+  template <typename S>
+  S* create() {
+    static_assert(is_base_of_v<Base, S>);
+    auto it = index_.find(type_id_v<S>);
+    if (it != index_.end())
+      entries_[it->second].count++;
+    return arena_.make<S>();
+  }
+
+  // Destroy all the created objects and recycle the memory.
+  void reset() {
+    arena_.reset();
+    for (auto& e : entries_)
+      e.count = 0;
+  }
+
+  const vector<Entry>& types() const { return entries_; }
+
+  const Entry* find(string_view name) const {
+    auto it = index_.find(fnv1a_64(name));
+    return it == index_.end() ? nullptr : &entries_[it->second];
+  }
+
+  const Arena& arena() const { return arena_; }
+
+ private:
+  template <typename Info>
+  void add(Info info) {
+    using S = typename Info::class_t;
+    if constexpr (is_default_constructible_v<S> && !is_abstract_v<S>) {
+      Entry e{info.name, info.full_name, info.id, info.size, info.align,
+              [](void* p) -> Base* { return new (p) S(); }, nullptr};
+      if constexpr (!is_trivially_destructible_v<S>) {
+        e.destroy = [](void* p) { static_cast<S*>(p)->~S(); };
+      }
+      entries_.push_back(e);
+    }
+  }
+
+  Arena                           arena_;
+  vector<Entry>                   entries_;
+  unordered_map<uint64_t, size_t> index_;
+};
+
+}  // namespace imp
+
+using imp::Arena;
+using imp::Factory;
+
+}  // namespace tref
+#endif
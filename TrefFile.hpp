@@ -0,0 +1,130 @@
+// Tref: read-only memory mapped file.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_FILE_H
+#define TREF_FILE_H
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tref {
+namespace imp {
+
+using namespace std;
+
+// The whole file mapped into memory, pages are loaded on demand by the OS.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  explicit MappedFile(const string& path) { open(path); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const string& path) {
+    close();
+#ifdef _WIN32
+    auto f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER sz;
+    if (GetFileSizeEx(f, &sz) && sz.QuadPart > 0) {
+      auto m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (m) {
+        auto p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+        data_ = static_cast<const char*>(p);
+        CloseHandle(m);
+      }
+    }
+    auto empty = sz.QuadPart == 0;
+    size_ = data_ ? static_cast<size_t>(sz.QuadPart) : 0;
+    CloseHandle(f);
+    return data_ || empty;
+#else
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    auto        ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+      auto p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      if (ok) {
+        data_ = static_cast<const char*>(p);
+        size_ = static_cast<size_t>(st.st_size);
+      }
+    }
+    ::close(fd);
+    return ok;
+#endif
+  }
+
+  void close() {
+    if (data_) {
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  // Hint the OS to read the pages in ahead of use, no-op on Windows.
+  void prefetch() const {
+#ifndef _WIN32
+    if (data_)
+      posix_madvise(const_cast<char*>(data_), size_, POSIX_MADV_WILLNEED);
+#endif
+  }
+
+  const char* data() const { return data_; }
+  size_t      size() const { return size_; }
+  string_view view() const { return {data_, size_}; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t      size_ = 0;
+};
+
+}  // namespace imp
+
+using imp::MappedFile;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,732 @@
+// Tref: filters compiled from runtime expressions over reflected fields.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_FILTER_H
+#define TREF_FILTER_H
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefSoa.hpp"
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// parser
+//
+//////////////////////////////////////////////////////////////////////////
+
+enum class FilterOp { Eq, Ne, Lt, Le, Gt, Ge, StartsWith, EndsWith, Contains };
+
+struct FilterLiteral {
+  enum Kind { Int, Float, String, Ident } kind = Int;
+  int64_t i = 0;
+  double  d = 0;
+  string  s;
+};
+
+// Comparison of a field with a literal.
+struct FilterTerm {
+  string        field;
+  FilterOp      op;
+  FilterLiteral literal;
+  size_t        pos;  // position in the expression, for errors.
+};
+
+// Plan of the expression in postfix order.
+struct FilterNode {
+  enum Kind { Term, And, Or, Not } kind;
+  size_t term;
+};
+
+// Grammar:
+//   or    := and ('||' and)*
+//   and   := unary ('&&' unary)*
+//   unary := '!' unary | '(' or ')' | field [op literal]
+//   op    := == | != | < | <= | > | >= | startswith | endswith | contains
+// A single field is short for `field == true`.
+class FilterParser {
+ public:
+  explicit FilterParser(string_view s) : s_{s} {}
+
+  // @return error message, empty if succeeded.
+  string parse(vector<FilterNode>& plan, vector<FilterTerm>& terms) {
+    plan_ = &plan;
+    terms_ = &terms;
+    skip_space();
+    if (pos_ == s_.size())
+      return "empty filter";
+    parse_or();
+    if (error_.empty() && pos_ != s_.size())
+      fail("unexpected character");
+    return error_;
+  }
+
+ private:
+  void fail(string_view msg) {
+    if (error_.empty())
+      error_ = string{msg} + " at " + to_string(pos_);
+  }
+
+  void skip_space() {
+    while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' ||
+                                s_[pos_] == '\r' || s_[pos_] == '\n'))
+      pos_++;
+  }
+
+  bool eat(string_view tok) {
+    skip_space();
+    if (s_.substr(pos_, tok.size()) != tok)
+      return false;
+    pos_ += tok.size();
+    return true;
+  }
+
+  string_view ident() {
+    skip_space();
+    auto b = pos_;
+    while (pos_ < s_.size() &&
+           (is_ident_char(s_[pos_]) || (pos_ > b && s_[pos_] == '.')))
+      pos_++;
+    if (b < s_.size() && s_[b] >= '0' && s_[b] <= '9')
+      pos_ = b;
+    return s_.substr(b, pos_ - b);
+  }
+
+  void parse_or() {
+    parse_and();
+    while (error_.empty() && eat("||")) {
+      parse_and();
+      plan_->push_back({FilterNode::Or, 0});
+    }
+  }
+
+  void parse_and() {
+    parse_unary();
+    while (error_.empty() && eat("&&")) {
+      parse_unary();
+      plan_->push_back({FilterNode::And, 0});
+    }
+  }
+
+  void parse_unary() {
+    if (eat("!")) {
+      parse_unary();
+      plan_->push_back({FilterNode::Not, 0});
+    } else if (eat("(")) {
+      parse_or();
+      if (error_.empty() && !eat(")"))
+        fail("expect ')'");
+    } else {
+      parse_term();
+    }
+  }
+
+  void parse_term() {
+    FilterTerm t;
+    t.pos = (skip_space(), pos_);
+    t.field = string{ident()};
+    if (t.field.empty())
+      return fail("expect field name");
+
+    constexpr pair<string_view, FilterOp> ops[] = {
+        {"==", FilterOp::Eq}, {"!=", FilterOp::Ne}, {"<=", FilterOp::Le},
+        {">=", FilterOp::Ge}, {"<", FilterOp::Lt},  {">", FilterOp::Gt}};
+    constexpr pair<string_view, FilterOp> words[] = {
+        {"startswith", FilterOp::StartsWith},
+        {"endswith", FilterOp::EndsWith},
+        {"contains", FilterOp::Contains}};
+
+    auto found = false;
+    for (auto& [tok, op] : ops) {
+      if (!found && eat(tok)) {
+        t.op = op;
+        found = true;
+      }
+    }
+    for (auto& [tok, op] : words) {
+      auto p = pos_;
+      if (!found && ident() == tok) {
+        t.op = op;
+        found = true;
+      } else if (!found) {
+        pos_ = p;
+      }
+    }
+    if (!found) {
+      t.op = FilterOp::Eq;
+      t.literal = {FilterLiteral::Ident, 0, 0, "true"};
+    } else if (!parse_literal(t.literal)) {
+      return;
+    }
+    plan_->push_back({FilterNode::Term, terms_->size()});
+    terms_->push_back(move(t));
+  }
+
+  bool parse_literal(FilterLiteral& l) {
+    skip_space();
+    if (pos_ == s_.size()) {
+      fail("expect literal");
+      return false;
+    }
+    auto c = s_[pos_];
+    if (c == '"' || c == '\'') {
+      l.kind = FilterLiteral::String;
+      for (pos_++; pos_ < s_.size() && s_[pos_] != c; pos_++) {
+        if (s_[pos_] == '\\' && pos_ + 1 < s_.size())
+          pos_++;
+        l.s += s_[pos_];
+      }
+      if (pos_ == s_.size()) {
+        fail("unterminated string");
+        return false;
+      }
+      pos_++;
+      return true;
+    }
+    if (c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9')) {
+      auto b = s_.data() + pos_ + (c == '+');
+      auto e = s_.data() + s_.size();
+      auto ri = from_chars(b, e, l.i);
+      auto rd = from_chars(b, e, l.d);
+      if (rd.ec != errc{}) {
+        fail("invalid number");
+        return false;
+      }
+      l.kind = ri.ec == errc{} && ri.ptr == rd.ptr ? FilterLiteral::Int
+                                                   : FilterLiteral::Float;
+      pos_ = static_cast<size_t>(rd.ptr - s_.data());
+      return true;
+    }
+    l.kind = FilterLiteral::Ident;
+    l.s = string{ident()};
+    if (l.s.empty()) {
+      fail("expect literal");
+      return false;
+    }
+    return true;
+  }
+
+  string_view         s_;
+  size_t              pos_ = 0;
+  string              error_;
+  vector<FilterNode>* plan_ = nullptr;
+  vector<FilterTerm>* terms_ = nullptr;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// kernels
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename M>
+constexpr auto is_string_field_v =
+    is_same_v<M, string> || is_same_v<M, string_view>;
+
+struct FilterLeaf;
+using FilterKernel = void (*)(const FilterLeaf& leaf,
+                              const char*       base,
+                              size_t            stride,
+                              size_t            n,
+                              uint64_t*         out);
+
+// Compiled term with the literal converted for the field.
+struct FilterLeaf {
+  size_t       field;
+  int64_t      i;
+  double       d;
+  string       s;
+  FilterKernel kernel;
+};
+
+template <FilterOp Op, typename A, typename B>
+bool filter_apply(const A& a, const B& b) {
+  if constexpr (Op == FilterOp::Eq) {
+    return a == b;
+  } else if constexpr (Op == FilterOp::Ne) {
+    return a != b;
+  } else if constexpr (Op == FilterOp::Lt) {
+    return a < b;
+  } else if constexpr (Op == FilterOp::Le) {
+    return a <= b;
+  } else if constexpr (Op == FilterOp::Gt) {
+    return a > b;
+  } else if constexpr (Op == FilterOp::Ge) {
+    return a >= b;
+  } else if constexpr (Op == FilterOp::StartsWith) {
+    return string_view{a}.substr(0, b.size()) == b;
+  } else if constexpr (Op == FilterOp::EndsWith) {
+    return a.size() >= b.size() &&
+           string_view{a}.substr(a.size() - b.size()) == b;
+  } else {
+    return string_view{a}.find(b) != string_view::npos;
+  }
+}
+
+// Lane type of the vectorized compares.
+template <typename M, typename = void>
+struct filter_lane {
+  using type = void;
+};
+template <>
+struct filter_lane<float> {
+  using type = float;
+};
+template <>
+struct filter_lane<int32_t> {
+  using type = int32_t;
+};
+template <typename M>
+struct filter_lane<M, enable_if_t<is_enum_v<M>>> {
+  using type = typename filter_lane<underlying_type_t<M>>::type;
+};
+
+// Compare 64 values to the literal.
+// @return bit j is set if p[j] matches.
+template <FilterOp Op>
+uint64_t filter_word(const float* p, float lit) {
+  uint64_t bits = 0;
+#if defined(__AVX__)
+  constexpr int pred = Op == FilterOp::Eq   ? _CMP_EQ_OQ
+                       : Op == FilterOp::Ne ? _CMP_NEQ_UQ
+                       : Op == FilterOp::Lt ? _CMP_LT_OQ
+                       : Op == FilterOp::Le ? _CMP_LE_OQ
+                       : Op == FilterOp::Gt ? _CMP_GT_OQ
+                                            : _CMP_GE_OQ;
+  auto l = _mm256_set1_ps(lit);
+  for (int j = 0; j < 64; j += 8) {
+    auto m = _mm256_cmp_ps(_mm256_loadu_ps(p + j), l, pred);
+    bits |= static_cast<uint64_t>(_mm256_movemask_ps(m)) << j;
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  auto l = _mm_set1_ps(lit);
+  for (int j = 0; j < 64; j += 4) {
+    auto v = _mm_loadu_ps(p + j);
+    __m128 m;
+    if constexpr (Op == FilterOp::Eq)
+      m = _mm_cmpeq_ps(v, l);
+    else if constexpr (Op == FilterOp::Ne)
+      m = _mm_cmpneq_ps(v, l);
+    else if constexpr (Op == FilterOp::Lt)
+      m = _mm_cmplt_ps(v, l);
+    else if constexpr (Op == FilterOp::Le)
+      m = _mm_cmple_ps(v, l);
+    else if constexpr (Op == FilterOp::Gt)
+      m = _mm_cmpgt_ps(v, l);
+    else
+      m = _mm_cmpge_ps(v, l);
+    bits |= static_cast<uint64_t>(_mm_movemask_ps(m)) << j;
+  }
+#else
+  for (int j = 0; j < 64; j++)
+    bits |= static_cast<uint64_t>(filter_apply<Op>(p[j], lit)) << j;
+#endif
+  return bits;
+}
+
+template <FilterOp Op>
+uint64_t filter_word(const int32_t* p, int32_t lit) {
+  uint64_t bits = 0;
+  // Ne, Le & Ge are negations of Eq, Gt & Lt.
+  constexpr auto negate =
+      Op == FilterOp::Ne || Op == FilterOp::Le || Op == FilterOp::Ge;
+#if defined(__AVX2__)
+  auto l = _mm256_set1_epi32(lit);
+  for (int j = 0; j < 64; j += 8) {
+    auto   v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + j));
+    __m256i m;
+    if constexpr (Op == FilterOp::Eq || Op == FilterOp::Ne)
+      m = _mm256_cmpeq_epi32(v, l);
+    else if constexpr (Op == FilterOp::Gt || Op == FilterOp::Le)
+      m = _mm256_cmpgt_epi32(v, l);
+    else
+      m = _mm256_cmpgt_epi32(l, v);
+    auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+    bits |= static_cast<uint64_t>(negate ? mask ^ 0xff : mask) << j;
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  auto l = _mm_set1_epi32(lit);
+  for (int j = 0; j < 64; j += 4) {
+    auto    v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + j));
+    __m128i m;
+    if constexpr (Op == FilterOp::Eq || Op == FilterOp::Ne)
+      m = _mm_cmpeq_epi32(v, l);
+    else if constexpr (Op == FilterOp::Gt || Op == FilterOp::Le)
+      m = _mm_cmpgt_epi32(v, l);
+    else
+      m = _mm_cmplt_epi32(v, l);
+    auto mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+    bits |= static_cast<uint64_t>(negate ? mask ^ 0xf : mask) << j;
+  }
+#else
+  for (int j = 0; j < 64; j++)
+    bits |= static_cast<uint64_t>(filter_apply<Op>(p[j], lit)) << j;
+#endif
+  return bits;
+}
+
+template <typename M>
+auto filter_literal(const FilterLeaf& leaf) {
+  if constexpr (is_string_field_v<M>) {
+    return string_view{leaf.s};
+  } else if constexpr (is_floating_point_v<M>) {
+    return static_cast<M>(leaf.d);
+  } else {
+    return static_cast<M>(leaf.i);
+  }
+}
+
+// Scan the n values of the field from base, contiguous arithmetic & enum
+// columns of 4 bytes are compared by SIMD.
+template <typename M, FilterOp Op>
+void filter_kernel(const FilterLeaf& leaf,
+                   const char*       base,
+                   size_t            stride,
+                   size_t            n,
+                   uint64_t*         out) {
+  auto   lit = filter_literal<M>(leaf);
+  size_t i = 0;
+
+  using Lane = typename filter_lane<M>::type;
+  if constexpr (!is_void_v<Lane> && Op <= FilterOp::Ge) {
+    if (stride == sizeof(M)) {
+      auto p = reinterpret_cast<const Lane*>(base);
+      for (; i + 64 <= n; i += 64)
+        out[i / 64] = filter_word<Op>(p + i, static_cast<Lane>(lit));
+    }
+  }
+  for (; i < n; i += 64) {
+    auto     m = min<size_t>(64, n - i);
+    uint64_t bits = 0;
+    for (size_t j = 0; j < m; j++) {
+      auto& v = *reinterpret_cast<const M*>(base + (i + j) * stride);
+      bits |= static_cast<uint64_t>(filter_apply<Op>(v, lit)) << j;
+    }
+    out[i / 64] = bits;
+  }
+}
+
+template <typename M>
+FilterKernel filter_kernel_of(FilterOp op) {
+  switch (op) {
+    case FilterOp::Eq: return &filter_kernel<M, FilterOp::Eq>;
+    case FilterOp::Ne: return &filter_kernel<M, FilterOp::Ne>;
+    case FilterOp::Lt: return &filter_kernel<M, FilterOp::Lt>;
+    case FilterOp::Le: return &filter_kernel<M, FilterOp::Le>;
+    case FilterOp::Gt: return &filter_kernel<M, FilterOp::Gt>;
+    case FilterOp::Ge: return &filter_kernel<M, FilterOp::Ge>;
+    default: break;
+  }
+  if constexpr (is_string_field_v<M>) {
+    switch (op) {
+      case FilterOp::StartsWith:
+        return &filter_kernel<M, FilterOp::StartsWith>;
+      case FilterOp::EndsWith: return &filter_kernel<M, FilterOp::EndsWith>;
+      case FilterOp::Contains: return &filter_kernel<M, FilterOp::Contains>;
+      default: break;
+    }
+  }
+  return nullptr;
+}
+
+// @return error message, empty if succeeded.
+template <typename M>
+string compile_filter_leaf(const FilterTerm& t, FilterLeaf& leaf) {
+  auto& l = t.literal;
+  auto  err = [&](string_view msg) {
+    return string{msg} + " for field '" + t.field + "' at " + to_string(t.pos);
+  };
+
+  if constexpr (is_same_v<M, bool>) {
+    if (l.kind == FilterLiteral::Ident && (l.s == "true" || l.s == "false"))
+      leaf.i = l.s == "true";
+    else if (l.kind == FilterLiteral::Int && (l.i == 0 || l.i == 1))
+      leaf.i = l.i;
+    else
+      return err("expect true or false");
+  } else if constexpr (is_enum_v<M>) {
+    if (l.kind == FilterLiteral::Ident) {
+      if constexpr (is_reflected_enum_v<M>) {
+        // the default value is returned for unknown names.
+        auto v = string_to_enum(l.s, M{});
+        if (v == M{} && string_to_enum(l.s, static_cast<M>(1)) != M{})
+          return err("unknown enum item '" + l.s + "'");
+        leaf.i = static_cast<int64_t>(v);
+      } else {
+        return err("enum is not reflected");
+      }
+    } else if (l.kind == FilterLiteral::Int) {
+      leaf.i = l.i;
+    } else {
+      return err("expect enum item");
+    }
+  } else if constexpr (is_integral_v<M>) {
+    using Lim = numeric_limits<M>;
+    if (l.kind != FilterLiteral::Int)
+      return err("expect integer");
+    if (l.i < static_cast<int64_t>(Lim::min()) ||
+        (Lim::max() < numeric_limits<int64_t>::max() &&
+         l.i > static_cast<int64_t>(Lim::max())))
+      return err("integer out of range");
+    leaf.i = l.i;
+  } else if constexpr (is_floating_point_v<M>) {
+    if (l.kind == FilterLiteral::Int)
+      leaf.d = static_cast<double>(l.i);
+    else if (l.kind == FilterLiteral::Float)
+      leaf.d = l.d;
+    else
+      return err("expect number");
+  } else if constexpr (is_string_field_v<M>) {
+    if (l.kind != FilterLiteral::String)
+      return err("expect string");
+    leaf.s = l.s;
+  } else {
+    return err("unsupported type");
+  }
+
+  leaf.kernel = filter_kernel_of<M>(t.op);
+  if (!leaf.kernel)
+    return err("unsupported operator");
+  return {};
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Filter
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Bitmap of the rows matched, bit i%64 of word i/64 is set if row i matches.
+struct Selection {
+  vector<uint64_t> bits;
+  size_t           size = 0;
+
+  bool test(size_t i) const { return (bits[i / 64] >> (i % 64)) & 1; }
+
+  size_t count() const {
+    size_t n = 0;
+    for (auto w : bits) {
+      for (; w; w &= w - 1)
+        n++;
+    }
+    return n;
+  }
+
+  // @param f: [](size_t row)
+  template <typename F>
+  void each(F&& f) const {
+    for (size_t i = 0; i < bits.size(); i++) {
+      size_t j = 0;
+      for (auto w = bits[i]; w; w >>= 1, j++) {
+        if (w & 1)
+          f(i * 64 + j);
+      }
+    }
+  }
+};
+
+// Filter compiled from the expression against the data fields of T, e.g.
+//   auto f = Filter<Player>::compile("level >= 10 && name startswith \"a\"");
+// the terms are evaluated column by column in batches of rows, combined with
+// bitwise operations of the selection bitmaps.
+template <typename T>
+class Filter {
+  static constexpr auto fields_ = data_fields<T>();
+  static constexpr auto N = tuple_size_v<decltype(fields_)>;
+  using Indices = make_index_sequence<N>;
+
+  template <size_t I>
+  using member_at_t =
+      typename remove_reference_t<decltype(get<I>(fields_))>::member_t;
+
+  // rows per batch, the bitmaps of a batch fit in the L1 cache.
+  static constexpr size_t batch_rows = 1024;
+  static constexpr size_t batch_words = batch_rows / 64;
+
+  // The field of rows: base address & distance between rows in bytes.
+  struct Column {
+    const char* base;
+    size_t      stride;
+  };
+
+ public:
+  static Filter compile(string_view expr) {
+    Filter             f;
+    vector<FilterTerm> terms;
+    f.error_ = FilterParser{expr}.parse(f.plan_, terms);
+    for (auto& t : terms) {
+      if (!f.error_.empty())
+        break;
+      FilterLeaf leaf{N, 0, 0, {}, nullptr};
+      f.error_ = compile_leaf(t, leaf, Indices{});
+      if (f.error_.empty() && leaf.field == N)
+        f.error_ = "unknown field '" + t.field + "' at " + to_string(t.pos);
+      f.leaves_.push_back(move(leaf));
+    }
+
+    size_t depth = 0;
+    for (auto& n : f.plan_) {
+      depth += n.kind == FilterNode::Term ? 1 : 0;
+      depth -= n.kind == FilterNode::And || n.kind == FilterNode::Or ? 1 : 0;
+      f.depth_ = max(f.depth_, depth);
+    }
+    return f;
+  }
+
+  explicit operator bool() const { return error_.empty(); }
+  const string& error() const { return error_; }
+
+  Selection select(Span<const T> rows) const {
+    Column cols[N > 0 ? N : 1]{};
+    if (!rows.empty())
+      aos_columns(rows.data(), cols, Indices{});
+    return select(cols, rows.size());
+  }
+
+  Selection select(const SoaVector<T>& rows) const {
+    Column cols[N > 0 ? N : 1]{};
+    if (!rows.empty())
+      soa_columns(rows, cols, Indices{});
+    return select(cols, rows.size());
+  }
+
+  bool match(const T& row) const {
+    return select(Span<const T>{&row, 1}).test(0);
+  }
+
+ private:
+  template <size_t... Is>
+  static string compile_leaf(const FilterTerm&     t,
+                             FilterLeaf&           leaf,
+                             index_sequence<Is...>) {
+    string err;
+    (
+        [&] {
+          if (leaf.field == N && get<Is>(fields_).name == t.field) {
+            leaf.field = Is;
+            err = compile_filter_leaf<member_at_t<Is>>(t, leaf);
+          }
+        }(),
+        ...);
+    return err;
+  }
+
+  template <size_t... Is>
+  static void aos_columns(const T* rows, Column* cols, index_sequence<Is...>) {
+    ((cols[Is] = {reinterpret_cast<const char*>(
+                      &(rows->*get<Is>(fields_).value)),
+                  sizeof(T)}),
+     ...);
+  }
+
+  template <size_t... Is>
+  static void soa_columns(const SoaVector<T>& rows,
+                          Column*             cols,
+                          index_sequence<Is...>) {
+    (
+        [&] {
+          auto p = reinterpret_cast<const char*>(&rows.template at<Is>(0));
+          // cold fields are strided in the shared column.
+          auto stride = sizeof(member_at_t<Is>);
+          if (rows.size() > 1) {
+            auto q = reinterpret_cast<const char*>(&rows.template at<Is>(1));
+            stride = static_cast<size_t>(q - p);
+          }
+          cols[Is] = {p, stride};
+        }(),
+        ...);
+  }
+
+  Selection select(const Column* cols, size_t n) const {
+    Selection r{vector<uint64_t>((n + 63) / 64), n};
+    if (!error_.empty())
+      return r;
+
+    vector<uint64_t> stack(depth_ * batch_words);
+    for (size_t b = 0; b < n; b += batch_rows) {
+      auto   m = min(batch_rows, n - b);
+      auto   words = (m + 63) / 64;
+      size_t top = 0;
+      for (auto& node : plan_) {
+        // binary nodes combine the top into the one below it.
+        auto pop = node.kind == FilterNode::Term  ? 0
+                   : node.kind == FilterNode::Not ? 1
+                                                  : 2;
+        auto dst = &stack[(top - pop) * batch_words];
+        auto src = dst + batch_words;
+        switch (node.kind) {
+          case FilterNode::Term: {
+            auto& l = leaves_[node.term];
+            auto& c = cols[l.field];
+            l.kernel(l, c.base + b * c.stride, c.stride, m, dst);
+            top++;
+            break;
+          }
+          case FilterNode::And:
+            for (size_t w = 0; w < words; w++)
+              dst[w] &= src[w];
+            top--;
+            break;
+          case FilterNode::Or:
+            for (size_t w = 0; w < words; w++)
+              dst[w] |= src[w];
+            top--;
+            break;
+          case FilterNode::Not:
+            for (size_t w = 0; w < words; w++)
+              dst[w] = ~dst[w];
+            if (m % 64)
+              dst[words - 1] &= (uint64_t{1} << (m % 64)) - 1;
+            break;
+        }
+      }
+      copy(stack.begin(), stack.begin() + words, r.bits.begin() + b / 64);
+    }
+    return r;
+  }
+
+  string             error_;
+  vector<FilterNode> plan_;
+  vector<FilterLeaf> leaves_;
+  size_t             depth_ = 0;
+};
+
+}  // namespace imp
+
+using imp::Filter;
+using imp::FilterOp;
+using imp::Selection;
+
+}  // namespace tref
+#endif
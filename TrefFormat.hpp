@@ -0,0 +1,280 @@
+// Tref: allocation free text formatting of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_FORMAT_H
+#define TREF_FORMAT_H
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// Compact:  {id: 1, pos: {x: 1.5, y: 2}, tags: ["a", "b"], kind: Big}
+// Indented: every field on its own line, indented by 2 spaces per level,
+//   ranges of objects one element per line.
+// Numbers are written by to_chars, enums by name(or the number if not
+// reflected), strings quoted & escaped, optionals as the value or null.
+// Values of other types are written as ?.
+enum class FormatMode { Compact, Indented };
+
+//////////////////////////////////////////////////////////////////////////
+//
+// writer
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Write into a fixed buffer, the text is truncated if it's full.
+class FormatWriter {
+ public:
+  FormatWriter(char* first, char* last, FormatMode mode)
+      : p_{first}, end_{last}, indented_{mode == FormatMode::Indented} {}
+
+  char* ptr() const { return p_; }
+  bool  full() const { return full_; }
+  bool  indented() const { return indented_; }
+
+  void put(char c) {
+    if (p_ == end_) {
+      full_ = true;
+      return;
+    }
+    *p_++ = c;
+  }
+
+  void put(string_view s) {
+    auto n = min(s.size(), static_cast<size_t>(end_ - p_));
+    memcpy(p_, s.data(), n);
+    p_ += n;
+    full_ |= n < s.size();
+  }
+
+  // Formatted in a local buffer first since the output of a failed to_chars
+  // is unspecified, then the prefix that fits is kept.
+  template <typename N>
+  void number(N v) {
+    char tmp[64];
+    auto r = to_chars(tmp, tmp + sizeof(tmp), v);
+    if (r.ec != errc{}) {
+      full_ = true;
+      return;
+    }
+    put(string_view(tmp, static_cast<size_t>(r.ptr - tmp)));
+  }
+
+  void quoted(string_view s) {
+    put('"');
+    for (auto c : s) {
+      switch (c) {
+        case '"': put("\\\""); break;
+        case '\\': put("\\\\"); break;
+        case '\n': put("\\n"); break;
+        case '\r': put("\\r"); break;
+        case '\t': put("\\t"); break;
+        default: put(c);
+      }
+    }
+    put('"');
+  }
+
+  // Start a line in the indented mode.
+  void line(int depth) {
+    put('\n');
+    for (int i = 0; i < depth; i++)
+      put("  ");
+  }
+
+ private:
+  char* p_;
+  char* end_;
+  bool  indented_;
+  bool  full_ = false;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// values
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename = void>
+struct is_format_range : false_type {};
+
+template <typename T>
+struct is_format_range<T,
+                       void_t<decltype(std::begin(declval<const T&>())),
+                              decltype(std::end(declval<const T&>()))>>
+    : true_type {};
+
+template <typename T>
+struct is_format_optional : false_type {};
+
+template <typename T>
+struct is_format_optional<optional<T>> : true_type {};
+
+// "name: " of the field, built at compile time.
+template <typename T, size_t I>
+struct FormatLabel {
+  static constexpr auto name = get<I>(data_fields<T>()).name;
+  static constexpr auto text = [] {
+    array<char, name.size() + 2> r{};
+    for (size_t i = 0; i < name.size(); i++)
+      r[i] = name[i];
+    r[name.size()] = ':';
+    r[name.size() + 1] = ' ';
+    return r;
+  }();
+
+  static constexpr string_view view() { return {text.data(), text.size()}; }
+};
+
+template <typename M>
+void format_value(FormatWriter& w, const M& v, int depth);
+
+template <typename T, size_t I, typename M>
+void format_field(FormatWriter& w, const M& v, int depth) {
+  if (I > 0)
+    w.put(w.indented() ? "," : ", ");
+  if (w.indented())
+    w.line(depth + 1);
+  w.put(FormatLabel<T, I>::view());
+  format_value(w, v, depth + 1);
+}
+
+template <typename T, size_t... Is>
+void format_fields(FormatWriter& w,
+                   const T&      v,
+                   int           depth,
+                   index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  w.put('{');
+  (format_field<T, Is>(w, v.*(get<Is>(fields).value), depth), ...);
+  if (w.indented() && sizeof...(Is) > 0)
+    w.line(depth);
+  w.put('}');
+}
+
+template <typename C>
+void format_range(FormatWriter& w, const C& c, int depth) {
+  using E = remove_cv_t<remove_reference_t<decltype(*std::begin(c))>>;
+  constexpr bool lines = is_reflected_v<E>;
+  bool           first = true;
+  w.put('[');
+  for (auto& e : c) {
+    if (!first)
+      w.put(w.indented() && lines ? "," : ", ");
+    if (w.indented() && lines)
+      w.line(depth + 1);
+    format_value(w, e, depth + 1);
+    first = false;
+  }
+  if (w.indented() && lines && !first)
+    w.line(depth);
+  w.put(']');
+}
+
+template <typename M>
+void format_value(FormatWriter& w, const M& v, int depth) {
+  if constexpr (is_same_v<M, bool>) {
+    w.put(v ? "true" : "false");
+  } else if constexpr (is_arithmetic_v<M>) {
+    w.number(v);
+  } else if constexpr (is_enum_v<M>) {
+    if constexpr (is_reflected_enum_v<M>) {
+      constexpr auto items = enum_info<M>().items;
+      for (auto& e : items) {
+        if (e.value == v) {
+          w.put(e.name);
+          return;
+        }
+      }
+    }
+    w.number(static_cast<underlying_type_t<M>>(v));
+  } else if constexpr (is_same_v<M, string> || is_same_v<M, string_view>) {
+    w.quoted(v);
+  } else if constexpr (is_same_v<decay_t<M>, const char*> ||
+                       is_same_v<decay_t<M>, char*>) {
+    if (v)
+      w.quoted(v);
+    else
+      w.put("null");
+  } else if constexpr (is_format_optional<M>::value) {
+    if (v)
+      format_value(w, *v, depth);
+    else
+      w.put("null");
+  } else if constexpr (is_reflected_v<M>) {
+    constexpr auto n = tuple_size_v<decltype(data_fields<M>())>;
+    format_fields(w, v, depth, make_index_sequence<n>{});
+  } else if constexpr (is_format_range<M>::value) {
+    format_range(w, v, depth);
+  } else {
+    w.put('?');
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// APIs
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Write the object as text into [first, last), nothing is allocated, the
+// text is not null terminated.
+// @return the end of the text, with errc::value_too_large if truncated.
+template <typename T>
+to_chars_result format_to(char*      first,
+                          char*      last,
+                          const T&   obj,
+                          FormatMode mode = FormatMode::Compact) {
+  FormatWriter w{first, last, mode};
+  format_value(w, obj, 0);
+  return {w.ptr(), w.full() ? errc::value_too_large : errc{}};
+}
+
+// e.g.
+//   char buf[256];
+//   log(format_to(buf, player));
+// @return the text written, truncated if the buffer is full.
+template <size_t N, typename T>
+string_view format_to(char (&buf)[N],
+                      const T&   obj,
+                      FormatMode mode = FormatMode::Compact) {
+  auto r = format_to(buf, buf + N, obj, mode);
+  return {buf, static_cast<size_t>(r.ptr - buf)};
+}
+
+}  // namespace imp
+
+using imp::format_to;
+using imp::FormatMode;
+
+}  // namespace tref
+#endif
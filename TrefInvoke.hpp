@@ -0,0 +1,272 @@
+// Tref: type-erased invokers of reflected functions without allocation.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_INVOKE_H
+#define TREF_INVOKE_H
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// arguments
+//
+//////////////////////////////////////////////////////////////////////////
+
+constexpr size_t max_invoke_args = 8;
+
+// Arguments viewed by the invoker thunks.
+struct ArgView {
+  char*           base;
+  const uint16_t* offsets;
+  const uint64_t* types;
+  size_t          count;
+
+  void* at(size_t i) const { return base + offsets[i]; }
+};
+
+// Arguments of a call stored by value in a fixed size buffer, i.e. on the
+// stack when the pack is a local variable.
+template <size_t Capacity = 64>
+class ArgPack {
+ public:
+  ArgPack() = default;
+  ArgPack(const ArgPack&) = delete;
+  ArgPack& operator=(const ArgPack&) = delete;
+  ~ArgPack() { clear(); }
+
+  // Store a copy of the argument(or move it in).
+  // @return false if the pack is full.
+  template <typename A>
+  bool push(A&& a) {
+    using D = decay_t<A>;
+    static_assert(alignof(D) <= alignof(max_align_t), "over aligned");
+    auto off = (used_ + alignof(D) - 1) / alignof(D) * alignof(D);
+    if constexpr (sizeof(D) > Capacity) {
+      return false;
+    } else {
+      if (count_ == max_invoke_args || off + sizeof(D) > Capacity)
+        return false;
+      new (buf_ + off) D(forward<A>(a));
+      offsets_[count_] = static_cast<uint16_t>(off);
+      types_[count_] = type_id_v<D>;
+      dtors_[count_] = nullptr;
+      if constexpr (!is_trivially_destructible_v<D>)
+        dtors_[count_] = [](void* p) { static_cast<D*>(p)->~D(); };
+      count_++;
+      used_ = off + sizeof(D);
+      return true;
+    }
+  }
+
+  // Destroy the arguments.
+  void clear() {
+    for (size_t i = count_; i-- > 0;) {
+      if (dtors_[i])
+        dtors_[i](buf_ + offsets_[i]);
+    }
+    count_ = used_ = 0;
+  }
+
+  size_t  size() const { return count_; }
+  ArgView view() { return {buf_, offsets_, types_, count_}; }
+
+ private:
+  alignas(max_align_t) char buf_[Capacity];
+  uint16_t offsets_[max_invoke_args];
+  uint64_t types_[max_invoke_args];
+  void (*dtors_[max_invoke_args])(void*);
+  size_t count_ = 0;
+  size_t used_ = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// invoker
+//
+//////////////////////////////////////////////////////////////////////////
+
+// The argument is passed as lvalue for lvalue references, or moved out of the
+// pack.
+template <typename A>
+decltype(auto) invoke_arg(void* p) {
+  using D = decay_t<A>;
+  if constexpr (is_lvalue_reference_v<A>)
+    return *static_cast<D*>(p);
+  else
+    return move(*static_cast<D*>(p));
+}
+
+// @param T: the class of obj, the class declaring the function if void.
+template <typename T, typename P, size_t... Is>
+bool invoke_thunk(const void*    fn,
+                  void*          obj,
+                  const ArgView& args,
+                  void*          ret,
+                  index_sequence<Is...>) {
+  using Trait = func_trait<P>;
+  using Args = typename Trait::args_t;
+  using R = typename Trait::ret_t;
+
+  if (args.count != sizeof...(Is) ||
+      ((args.types[Is] != type_id_v<decay_t<tuple_element_t<Is, Args>>>) ||
+       ... || false))
+    return false;
+
+  P f;
+  memcpy(&f, fn, sizeof(P));
+  auto call = [&]() -> decltype(auto) {
+    if constexpr (is_member_function_pointer_v<P>) {
+      using C = enclosing_class_t<P>;
+      using Obj = conditional_t<is_void_v<T>, C, T>;
+      static_assert(is_base_of_v<C, Obj>);
+      // through Obj*, the base declaring the function may not be at offset 0.
+      return (static_cast<C*>(static_cast<Obj*>(obj))->*f)(
+          invoke_arg<tuple_element_t<Is, Args>>(args.at(Is))...);
+    } else {
+      return f(invoke_arg<tuple_element_t<Is, Args>>(args.at(Is))...);
+    }
+  };
+  if constexpr (is_void_v<R>) {
+    call();
+  } else {
+    if (ret)
+      *static_cast<remove_cv_t<remove_reference_t<R>>*>(ret) = call();
+    else
+      call();
+  }
+  return true;
+}
+
+// Type ids of the return type & the argument types.
+template <typename P, size_t... Is>
+constexpr auto make_signature_ids(index_sequence<Is...>) {
+  using Trait = func_trait<P>;
+  using Args = typename Trait::args_t;
+  using R = remove_cv_t<remove_reference_t<typename Trait::ret_t>>;
+  return array<uint64_t, sizeof...(Is) + 1>{
+      type_id_v<R>, type_id_v<decay_t<tuple_element_t<Is, Args>>>...};
+}
+
+template <typename P>
+constexpr auto signature_ids =
+    make_signature_ids<P>(make_index_sequence<func_trait<P>::args_count>{});
+
+// Call a reflected member or static function with the arguments of an
+// ArgPack, nothing is allocated.
+class Invoker {
+ public:
+  Invoker() = default;
+
+  // @param ptr: member function pointer of T or its base classes, or static
+  //   function pointer.
+  template <typename T, typename P>
+  Invoker(Type<T>, P ptr) {
+    static_assert(is_member_function_pointer_v<P> ||
+                      is_function_v<remove_pointer_t<P>>,
+                  "not a function");
+    static_assert(sizeof(P) <= sizeof(fn_), "unsupported function pointer");
+    memcpy(fn_, &ptr, sizeof(P));
+    thunk_ = [](const void* fn, void* obj, const ArgView& args, void* ret) {
+      constexpr auto n = func_trait<P>::args_count;
+      return invoke_thunk<T, P>(fn, obj, args, ret,
+                                make_index_sequence<n>{});
+    };
+    signature_ = signature_ids<P>.data();
+    args_count_ = func_trait<P>::args_count;
+    is_member_ = is_member_function_pointer_v<P>;
+  }
+
+  // The object passed to the calls is of the class declaring the function.
+  template <typename P>
+  explicit Invoker(P ptr) : Invoker{Type<void>{}, ptr} {}
+
+  explicit operator bool() const { return thunk_ != nullptr; }
+
+  size_t   args_count() const { return args_count_; }
+  uint64_t arg_type(size_t i) const { return signature_[i + 1]; }
+  uint64_t ret_type() const { return signature_[0]; }
+  bool     is_member() const { return is_member_; }
+
+  // @param obj: the object for member functions, ignored by static ones. It
+  //   points to T of Invoker(Type<T>, ptr) or find_invoker<T>.
+  // @param ret: address of the return value to assign, nullptr to discard.
+  // @return false if the arguments do not match the parameters, the function
+  //   is not called.
+  template <size_t N>
+  bool operator()(void* obj, ArgPack<N>& args, void* ret = nullptr) const {
+    return thunk_(fn_, obj, args.view(), ret);
+  }
+
+  // Type checked version, the return type must be the same.
+  template <typename R, size_t N>
+  bool call(void* obj, ArgPack<N>& args, R* ret) const {
+    return ret_type() == type_id_v<R> && (*this)(obj, args, ret);
+  }
+
+ private:
+  using Thunk = bool (*)(const void*    fn,
+                         void*          obj,
+                         const ArgView& args,
+                         void*          ret);
+
+  alignas(max_align_t) char fn_[32]{};
+  Thunk           thunk_ = nullptr;
+  const uint64_t* signature_ = nullptr;
+  size_t          args_count_ = 0;
+  bool            is_member_ = false;
+};
+
+// Find the invoker of the reflected member or static function of T or its
+// base classes, the first one for overloaded functions.
+template <typename T>
+Invoker find_invoker(string_view name) {
+  Invoker r;
+  class_info<T>().each_field([&](auto info, int) {
+    if constexpr (decltype(info)::is_func_v) {
+      if (info.name == name) {
+        r = Invoker{Type<T>{}, info.value};
+        return false;
+      }
+    }
+    return true;
+  });
+  return r;
+}
+
+}  // namespace imp
+
+using imp::ArgPack;
+using imp::find_invoker;
+using imp::Invoker;
+
+}  // namespace tref
+#endif
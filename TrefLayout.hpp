@@ -0,0 +1,233 @@
+// Tref: memory layout & padding analysis of reflected classes.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_LAYOUT_H
+#define TREF_LAYOUT_H
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// The sizes & alignments of the fields are known at compile time, but not
+// their offsets, so the padding budget and the suggested order are
+// constexpr, while the per field report reads the offsets at runtime.
+// Members not reflected(and the vptr) are counted as padding.
+
+// Field meta: the field is accessed frequently, it should not straddle two
+// cache lines.
+struct MetaHot {};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// compile time
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct FieldShape {
+  string_view name;
+  size_t      size;
+  size_t      align;
+  bool        hot;
+  uint64_t    owner;  // type_id_v of the class declaring the field.
+};
+
+template <typename T, size_t... Is>
+constexpr auto make_field_shapes(index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  return array<FieldShape, sizeof...(Is)>{FieldShape{
+      get<Is>(fields).name,
+      sizeof(typename tuple_element_t<Is, decltype(fields)>::member_t),
+      alignof(typename tuple_element_t<Is, decltype(fields)>::member_t),
+      is_base_of_v<MetaHot, decltype(get<Is>(fields).meta)>,
+      type_id_v<typename tuple_element_t<Is, decltype(fields)>::
+                    enclosing_class_t>}...};
+}
+
+// Shapes of the data fields, base class fields first.
+template <typename T>
+constexpr auto field_shapes() {
+  constexpr auto n = tuple_size_v<decltype(data_fields<T>())>;
+  return make_field_shapes<T>(make_index_sequence<n>{});
+}
+
+template <typename T>
+constexpr size_t fields_size_v = [] {
+  size_t n = 0;
+  for (auto& f : field_shapes<T>())
+    n += f.size;
+  return n;
+}();
+
+// Bytes of T not occupied by the reflected fields, e.g.
+//   static_assert(max_padding_v<Entity> <= 8);
+template <typename T>
+constexpr size_t max_padding_v = sizeof(T) - fields_size_v<T>;
+
+// Suggested field order: by alignment then size descending, which gives the
+// least padding. Fields of base classes can only be moved inside the base,
+// so the fields of each class are sorted separately, base classes first.
+template <typename T>
+constexpr auto suggested_order() {
+  auto r = field_shapes<T>();
+  for (size_t i = 1; i < r.size(); i++) {
+    for (size_t j = i; j > 0; j--) {
+      auto& a = r[j - 1];
+      auto& b = r[j];
+      if (a.owner != b.owner || a.align > b.align ||
+          (a.align == b.align && a.size >= b.size))
+        break;
+      auto t = a;
+      a = b;
+      b = t;
+    }
+  }
+  return r;
+}
+
+// Size of T with the fields in the suggested order, the base class taking
+// its own optimal size.
+template <typename T>
+constexpr size_t optimal_size_v = [] {
+  size_t off = 0;
+  if constexpr (has_base_class_v<T>)
+    off = optimal_size_v<ZTrefBaseOf(T)>;
+  for (auto& f : suggested_order<T>()) {
+    if (f.owner == type_id_v<T>)
+      off = (off + f.align - 1) / f.align * f.align + f.size;
+  }
+  return (off + alignof(T) - 1) / alignof(T) * alignof(T);
+}();
+
+//////////////////////////////////////////////////////////////////////////
+//
+// report
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct FieldLayout {
+  string_view name;
+  size_t      offset;
+  size_t      size;
+  size_t      align;
+  size_t      hole;        // padding bytes before the field.
+  size_t      first_line;  // index of the cache lines touched.
+  size_t      last_line;
+  bool        hot;
+
+  // Assuming the object is aligned to the cache line.
+  bool straddles() const { return first_line != last_line; }
+};
+
+struct LayoutReport {
+  string_view         name;
+  size_t              size;
+  size_t              align;
+  size_t              padding;  // holes & the tail padding.
+  size_t              tail;
+  size_t              optimal_size;
+  vector<FieldLayout> fields;  // in the order of offsets.
+  vector<string_view> suggested_order;
+
+  size_t hot_straddles() const {
+    size_t n = 0;
+    for (auto& f : fields)
+      n += f.hot && f.straddles();
+    return n;
+  }
+};
+
+template <typename T>
+LayoutReport layout_report() {
+  LayoutReport r{class_info<T>().name, sizeof(T), alignof(T), 0, 0,
+                 optimal_size_v<T>,    {},        {}};
+  auto   shapes = field_shapes<T>();
+  size_t i = 0;
+  apply(
+      [&](auto... fs) {
+        ((r.fields.push_back({fs.name, offset_of<T>(fs.value), shapes[i].size,
+                              shapes[i].align, 0, 0, 0, shapes[i].hot}),
+          i++),
+         ...);
+      },
+      data_fields<T>());
+  sort(r.fields.begin(), r.fields.end(),
+       [](auto& a, auto& b) { return a.offset < b.offset; });
+
+  size_t end = 0;
+  for (auto& f : r.fields) {
+    f.hole = f.offset > end ? f.offset - end : 0;
+    f.first_line = f.offset / cache_line_size;
+    f.last_line = (f.offset + max<size_t>(f.size, 1) - 1) / cache_line_size;
+    end = max(end, f.offset + f.size);
+  }
+  r.tail = r.size > end ? r.size - end : 0;
+  r.padding = max_padding_v<T>;
+  for (auto& f : suggested_order<T>())
+    r.suggested_order.push_back(f.name);
+  return r;
+}
+
+// Print the report like pahole.
+inline ostream& operator<<(ostream& out, const LayoutReport& r) {
+  out << r.name << ": size " << r.size << ", align " << r.align
+      << ", padding " << r.padding << "\n";
+  for (auto& f : r.fields) {
+    if (f.hole)
+      out << "    /* hole " << f.hole << " */\n";
+    out << "  " << f.name << ": offset " << f.offset << ", size " << f.size
+        << ", lines " << f.first_line;
+    if (f.straddles())
+      out << "-" << f.last_line;
+    if (f.hot)
+      out << (f.straddles() ? ", hot, STRADDLES" : ", hot");
+    out << "\n";
+  }
+  if (r.tail)
+    out << "    /* tail padding " << r.tail << " */\n";
+  if (r.optimal_size < r.size) {
+    out << "  suggested order(size " << r.optimal_size << "):";
+    for (auto n : r.suggested_order)
+      out << " " << n;
+    out << "\n";
+  }
+  return out;
+}
+
+}  // namespace imp
+
+using imp::layout_report;
+using imp::LayoutReport;
+using imp::max_padding_v;
+using imp::MetaHot;
+using imp::optimal_size_v;
+using imp::suggested_order;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,237 @@
+// Tref: parallel loader of asset files into reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_LOADER_H
+#define TREF_LOADER_H
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefFactory.hpp"
+#include "TrefFile.hpp"
+
+namespace tref {
+namespace imp {
+
+struct AssetTypeStats {
+  string_view name;
+  size_t      count = 0;    // of the objects loaded.
+  size_t      bytes = 0;    // of the files.
+  double      seconds = 0;  // spent in parsing, summed over the threads.
+};
+
+// Load asset files into the objects of Base or its reflected subclasses.
+// Each thread creates the objects by its own Factory, i.e. arena, and works
+// through its own queue of files, stealing from the others when it is empty.
+// The next file of the queue is mapped & prefetched while parsing the
+// current one, so that the reading overlaps the parsing.
+// Objects are kept until reset() or the destruction of the loader.
+template <typename Base>
+class AssetLoader {
+ public:
+  // @param data: the whole file, unmapped after parsing.
+  // @param factory: of the calling thread, create the root object by the type
+  //   name stored in the data then load its fields.
+  // @return the root object, nullptr on error.
+  using Parse = function<Base*(string_view data, Factory<Base>& factory)>;
+
+  // @param threads: 0 for the count of hardware threads.
+  explicit AssetLoader(Parse parse, unsigned threads = 0)
+      : parse_{move(parse)} {
+    add_type(class_info<Base>());
+    class_info<Base>().each_subclass([&](auto info, int) {
+      add_type(info);
+      return true;
+    });
+    if (!threads)
+      threads = max(thread::hardware_concurrency(), 1u);
+    for (unsigned i = 0; i < threads; i++)
+      workers_.push_back(make_unique<Worker>(types_));
+  }
+
+  AssetLoader(const AssetLoader&) = delete;
+  AssetLoader& operator=(const AssetLoader&) = delete;
+
+  // Load the files, blocking until all done.
+  // @param progress: [](size_t done, size_t total), called by the loading
+  //   threads after each file.
+  // @return count of the files failed to load.
+  size_t load(const vector<string>&          paths,
+              function<void(size_t, size_t)> progress = {}) {
+    objects_.assign(paths.size(), nullptr);
+    auto n = workers_.size();
+    for (size_t i = 0; i < n; i++) {
+      auto& q = workers_[i]->tasks;
+      for (auto t = paths.size() * i / n; t < paths.size() * (i + 1) / n; t++)
+        q.push_back(static_cast<uint32_t>(t));
+    }
+
+    atomic<size_t> done{0}, failed{0};
+    auto           work = [&](size_t self) {
+      auto& w = *workers_[self];
+      MappedFile files[2];
+      bool       opened[2] = {};
+      auto       prefetched = invalid_task;
+      for (uint32_t t, cur = 0; take(self, t);) {
+        if (t == prefetched)
+          cur ^= 1;
+        else
+          opened[cur] = files[cur].open(paths[t]);
+        prefetched = invalid_task;
+        {
+          lock_guard<mutex> lock{w.m};
+          if (!w.tasks.empty())
+            prefetched = w.tasks.front();
+        }
+        if (prefetched != invalid_task) {
+          opened[cur ^ 1] = files[cur ^ 1].open(paths[prefetched]);
+          files[cur ^ 1].prefetch();
+        }
+
+        auto& file = files[cur];
+        auto  bytes = file.size();
+        Base* obj = nullptr;
+        auto  start = chrono::steady_clock::now();
+        if (opened[cur])
+          obj = parse_(file.view(), w.factory);
+        chrono::duration<double> dt = chrono::steady_clock::now() - start;
+        file.close();
+
+        objects_[t] = obj;
+        if (!obj) {
+          failed++;
+        } else if (auto it = slots_.find(type_of(obj)); it != slots_.end()) {
+          auto& s = w.stats[it->second];
+          s.count++;
+          s.bytes += bytes;
+          s.seconds += dt.count();
+        }
+        auto d = ++done;
+        if (progress)
+          progress(d, paths.size());
+      }
+    };
+
+    vector<thread> pool;
+    for (size_t i = 1; i < n; i++)
+      pool.emplace_back(work, i);
+    work(0);
+    for (auto& t : pool)
+      t.join();
+    return failed.load();
+  }
+
+  // Objects of the last load in the order of the paths, nullptr if failed.
+  const vector<Base*>& objects() const { return objects_; }
+
+  // Statistics of each type since the last reset.
+  vector<AssetTypeStats> stats() const {
+    auto r = types_;
+    for (auto& w : workers_) {
+      for (size_t i = 0; i < r.size(); i++) {
+        r[i].count += w->stats[i].count;
+        r[i].bytes += w->stats[i].bytes;
+        r[i].seconds += w->stats[i].seconds;
+      }
+    }
+    return r;
+  }
+
+  // Destroy all the loaded objects.
+  void reset() {
+    for (auto& w : workers_) {
+      w->factory.reset();
+      w->stats = types_;
+    }
+    objects_.clear();
+  }
+
+ private:
+  static constexpr auto invalid_task = ~uint32_t{0};
+
+  struct Worker {
+    explicit Worker(const vector<AssetTypeStats>& types) : stats{types} {}
+
+    Factory<Base>          factory;
+    mutex                  m;
+    deque<uint32_t>        tasks;
+    vector<AssetTypeStats> stats;
+  };
+
+  template <typename Info>
+  void add_type(Info info) {
+    using S = typename Info::class_t;
+    slots_.emplace(type_index{typeid(S)}, types_.size());
+    types_.push_back({info.name});
+  }
+
+  static type_index type_of(Base* obj) {
+    if constexpr (is_polymorphic_v<Base>)
+      return typeid(*obj);
+    else
+      return typeid(Base);
+  }
+
+  // Pop from the front of its own queue, or steal from the back of others.
+  bool take(size_t self, uint32_t& task) {
+    for (size_t i = 0; i < workers_.size(); i++) {
+      auto&             w = *workers_[(self + i) % workers_.size()];
+      lock_guard<mutex> lock{w.m};
+      if (!w.tasks.empty()) {
+        if (i == 0) {
+          task = w.tasks.front();
+          w.tasks.pop_front();
+        } else {
+          task = w.tasks.back();
+          w.tasks.pop_back();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Parse                             parse_;
+  vector<unique_ptr<Worker>>        workers_;
+  vector<AssetTypeStats>            types_;
+  unordered_map<type_index, size_t> slots_;
+  vector<Base*>                     objects_;
+};
+
+}  // namespace imp
+
+using imp::AssetLoader;
+using imp::AssetTypeStats;
+
+}  // namespace tref
+#endif
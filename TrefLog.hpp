@@ -0,0 +1,558 @@
+// Tref: compressed columnar append-only log of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_LOG_H
+#define TREF_LOG_H
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefFile.hpp"
+
+namespace tref {
+namespace imp {
+
+// Layout of a log file(little endian):
+//   header: "TREFLOG1", u32 column count,
+//           per column: u8 codec, u8 byte size, u16 name size, name.
+//   blocks: u32 magic, u32 rows, per column: u32 byte size, then the columns.
+// Each block restarts the delta & xor chains, so it is a keyframe to seek to.
+// A block truncated by a crash is dropped on reopening the log.
+
+//////////////////////////////////////////////////////////////////////////
+//
+// codecs
+//
+//////////////////////////////////////////////////////////////////////////
+
+enum class LogCodec : uint8_t {
+  Delta = 1,     // integers: zigzag varint of the difference to the last.
+  Rle = 2,       // bools & enums: runs of zigzag varint values.
+  XorFloat = 3,  // floats: xor with the last, only the non-zero bytes.
+  String = 4,    // runs of sized strings.
+};
+
+template <typename M>
+constexpr auto is_log_leaf_v =
+    (is_arithmetic_v<M> && !is_same_v<M, long double>) || is_enum_v<M> ||
+    is_same_v<M, string>;
+
+template <typename M>
+constexpr auto log_codec_v =
+    is_same_v<M, bool> || is_enum_v<M>
+        ? LogCodec::Rle
+        : is_floating_point_v<M>
+              ? LogCodec::XorFloat
+              : is_integral_v<M> ? LogCodec::Delta : LogCodec::String;
+
+inline void log_put_varint(string& out, uint64_t v) {
+  for (; v >= 0x80; v >>= 7)
+    out.push_back(static_cast<char>(v | 0x80));
+  out.push_back(static_cast<char>(v));
+}
+
+inline bool log_get_varint(const char*& p, const char* end, uint64_t& v) {
+  v = 0;
+  for (int s = 0; s < 64 && p < end; s += 7) {
+    auto b = static_cast<uint8_t>(*p++);
+    v |= uint64_t{b & 0x7fu} << s;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+constexpr uint64_t log_zigzag(uint64_t v) {
+  return (v << 1) ^ (0 - (v >> 63));
+}
+
+constexpr uint64_t log_unzigzag(uint64_t v) {
+  return (v >> 1) ^ (0 - (v & 1));
+}
+
+// Integer, bool or enum to 64 bits, sign extended.
+template <typename M>
+uint64_t log_to_bits(M v) {
+  if constexpr (is_enum_v<M>)
+    return log_to_bits(static_cast<underlying_type_t<M>>(v));
+  else if constexpr (is_signed_v<M>)
+    return static_cast<uint64_t>(static_cast<int64_t>(v));
+  else
+    return static_cast<uint64_t>(v);
+}
+
+template <typename M>
+M log_from_bits(uint64_t v) {
+  if constexpr (is_enum_v<M>)
+    return static_cast<M>(log_from_bits<underlying_type_t<M>>(v));
+  else if constexpr (is_same_v<M, bool>)
+    return v != 0;
+  else
+    return static_cast<M>(v);
+}
+
+// Encode n values of a column.
+// @param base: address of the first value.
+// @param stride: byte distance between the values.
+template <typename M>
+void log_encode(const char* base, size_t stride, size_t n, string& out) {
+  auto at = [&](size_t i) -> const M& {
+    return *reinterpret_cast<const M*>(base + i * stride);
+  };
+  constexpr auto codec = log_codec_v<M>;
+
+  if constexpr (codec == LogCodec::Delta) {
+    uint64_t last = 0;
+    for (size_t i = 0; i < n; i++) {
+      auto v = log_to_bits(at(i));
+      log_put_varint(out, log_zigzag(v - last));
+      last = v;
+    }
+  } else if constexpr (codec == LogCodec::XorFloat) {
+    using U = conditional_t<sizeof(M) == 4, uint32_t, uint64_t>;
+    U last = 0;
+    for (size_t i = 0; i < n; i++) {
+      U v;
+      memcpy(&v, &at(i), sizeof(U));
+      U x = v ^ last;
+      last = v;
+      // ctrl byte: count of the zero high bytes | the zero low bytes << 4.
+      unsigned lead = 0, trail = 0;
+      while (lead < sizeof(U) && !(x >> (8 * (sizeof(U) - 1 - lead)) & 0xff))
+        lead++;
+      while (lead + trail < sizeof(U) && !(x >> (8 * trail) & 0xff))
+        trail++;
+      out.push_back(static_cast<char>(lead | trail << 4));
+      for (auto b = trail; b < sizeof(U) - lead; b++)
+        out.push_back(static_cast<char>(x >> (8 * b)));
+    }
+  } else {
+    for (size_t i = 0, j; i < n; i = j) {
+      for (j = i + 1; j < n && at(j) == at(i);)
+        j++;
+      log_put_varint(out, j - i);
+      if constexpr (codec == LogCodec::String) {
+        log_put_varint(out, at(i).size());
+        out += at(i);
+      } else {
+        log_put_varint(out, log_zigzag(log_to_bits(at(i))));
+      }
+    }
+  }
+}
+
+// Decode a column of n values, only the values [from, from + count) are
+// stored.
+// @param base: address to store the value of row `from`.
+// @param stride: byte distance between the stored values.
+template <typename M>
+bool log_decode(const char* p,
+                const char* end,
+                size_t      n,
+                size_t      from,
+                size_t      count,
+                char*       base,
+                size_t      stride) {
+  auto to = min(n, from + count);
+  auto at = [&](size_t i) -> M& {
+    return *reinterpret_cast<M*>(base + (i - from) * stride);
+  };
+  constexpr auto codec = log_codec_v<M>;
+  uint64_t       v;
+
+  if constexpr (codec == LogCodec::Delta) {
+    uint64_t last = 0;
+    for (size_t i = 0; i < to; i++) {
+      if (!log_get_varint(p, end, v))
+        return false;
+      last += log_unzigzag(v);
+      if (i >= from)
+        at(i) = log_from_bits<M>(last);
+    }
+  } else if constexpr (codec == LogCodec::XorFloat) {
+    using U = conditional_t<sizeof(M) == 4, uint32_t, uint64_t>;
+    U last = 0;
+    for (size_t i = 0; i < to; i++) {
+      if (p == end)
+        return false;
+      auto     ctrl = static_cast<uint8_t>(*p++);
+      unsigned lead = ctrl & 15, trail = ctrl >> 4;
+      if (lead + trail > sizeof(U) ||
+          end - p < static_cast<ptrdiff_t>(sizeof(U) - lead - trail))
+        return false;
+      U x = 0;
+      for (auto b = trail; b < sizeof(U) - lead; b++)
+        x |= static_cast<U>(static_cast<uint8_t>(*p++)) << (8 * b);
+      last ^= x;
+      if (i >= from)
+        memcpy(&at(i), &last, sizeof(U));
+    }
+  } else {
+    for (size_t i = 0; i < to;) {
+      uint64_t run;
+      if (!log_get_varint(p, end, run) || run == 0 || run > n - i)
+        return false;
+      if (!log_get_varint(p, end, v))
+        return false;
+      auto b = max(i, from), e = min<size_t>(i + run, to);
+      if constexpr (codec == LogCodec::String) {
+        if (v > static_cast<uint64_t>(end - p))
+          return false;
+        for (; b < e; b++)
+          at(b).assign(p, v);
+        p += v;
+      } else {
+        for (auto x = log_from_bits<M>(log_unzigzag(v)); b < e; b++)
+          at(b) = x;
+      }
+      i += run;
+    }
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// columns
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct LogColumn {
+  string   name;  // path of the leaf field, e.g. "pos.x".
+  LogCodec codec;
+  uint8_t  size;    // byte size of the value, 0 for strings.
+  size_t   offset;  // in the logged object.
+  void (*encode)(const char* base, size_t stride, size_t n, string& out);
+  bool (*decode)(const char* p,
+                 const char* end,
+                 size_t      n,
+                 size_t      from,
+                 size_t      count,
+                 char*       base,
+                 size_t      stride);
+};
+
+// One column per arithmetic, enum or string field, nested reflected classes
+// are flattened, other fields are not logged.
+template <typename C>
+void log_columns(vector<LogColumn>& cols,
+                 const string&      prefix = {},
+                 size_t             offset = 0) {
+  apply(
+      [&](auto... fs) {
+        (
+            [&](auto info) {
+              using M = typename decltype(info)::member_t;
+              auto name = prefix + string{info.name};
+              auto off = offset + offset_of<C>(info.value);
+              if constexpr (is_log_leaf_v<M>) {
+                uint8_t size = is_same_v<M, string> ? 0 : sizeof(M);
+                cols.push_back({name, log_codec_v<M>, size, off,
+                                &log_encode<M>, &log_decode<M>});
+              } else if constexpr (is_class_v<M> && is_reflected_v<M>) {
+                log_columns<M>(cols, name + ".", off);
+              }
+            }(fs),
+            ...);
+      },
+      data_fields<C>());
+}
+
+constexpr char     log_magic[] = "TREFLOG1";
+constexpr uint32_t log_block_magic = 0x4b4c4254;  // "TBLK"
+
+struct LogStoredColumn {
+  string_view name;
+  LogCodec    codec;
+  uint8_t     size;
+};
+
+struct LogBlock {
+  size_t   first;  // index of the first row.
+  uint32_t rows;
+  size_t   pos;  // of the column sizes.
+};
+
+template <typename S>
+S log_read(const char* p) {
+  S v;
+  memcpy(&v, p, sizeof(S));
+  return v;
+}
+
+template <typename S>
+void log_write(string& out, S v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(S));
+}
+
+inline string log_header(const vector<LogColumn>& cols) {
+  string h{log_magic, 8};
+  log_write(h, static_cast<uint32_t>(cols.size()));
+  for (auto& c : cols) {
+    log_write(h, static_cast<uint8_t>(c.codec));
+    log_write(h, c.size);
+    log_write(h, static_cast<uint16_t>(c.name.size()));
+    h += c.name;
+  }
+  return h;
+}
+
+// Parse the header and the complete blocks.
+// @return size of the valid prefix of the data, 0 if the header is invalid.
+inline size_t log_scan(string_view              data,
+                       vector<LogStoredColumn>& cols,
+                       vector<LogBlock>&        blocks) {
+  auto p = data.data();
+  auto end = p + data.size();
+  if (data.size() < 12 || data.substr(0, 8) != string_view{log_magic, 8})
+    return 0;
+  auto n = log_read<uint32_t>(p + 8);
+  p += 12;
+  for (uint32_t i = 0; i < n; i++) {
+    if (end - p < 4)
+      return 0;
+    LogStoredColumn c;
+    c.codec = static_cast<LogCodec>(log_read<uint8_t>(p));
+    c.size = log_read<uint8_t>(p + 1);
+    auto len = log_read<uint16_t>(p + 2);
+    if (end - p - 4 < len)
+      return 0;
+    c.name = {p + 4, len};
+    p += 4 + len;
+    cols.push_back(c);
+  }
+
+  size_t rows = 0;
+  for (;;) {
+    auto pos = static_cast<size_t>(p - data.data());
+    auto head = 8 + 4 * size_t{n};
+    if (static_cast<size_t>(end - p) < head ||
+        log_read<uint32_t>(p) != log_block_magic)
+      return pos;
+    LogBlock b{rows, log_read<uint32_t>(p + 4), pos + 8};
+    size_t   body = 0;
+    for (uint32_t i = 0; i < n; i++)
+      body += log_read<uint32_t>(p + 8 + 4 * i);
+    if (static_cast<size_t>(end - p) - head < body)
+      return pos;
+    p += head + body;
+    rows += b.rows;
+    blocks.push_back(b);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// writer & reader
+//
+//////////////////////////////////////////////////////////////////////////
+
+// rows per block by default, i.e. the keyframe interval.
+constexpr size_t log_keyframe_rows = 4096;
+
+// Append objects to a log file, rows are buffered and encoded column by
+// column into a block on every keyframe_rows rows.
+template <typename T>
+class LogWriter {
+ public:
+  // Open the log for appending, a new file is created if not exists.
+  // The columns of an existing log must be the same as T.
+  explicit LogWriter(const string& path,
+                     size_t        keyframe_rows = log_keyframe_rows)
+      : keyframe_rows_{max<size_t>(keyframe_rows, 1)} {
+    log_columns<T>(cols_);
+    auto   header = log_header(cols_);
+    size_t valid = 0;
+    {
+      MappedFile f{path};
+      if (f.size()) {
+        vector<LogStoredColumn> cols;
+        vector<LogBlock>        blocks;
+        valid = log_scan(f.view(), cols, blocks);
+        if (f.view().substr(0, header.size()) != header) {
+          error_ = "columns mismatch: " + path;
+          return;
+        }
+      }
+    }
+    error_code ec;
+    if (valid)
+      filesystem::resize_file(path, valid, ec);
+    out_.open(path, ios::binary | ios::app);
+    if (!out_ || ec) {
+      error_ = "can not open: " + path;
+      return;
+    }
+    if (!valid)
+      out_.write(header.data(), static_cast<streamsize>(header.size()));
+  }
+
+  LogWriter(const LogWriter&) = delete;
+  LogWriter& operator=(const LogWriter&) = delete;
+  ~LogWriter() { flush(); }
+
+  explicit operator bool() const { return error_.empty(); }
+  const string& error() const { return error_; }
+
+  void append(const T& row) {
+    if (!error_.empty())
+      return;
+    rows_.push_back(row);
+    if (rows_.size() >= keyframe_rows_)
+      flush();
+  }
+
+  void append(Span<const T> rows) {
+    for (auto& r : rows)
+      append(r);
+  }
+
+  // Write the buffered rows as a block.
+  void flush() {
+    if (rows_.empty() || !error_.empty())
+      return;
+    auto base = reinterpret_cast<const char*>(rows_.data());
+    body_.clear();
+    sizes_.clear();
+    log_write(sizes_, log_block_magic);
+    log_write(sizes_, static_cast<uint32_t>(rows_.size()));
+    for (auto& c : cols_) {
+      auto n = body_.size();
+      c.encode(base + c.offset, sizeof(T), rows_.size(), body_);
+      log_write(sizes_, static_cast<uint32_t>(body_.size() - n));
+    }
+    out_.write(sizes_.data(), static_cast<streamsize>(sizes_.size()));
+    out_.write(body_.data(), static_cast<streamsize>(body_.size()));
+    out_.flush();
+    rows_.clear();
+  }
+
+ private:
+  vector<LogColumn> cols_;
+  vector<T>         rows_;
+  size_t            keyframe_rows_;
+  string            body_, sizes_;
+  ofstream          out_;
+  string            error_;
+};
+
+// Read a log file by memory mapping it, only the requested columns of the
+// blocks containing the requested rows are decoded.
+// Columns are matched by names, missing ones are left untouched.
+template <typename T>
+class LogReader {
+ public:
+  explicit LogReader(const string& path) {
+    if (!file_.open(path)) {
+      error_ = "can not open: " + path;
+      return;
+    }
+    vector<LogStoredColumn> stored;
+    if (!log_scan(file_.view(), stored, blocks_)) {
+      error_ = "invalid log: " + path;
+      return;
+    }
+    ncols_ = stored.size();
+    rows_ = blocks_.empty() ? 0 : blocks_.back().first + blocks_.back().rows;
+    log_columns<T>(cols_);
+    for (auto& c : cols_) {
+      auto it = find_if(stored.begin(), stored.end(), [&](auto& s) {
+        return s.name == c.name && s.codec == c.codec &&
+               (s.size == c.size || c.codec != LogCodec::XorFloat);
+      });
+      index_.push_back(it == stored.end() ? -1 : int(it - stored.begin()));
+    }
+  }
+
+  explicit operator bool() const { return error_.empty(); }
+  const string& error() const { return error_; }
+
+  size_t size() const { return rows_; }
+  size_t keyframes() const { return blocks_.size(); }
+
+  // Decode the rows [first, first + n) into out.
+  // @param columns: paths of the fields to decode, e.g. "hp" or "pos.x",
+  //   a class field selects all of its fields, empty for all the columns.
+  // @return count of rows decoded, less than n if out of range or corrupted.
+  size_t read(size_t                         first,
+              size_t                         n,
+              T*                             out,
+              initializer_list<string_view> columns = {}) const {
+    vector<char> selected(cols_.size(), columns.size() == 0);
+    for (size_t i = 0; i < cols_.size(); i++) {
+      string_view name = cols_[i].name;
+      for (auto c : columns) {
+        selected[i] |= name == c || (name.size() > c.size() &&
+                                     name.substr(0, c.size()) == c &&
+                                     name[c.size()] == '.');
+      }
+    }
+
+    n = min(n, rows_ - min(first, rows_));
+    auto it = upper_bound(blocks_.begin(), blocks_.end(), first,
+                          [](size_t r, auto& b) { return r < b.first; });
+    size_t done = 0;
+    for (auto b = it - (it != blocks_.begin()); done < n; ++b) {
+      auto from = first + done - b->first;
+      auto count = min<size_t>(b->rows - from, n - done);
+      auto sizes = file_.data() + b->pos;
+      auto body = sizes + 4 * ncols_;
+      for (size_t i = 0; i < cols_.size(); i++) {
+        if (!selected[i] || index_[i] < 0)
+          continue;
+        auto p = body;
+        for (int k = 0; k < index_[i]; k++)
+          p += log_read<uint32_t>(sizes + 4 * k);
+        auto end = p + log_read<uint32_t>(sizes + 4 * index_[i]);
+        auto dst = reinterpret_cast<char*>(out + done) + cols_[i].offset;
+        if (!cols_[i].decode(p, end, b->rows, from, count, dst, sizeof(T)))
+          return done;
+      }
+      done += count;
+    }
+    return done;
+  }
+
+ private:
+  MappedFile        file_;
+  vector<LogColumn> cols_;
+  vector<int>       index_;  // of the stored column, -1 if missing.
+  vector<LogBlock>  blocks_;
+  size_t            ncols_ = 0;
+  size_t            rows_ = 0;
+  string            error_;
+};
+
+}  // namespace imp
+
+using imp::LogCodec;
+using imp::LogReader;
+using imp::LogWriter;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,288 @@
+// Tref: deep memory accounting of reflected objects.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_MEMORY_H
+#define TREF_MEMORY_H
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+// Heap bytes are estimated from the capacities, allocator overheads are not
+// counted:
+// - string: the capacity if not in the small string buffer.
+// - contiguous containers: the capacity, plus the heap of the elements.
+// - other containers: a node per element of the value & 2 pointers, plus the
+//   buckets of the hash containers.
+// - unique_ptr: the pointee, shared_ptr: the pointee divided by use_count.
+// - pairs & tuples, e.g. elements of maps: the heap of their elements.
+// - raw pointers & views are not owned, so not counted.
+
+//////////////////////////////////////////////////////////////////////////
+//
+// traits
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename = void>
+struct is_memory_range : false_type {};
+
+template <typename T>
+struct is_memory_range<T,
+                       void_t<decltype(std::begin(declval<const T&>())),
+                              decltype(declval<const T&>().size())>>
+    : true_type {};
+
+template <typename T, typename = void>
+struct has_memory_capacity : false_type {};
+
+template <typename T>
+struct has_memory_capacity<T,
+                           void_t<decltype(declval<const T&>().capacity()),
+                                  decltype(declval<const T&>().data())>>
+    : true_type {};
+
+// Contiguous range without capacity: inline(array) or not owned(span).
+template <typename T, typename = void>
+struct is_data_range : false_type {};
+
+template <typename T>
+struct is_data_range<T, void_t<decltype(declval<const T&>().data())>>
+    : bool_constant<!has_memory_capacity<T>::value &&
+                    is_memory_range<T>::value> {};
+
+template <typename T, typename = void>
+struct has_bucket_count : false_type {};
+
+template <typename T>
+struct has_bucket_count<T,
+                        void_t<decltype(declval<const T&>().bucket_count())>>
+    : true_type {};
+
+template <typename T>
+struct is_unique_ptr : false_type {};
+
+template <typename T, typename D>
+struct is_unique_ptr<unique_ptr<T, D>> : true_type {};
+
+template <typename T>
+struct is_shared_ptr : false_type {};
+
+template <typename T>
+struct is_shared_ptr<shared_ptr<T>> : true_type {};
+
+template <typename T>
+struct is_memory_optional : false_type {};
+
+template <typename T, typename = void>
+struct is_memory_tuple : false_type {};
+
+template <typename T>
+struct is_memory_tuple<T, void_t<decltype(tuple_size<T>::value)>>
+    : true_type {};
+
+template <typename T>
+struct is_memory_optional<optional<T>> : true_type {};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// heap bytes
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename M>
+size_t heap_bytes(const M& v);
+
+template <typename M>
+constexpr bool may_own_heap_v =
+    !is_arithmetic_v<M> && !is_enum_v<M> && !is_pointer_v<M> &&
+    !is_member_pointer_v<M>;
+
+template <typename C>
+size_t range_heap_bytes(const C& c) {
+  using E = remove_cv_t<remove_reference_t<decltype(*std::begin(c))>>;
+  size_t n = 0;
+  if constexpr (may_own_heap_v<E>) {
+    for (auto& e : c)
+      n += heap_bytes(e);
+  }
+  return n;
+}
+
+template <typename T, size_t... Is>
+size_t class_heap_bytes(const T& v, index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  return (heap_bytes(v.*(get<Is>(fields).value)) + ... + 0);
+}
+
+// Heap bytes owned by the value, recursively.
+template <typename M>
+size_t heap_bytes(const M& v) {
+  if constexpr (!may_own_heap_v<M>) {
+    return 0;
+  } else if constexpr (is_same_v<M, string>) {
+    static const auto sso = string{}.capacity();
+    return v.capacity() > sso ? v.capacity() + 1 : 0;
+  } else if constexpr (is_same_v<M, vector<bool>>) {
+    return v.capacity() / 8;
+  } else if constexpr (is_unique_ptr<M>::value) {
+    return v ? sizeof(*v) + heap_bytes(*v) : 0;
+  } else if constexpr (is_shared_ptr<M>::value) {
+    return v ? (sizeof(*v) + heap_bytes(*v)) / v.use_count() : 0;
+  } else if constexpr (is_memory_optional<M>::value) {
+    return v ? heap_bytes(*v) : 0;
+  } else if constexpr (is_reflected_v<M>) {
+    constexpr auto n = tuple_size_v<decltype(data_fields<M>())>;
+    return class_heap_bytes(v, make_index_sequence<n>{});
+  } else if constexpr (is_array_v<M> || is_data_range<M>::value) {
+    return range_heap_bytes(v);
+  } else if constexpr (is_memory_range<M>::value) {
+    using V = typename M::value_type;
+    if constexpr (has_memory_capacity<M>::value) {
+      return v.capacity() * sizeof(V) + range_heap_bytes(v);
+    } else {
+      size_t n = v.size() * (sizeof(V) + 2 * sizeof(void*));
+      if constexpr (has_bucket_count<M>::value)
+        n += v.bucket_count() * sizeof(void*);
+      return n + range_heap_bytes(v);
+    }
+  } else if constexpr (is_memory_tuple<M>::value) {
+    return apply([](auto&... e) { return (heap_bytes(e) + ... + size_t{0}); },
+                 v);
+  } else {
+    return 0;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// usage
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct FieldMemory {
+  string_view name;
+  size_t      size;  // inline in the object.
+  size_t      heap;
+};
+
+struct MemoryUsage {
+  size_t              shallow = 0;  // sizeof the object.
+  size_t              heap = 0;
+  vector<FieldMemory> fields;  // base class fields first.
+
+  size_t total() const { return shallow + heap; }
+};
+
+// Inline & heap memory of the object, with the breakdown of the fields.
+template <typename T>
+MemoryUsage memory_usage(const T& obj) {
+  static_assert(is_reflected_v<T>);
+  MemoryUsage r;
+  r.shallow = sizeof(T);
+  apply(
+      [&](auto... fs) {
+        (r.fields.push_back(
+             {fs.name, sizeof(typename decltype(fs)::member_t),
+              heap_bytes(obj.*(fs.value))}),
+         ...);
+      },
+      data_fields<T>());
+  for (auto& f : r.fields)
+    r.heap += f.heap;
+  return r;
+}
+
+struct TypeMemory {
+  string_view name;
+  size_t      count = 0;
+  size_t      shallow = 0;
+  size_t      heap = 0;
+
+  size_t total() const { return shallow + heap; }
+};
+
+// Memory of the objects summed per type, the types are Base and its reflected
+// subclasses in the order of each_subclass.
+// Objects are measured by their dynamic type if Base is polymorphic.
+// @param objects: range of pointers to Base.
+template <typename Base, typename C>
+vector<TypeMemory> memory_by_type(const C& objects) {
+  using Measure = void (*)(const Base* obj, TypeMemory& m);
+  vector<TypeMemory>                r;
+  vector<Measure>                   measures;
+  unordered_map<type_index, size_t> slots;
+
+  auto add = [&](auto info) {
+    using S = typename decltype(info)::class_t;
+    slots.emplace(type_index{typeid(S)}, r.size());
+    r.push_back({info.name});
+    measures.push_back([](const Base* obj, TypeMemory& m) {
+      auto& s = static_cast<const S&>(*obj);
+      m.count++;
+      m.shallow += sizeof(S);
+      m.heap += heap_bytes(s);
+    });
+  };
+  add(class_info<Base>());
+  class_info<Base>().each_subclass([&](auto info, int) {
+    add(info);
+    return true;
+  });
+
+  for (const Base* obj : objects) {
+    if (!obj)
+      continue;
+    size_t slot = 0;
+    if constexpr (is_polymorphic_v<Base>) {
+      auto it = slots.find(typeid(*obj));
+      if (it == slots.end())
+        continue;
+      slot = it->second;
+    }
+    measures[slot](obj, r[slot]);
+  }
+  return r;
+}
+
+}  // namespace imp
+
+using imp::FieldMemory;
+using imp::heap_bytes;
+using imp::memory_by_type;
+using imp::memory_usage;
+using imp::MemoryUsage;
+using imp::TypeMemory;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,399 @@
+// Tref: runtime type registry, e.g. for classes of dynamically loaded plugins.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_REGISTRY_H
+#define TREF_REGISTRY_H
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// runtime descriptors
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Strings are copied so the descriptors outlive the module registering them.
+struct RuntimeField {
+  int      index;
+  string   name;
+  size_t   offset;
+  size_t   size;
+  uint64_t type_id;
+};
+
+struct RuntimeClass {
+  string   name;
+  string   full_name;
+  uint64_t id;
+  uint64_t base_id;  // 0 for root class.
+  size_t   base_offset;
+  size_t   size;
+  size_t   align;
+
+  // data members of this level, base members are in the base class.
+  vector<RuntimeField> fields;
+
+  // placement construct & destroy, construct is nullptr if the class is not
+  // default constructible.
+  void* (*construct)(void* mem);
+  void (*destroy)(void* obj);
+
+  // the module registering the class, used by unregistering.
+  const void* module;
+};
+
+template <typename T>
+RuntimeClass make_runtime_class(const void* module = nullptr) {
+  constexpr auto info = class_info<T>();
+
+  RuntimeClass c{string{info.name},
+                 string{info.full_name},
+                 info.id,
+                 0,
+                 0,
+                 info.size,
+                 info.align,
+                 {},
+                 nullptr,
+                 [](void* p) { static_cast<T*>(p)->~T(); },
+                 module};
+
+  if constexpr (has_base_class_v<T>) {
+    using B = typename decltype(info)::base_t;
+    alignas(T) static char buf[sizeof(T)];
+    auto obj = reinterpret_cast<T*>(buf);
+    c.base_id = type_id_v<B>;
+    c.base_offset = static_cast<size_t>(
+        reinterpret_cast<char*>(static_cast<B*>(obj)) - buf);
+  }
+  if constexpr (is_default_constructible_v<T> && !is_abstract_v<T>) {
+    c.construct = [](void* p) -> void* { return new (p) T(); };
+  }
+
+  info.each_field([&](auto f, int level) {
+    using F = decltype(f);
+    if constexpr (F::is_data_member_v) {
+      if (level == 0) {
+        c.fields.push_back(RuntimeField{f.index, string{f.name},
+                                        offset_of(f.value),
+                                        sizeof(typename F::member_t),
+                                        type_id_v<typename F::member_t>});
+      }
+    }
+    return level == 0;
+  });
+  return c;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Registry
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Immutable view of the registered classes with an open addressing index.
+class RegistrySnapshot {
+ public:
+  explicit RegistrySnapshot(vector<shared_ptr<const RuntimeClass>> classes)
+      : classes_{move(classes)} {
+    size_t cap = 8;
+    while (cap < classes_.size() * 2)
+      cap *= 2;
+    slots_.assign(cap, 0);
+    for (uint32_t i = 0; i < classes_.size(); i++) {
+      auto s = classes_[i]->id & (cap - 1);
+      while (slots_[s])
+        s = (s + 1) & (cap - 1);
+      slots_[s] = i + 1;
+    }
+  }
+
+  const RuntimeClass* find(uint64_t id) const {
+    auto mask = slots_.size() - 1;
+    for (auto s = id & mask; slots_[s]; s = (s + 1) & mask) {
+      auto& c = classes_[slots_[s] - 1];
+      if (c->id == id)
+        return c.get();
+    }
+    return nullptr;
+  }
+
+  const vector<shared_ptr<const RuntimeClass>>& classes() const {
+    return classes_;
+  }
+
+  mutable atomic<int> readers{0};
+
+ private:
+  vector<shared_ptr<const RuntimeClass>> classes_;
+  vector<uint32_t>                       slots_;  // index + 1, 0 for empty.
+};
+
+// Runtime mirror of the ClassInfo, classes can be added & removed at any time
+// e.g. by plugins loaded with dlopen.
+//
+// Reading is lock-free: the registry is published as immutable snapshots, a
+// reader pins the current one by an atomic counter. Writers are serialized by
+// a mutex, the replaced snapshots are retired & freed by a later writer once
+// no reader pins them or is pinning any snapshot, so the descriptors are
+// always valid to readers.
+class Registry {
+ public:
+  // Pin the current snapshot, the returned descriptors are valid during the
+  // lifetime of the reader.
+  class Reader {
+   public:
+    explicit Reader(const Registry& r) {
+      // the snapshot loaded may be retired before pinning it, the writers
+      // don't free any snapshot while readers are entering.
+      r.entering_.fetch_add(1);
+      for (;;) {
+        s_ = r.current_.load();
+        s_->readers.fetch_add(1);
+        if (r.current_.load() == s_)
+          break;
+        s_->readers.fetch_sub(1);
+      }
+      r.entering_.fetch_sub(1);
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader() { s_->readers.fetch_sub(1); }
+
+    const RuntimeClass* find(uint64_t id) const { return s_->find(id); }
+
+    // @param name: fully qualified name of the class.
+    const RuntimeClass* find(string_view name) const {
+      return s_->find(fnv1a_64(name));
+    }
+
+    bool is_base_of(uint64_t base, uint64_t derived) const {
+      for (auto c = find(derived); c; c = find(c->base_id)) {
+        if (c->id == base)
+          return true;
+      }
+      return false;
+    }
+
+    // @param f: [](const RuntimeClass& c) -> bool, return false to stop the
+    // iterating.
+    template <typename F>
+    bool each_class(F&& f) const {
+      for (auto& c : s_->classes()) {
+        if (!f(*c))
+          return false;
+      }
+      return true;
+    }
+
+    // Iterate all the classes derived from base(directly or indirectly).
+    template <typename F>
+    bool each_subclass(uint64_t base, F&& f) const {
+      return each_class([&](const RuntimeClass& c) {
+        return c.id == base || !is_base_of(base, c.id) || f(c);
+      });
+    }
+
+    // Construct the object of class id into mem, which is at least of the
+    // size & alignment of the class.
+    // @return nullptr if the class is unknown, not derived from Base or not
+    // default constructible.
+    template <typename Base>
+    Base* construct_as(uint64_t id, void* mem) const {
+      auto c = find(id);
+      if (!c || !c->construct)
+        return nullptr;
+      auto p = static_cast<char*>(c->construct(mem));
+      for (; c && c->id != type_id_v<Base>; c = find(c->base_id))
+        p += c->base_offset;
+      if (!c) {
+        find(id)->destroy(mem);
+        return nullptr;
+      }
+      return reinterpret_cast<Base*>(p);
+    }
+
+   private:
+    const RegistrySnapshot* s_ = nullptr;
+  };
+
+  Registry() {
+    publish(make_unique<RegistrySnapshot>(
+        vector<shared_ptr<const RuntimeClass>>{}));
+  }
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  Reader read() const { return Reader{*this}; }
+
+  // Classes already registered(by id) are ignored.
+  // @return count of the added classes.
+  size_t add(vector<RuntimeClass> classes) {
+    lock_guard<mutex> lock{mutex_};
+    auto              cur = current_.load();
+    auto              all = cur->classes();
+    size_t            n = 0;
+    for (auto& c : classes) {
+      if (cur->find(c.id))
+        continue;
+      auto dup = false;
+      for (size_t i = cur->classes().size(); i < all.size(); i++)
+        dup = dup || all[i]->id == c.id;
+      if (!dup) {
+        all.push_back(make_shared<const RuntimeClass>(move(c)));
+        n++;
+      }
+    }
+    if (n)
+      publish(make_unique<RegistrySnapshot>(move(all)));
+    return n;
+  }
+
+  template <typename T>
+  size_t add(const void* module = nullptr) {
+    return add(vector<RuntimeClass>{make_runtime_class<T>(module)});
+  }
+
+  // Register the Base and all its reflected subclasses.
+  template <typename Base>
+  size_t add_hierarchy(const void* module = nullptr) {
+    vector<RuntimeClass> classes{make_runtime_class<Base>(module)};
+    class_info<Base>().each_subclass([&](auto info, int) {
+      classes.push_back(
+          make_runtime_class<typename decltype(info)::class_t>(module));
+      return true;
+    });
+    return add(move(classes));
+  }
+
+  // Unregister all the classes of the module and wait for the readers of all
+  // the retired snapshots having them to finish, after that it's safe to
+  // unload the module.
+  // NOTE: objects created by the module should be destroyed before unloading.
+  size_t remove_module(const void* module) {
+    lock_guard<mutex> lock{mutex_};
+    auto              cur = current_.load();
+    vector<shared_ptr<const RuntimeClass>> left;
+    for (auto& c : cur->classes()) {
+      if (c->module != module)
+        left.push_back(c);
+    }
+    auto n = cur->classes().size() - left.size();
+    if (n) {
+      publish(make_unique<RegistrySnapshot>(move(left)));
+      for (auto& s : snapshots_) {
+        if (s.get() == current_.load() || !has_module(*s, module))
+          continue;
+        while (s->readers.load() != 0)
+          this_thread::yield();
+      }
+      reclaim();
+    }
+    return n;
+  }
+
+  // Process wide registry, shared with plugins through the plugin entry.
+  static Registry& instance() {
+    static Registry r;
+    return r;
+  }
+
+ private:
+  void publish(unique_ptr<RegistrySnapshot> s) {
+    current_.store(s.get());
+    snapshots_.push_back(move(s));
+    reclaim();
+  }
+
+  // Free the retired snapshots not pinned, checking the entering readers
+  // after the pinned ones: a reader entering with a retired snapshot is
+  // either counted by entering_ or has moved to the current one.
+  void reclaim() {
+    auto cur = current_.load();
+    snapshots_.erase(remove_if(snapshots_.begin(), snapshots_.end(),
+                               [&](const unique_ptr<RegistrySnapshot>& s) {
+                                 return s.get() != cur &&
+                                        s->readers.load() == 0 &&
+                                        entering_.load() == 0;
+                               }),
+                     snapshots_.end());
+  }
+
+  static bool has_module(const RegistrySnapshot& s, const void* module) {
+    for (auto& c : s.classes()) {
+      if (c->module == module)
+        return true;
+    }
+    return false;
+  }
+
+  mutex                                mutex_;
+  atomic<const RegistrySnapshot*>      current_{nullptr};
+  mutable atomic<int>                  entering_{0};
+  vector<unique_ptr<RegistrySnapshot>> snapshots_;
+};
+
+#ifdef _MSC_VER
+#define ZTrefExport __declspec(dllexport)
+#else
+#define ZTrefExport __attribute__((visibility("default")))
+#endif
+
+#define ZTrefPluginEntryName "tref_register_plugin"
+
+// Define the entry of plugin, the host calls it after loading the plugin:
+//   auto entry = (tref::PluginEntry)dlsym(handle, TrefPluginEntryName);
+//   entry(tref::Registry::instance(), handle);
+// and calls registry.remove_module(handle) before dlclose.
+#define ZTrefPluginEntry(registry, module)                          \
+  extern "C" ZTrefExport void tref_register_plugin(tref::Registry& \
+                                                       registry,    \
+                                                   const void* module)
+
+using PluginEntry = void (*)(Registry&, const void*);
+
+}  // namespace imp
+
+using imp::make_runtime_class;
+using imp::PluginEntry;
+using imp::Registry;
+using imp::RuntimeClass;
+using imp::RuntimeField;
+
+#define TrefPluginEntry ZTrefPluginEntry
+#define TrefPluginEntryName ZTrefPluginEntryName
+
+}  // namespace tref
+#endif
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Tref: code size report of the reflection per reflected class.
+#
+# Usage: TrefSize.py [--top N] [--nm NM] <binary or object files>...
+#
+# Sums the sizes of the code & data symbols instantiated by Tref(those with
+# tref:: in the demangled name), attributed to the first class in their
+# template arguments which is not from std or tref. The symbols of lambdas
+# passed to each_field/each_subclass are counted too since their names
+# contain the FieldInfo/ClassInfo argument.
+# Build with the flags of the release, the inlined instantiations have no
+# symbol and are counted in their callers.
+
+import argparse
+import collections
+import re
+import subprocess
+import sys
+
+KEYWORDS = {
+    "auto", "bool", "char", "char16_t", "char32_t", "const", "double",
+    "float", "int", "long", "short", "signed", "unsigned", "void",
+    "volatile", "wchar_t", "nullptr_t", "decltype", "operator", "lambda",
+}
+
+IDENT = re.compile(r"[A-Za-z_][\w]*(?:::[A-Za-z_][\w]*)*")
+
+
+def owner_of(name):
+    """The first user class in the template arguments of the symbol."""
+    depth = 0
+    for i, c in enumerate(name):
+        if c == "<":
+            depth += 1
+        elif c == ">":
+            depth -= 1
+        elif depth > 0 and (c.isalpha() or c == "_"):
+            if i > 0 and (name[i - 1].isalnum() or name[i - 1] in "_:"):
+                continue
+            m = IDENT.match(name, i)
+            ident = m.group(0)
+            if ident in KEYWORDS or ident.startswith(("std::", "tref::",
+                                                      "__")):
+                continue
+            return ident
+    return "(shared)"
+
+
+def read_symbols(nm, path):
+    out = subprocess.run([nm, "-C", "-S", "--size-sort", path],
+                         check=True, capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        parts = line.split(" ", 3)
+        if len(parts) == 4 and parts[2].lower() in "tdbrvw":
+            yield int(parts[1], 16), parts[2].lower(), parts[3]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--top", type=int, default=30)
+    parser.add_argument("--nm", default="nm")
+    parser.add_argument("files", nargs="+")
+    args = parser.parse_args()
+
+    sizes = collections.Counter()
+    counts = collections.Counter()
+    total = text = 0
+    for path in args.files:
+        for size, kind, name in read_symbols(args.nm, path):
+            if kind in "tw":
+                text += size
+            if "tref::" not in name:
+                continue
+            owner = owner_of(name)
+            sizes[owner] += size
+            counts[owner] += 1
+            total += size
+
+    print(f"{'class':<48} {'symbols':>8} {'bytes':>10}")
+    for owner, size in sizes.most_common(args.top):
+        print(f"{owner[:48]:<48} {counts[owner]:>8} {size:>10}")
+    print(f"{'total of Tref':<48} {sum(counts.values()):>8} {total:>10}")
+    print(f"{'total code':<48} {'':>8} {text:>10}")
+
+
+if __name__ == "__main__":
+    sys.exit(main())
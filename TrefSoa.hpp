@@ -0,0 +1,446 @@
+// Tref: structure-of-arrays container generated from the reflected fields.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_SOA_H
+#define TREF_SOA_H
+#pragma once
+
+#include <new>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+template <typename T, size_t Align = cache_line_size>
+struct AlignedAllocator {
+  using value_type = T;
+
+  static constexpr auto alignment = Align > alignof(T) ? Align : alignof(T);
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Align>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  constexpr AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), align_val_t{alignment}));
+  }
+  void deallocate(T* p, size_t) {
+    ::operator delete(p, align_val_t{alignment});
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Align>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Align>&) const {
+    return false;
+  }
+};
+
+template <typename T>
+using AlignedVector = vector<T, AlignedAllocator<T>>;
+
+// Field meta: store the field with other cold fields in one shared column
+// instead of a dedicated one.
+struct SoaCold {};
+
+// Column element of bool, vector<bool> packs the bits so can not be
+// referenced or viewed as a Span.
+struct SoaBool {
+  SoaBool() = default;
+  SoaBool(bool v) : value{v} {}
+
+  bool value;
+};
+static_assert(sizeof(SoaBool) == sizeof(bool));
+
+template <typename M>
+using soa_element_t = conditional_t<is_same_v<M, bool>, SoaBool, M>;
+
+// Vector storing each data member of T in its own aligned column. Fields with
+// the SoaCold meta are grouped into a single column of tuples.
+// NOTE: T should be default constructible.
+template <typename T>
+class SoaVector {
+  static constexpr auto fields_ = data_fields<T>();
+  static constexpr auto N = tuple_size_v<decltype(fields_)>;
+
+  template <size_t I>
+  using field_t = remove_const_t<tuple_element_t<I, decltype(fields_)>>;
+
+ public:
+  template <size_t I>
+  using member_at_t = typename field_t<I>::member_t;
+
+  template <size_t I>
+  static constexpr bool is_cold_v =
+      is_base_of_v<SoaCold, decltype(declval<field_t<I>>().meta)>;
+
+ private:
+  struct Empty {};
+
+  template <size_t I>
+  using column_t = conditional_t<is_cold_v<I>,
+                                 Empty,
+                                 AlignedVector<soa_element_t<member_at_t<I>>>>;
+
+  template <size_t... Is>
+  static auto make_columns(index_sequence<Is...>) -> tuple<column_t<Is>...>;
+
+  template <size_t... Is>
+  static auto make_cold_row(index_sequence<Is...>)
+      -> decltype(tuple_cat(conditional_t<is_cold_v<Is>,
+                                          tuple<member_at_t<Is>>,
+                                          tuple<>>{}...));
+
+  using Indices = make_index_sequence<N>;
+  using Columns = decltype(make_columns(Indices{}));
+  using ColdRow = decltype(make_cold_row(Indices{}));
+
+  template <size_t I, size_t... Is>
+  static constexpr size_t count_cold(index_sequence<Is...>) {
+    return ((Is < I && is_cold_v<Is> ? 1 : 0) + ... + 0);
+  }
+
+  template <size_t I>
+  static constexpr auto cold_index = count_cold<I>(Indices{});
+
+  template <size_t I, typename V>
+  static auto pick_cold(V&& v) {
+    if constexpr (is_cold_v<I>) {
+      return tuple<member_at_t<I>>{forward<V>(v).*get<I>(fields_).value};
+    } else {
+      return tuple<>{};
+    }
+  }
+
+ public:
+  // Proxy of the element, use get<I>() or field<&T::field>() to access the
+  // fields.
+  template <typename V>
+  class BasicRef {
+   public:
+    BasicRef(V* v, size_t i) : v_{v}, i_{i} {}
+
+    template <size_t I>
+    auto& get() const {
+      return v_->template at<I>(i_);
+    }
+
+    // @param Ptr: member pointer, e.g. field<&T::field>().
+    template <auto Ptr>
+    auto& field() const {
+      return v_->template at<SoaVector::template field_index<Ptr>()>(i_);
+    }
+
+    operator T() const { return v_->load(i_); }
+
+    template <typename U = V, typename = enable_if_t<!is_const_v<U>>>
+    const BasicRef& operator=(const T& o) const {
+      v_->store(i_, o);
+      return *this;
+    }
+
+    size_t index() const { return i_; }
+
+   private:
+    V*     v_;
+    size_t i_;
+  };
+
+  using Ref = BasicRef<SoaVector>;
+  using ConstRef = BasicRef<const SoaVector>;
+
+  template <typename V>
+  class Iterator {
+   public:
+    Iterator(V* v, size_t i) : v_{v}, i_{i} {}
+    BasicRef<V> operator*() const { return {v_, i_}; }
+    Iterator&   operator++() {
+      ++i_;
+      return *this;
+    }
+    bool operator!=(const Iterator& o) const { return i_ != o.i_; }
+    bool operator==(const Iterator& o) const { return i_ == o.i_; }
+
+   private:
+    V*     v_;
+    size_t i_;
+  };
+
+  static constexpr size_t column_count() { return N; }
+
+  size_t size() const { return size_; }
+  bool   empty() const { return size_ == 0; }
+
+  void reserve(size_t n) {
+    each_storage([&](auto& c) { c.reserve(n); }, Indices{});
+    cold_.reserve(n);
+  }
+
+  void clear() {
+    each_storage([&](auto& c) { c.clear(); }, Indices{});
+    cold_.clear();
+    size_ = 0;
+  }
+
+  void push_back(const T& v) { push(v, Indices{}); }
+  void push_back(T&& v) { push(move(v), Indices{}); }
+
+  // Append the objects column by column.
+  void append(const T* objs, size_t n) { append(objs, n, Indices{}); }
+
+  // Copy all the elements to out column by column.
+  // @param out: at least size() elements.
+  void copy_to(T* out) const { copy_to(out, Indices{}); }
+
+  template <typename... Args>
+  Ref emplace_back(Args&&... args) {
+    push(T(forward<Args>(args)...), Indices{});
+    return back();
+  }
+
+  void pop_back() {
+    each_storage([&](auto& c) { c.pop_back(); }, Indices{});
+    if constexpr (tuple_size_v<ColdRow> > 0)
+      cold_.pop_back();
+    size_--;
+  }
+
+  // Remove the element by moving the last one into its place.
+  void swap_remove(size_t i) {
+    if (i + 1 != size_)
+      move_element(size_ - 1, i, Indices{});
+    pop_back();
+  }
+
+  Ref      operator[](size_t i) { return {this, i}; }
+  ConstRef operator[](size_t i) const { return {this, i}; }
+  Ref      back() { return {this, size_ - 1}; }
+
+  Iterator<SoaVector>       begin() { return {this, 0}; }
+  Iterator<SoaVector>       end() { return {this, size_}; }
+  Iterator<const SoaVector> begin() const { return {this, 0}; }
+  Iterator<const SoaVector> end() const { return {this, size_}; }
+
+  template <size_t I>
+  auto& at(size_t i) {
+    if constexpr (is_cold_v<I>) {
+      return std::get<cold_index<I>>(cold_[i]);
+    } else {
+      return column_data<I>()[i];
+    }
+  }
+  template <size_t I>
+  const auto& at(size_t i) const {
+    return const_cast<SoaVector*>(this)->template at<I>(i);
+  }
+
+  // Contiguous & cache line aligned values of the field, e.g. for vectorized
+  // kernels. Not available for cold fields.
+  template <size_t I>
+  Span<member_at_t<I>> column_at() {
+    static_assert(!is_cold_v<I>, "cold fields are not stored in column");
+    return {column_data<I>(), size_};
+  }
+  template <size_t I>
+  Span<const member_at_t<I>> column_at() const {
+    static_assert(!is_cold_v<I>, "cold fields are not stored in column");
+    return {const_cast<SoaVector*>(this)->template column_data<I>(), size_};
+  }
+
+  // @param Ptr: member pointer, e.g. column<&T::field>().
+  template <auto Ptr>
+  auto column() {
+    return column_at<field_index<Ptr>()>();
+  }
+  template <auto Ptr>
+  auto column() const {
+    return column_at<field_index<Ptr>()>();
+  }
+
+  template <auto Ptr>
+  static constexpr size_t field_index() {
+    constexpr auto idx = index_of(Ptr);
+    static_assert(idx != N, "not a reflected data member of T");
+    return idx;
+  }
+
+  T load(size_t i) const {
+    T v;
+    load(v, i, Indices{});
+    return v;
+  }
+
+  void store(size_t i, const T& v) { store(i, v, Indices{}); }
+
+  // @param f: [](auto info, auto column), info is the FieldInfo and column is
+  // the Span of the field, cold fields are skipped.
+  template <typename F>
+  void each_column(F&& f) {
+    each_column(f, Indices{});
+  }
+
+ private:
+  template <typename M, typename C>
+  static constexpr size_t index_of(M C::*ptr) {
+    size_t idx = N;
+    find_index(ptr, idx, Indices{});
+    return idx;
+  }
+
+  template <typename M, typename C, size_t... Is>
+  static constexpr void find_index(M C::*ptr,
+                                   size_t&  idx,
+                                   index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (is_same_v<decltype(get<Is>(fields_).value), M C::*>) {
+            if (get<Is>(fields_).value == ptr)
+              idx = Is;
+          }
+        }(),
+        ...);
+  }
+
+  template <typename F, size_t... Is>
+  void each_storage(F&& f, index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (!is_cold_v<Is>) {
+            if constexpr (is_invocable_v<F, column_t<Is>&, field_t<Is>>) {
+              f(std::get<Is>(columns_), get<Is>(fields_));
+            } else {
+              f(std::get<Is>(columns_));
+            }
+          }
+        }(),
+        ...);
+  }
+
+  template <typename F, size_t... Is>
+  void each_column(F& f, index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (!is_cold_v<Is>)
+            f(get<Is>(fields_), column_at<Is>());
+        }(),
+        ...);
+  }
+
+  // SoaBool is layout compatible with bool.
+  template <size_t I>
+  member_at_t<I>* column_data() {
+    return reinterpret_cast<member_at_t<I>*>(std::get<I>(columns_).data());
+  }
+
+  template <typename V, size_t... Is>
+  void push(V&& v, index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (!is_cold_v<Is>) {
+            using E = soa_element_t<member_at_t<Is>>;
+            std::get<Is>(columns_).push_back(
+                E(forward<V>(v).*get<Is>(fields_).value));
+          }
+        }(),
+        ...);
+    if constexpr (tuple_size_v<ColdRow> > 0)
+      cold_.push_back(tuple_cat(pick_cold<Is>(forward<V>(v))...));
+    size_++;
+  }
+
+  template <size_t... Is>
+  void append(const T* objs, size_t n, index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (!is_cold_v<Is>) {
+            auto ptr = get<Is>(fields_).value;
+            std::get<Is>(columns_).resize(size_ + n);
+            auto dst = column_data<Is>() + size_;
+            for (size_t i = 0; i < n; i++)
+              dst[i] = objs[i].*ptr;
+          }
+        }(),
+        ...);
+    if constexpr (tuple_size_v<ColdRow> > 0) {
+      for (size_t i = 0; i < n; i++)
+        cold_.push_back(tuple_cat(pick_cold<Is>(objs[i])...));
+    }
+    size_ += n;
+  }
+
+  template <size_t... Is>
+  void copy_to(T* out, index_sequence<Is...>) const {
+    (
+        [&] {
+          auto ptr = get<Is>(fields_).value;
+          if constexpr (is_cold_v<Is>) {
+            for (size_t i = 0; i < size_; i++)
+              out[i].*ptr = at<Is>(i);
+          } else {
+            auto src = column_at<Is>().data();
+            for (size_t i = 0; i < size_; i++)
+              out[i].*ptr = src[i];
+          }
+        }(),
+        ...);
+  }
+
+  template <size_t... Is>
+  void load(T& v, size_t i, index_sequence<Is...>) const {
+    ((v.*get<Is>(fields_).value = at<Is>(i)), ...);
+  }
+
+  template <size_t... Is>
+  void store(size_t i, const T& v, index_sequence<Is...>) {
+    ((at<Is>(i) = v.*get<Is>(fields_).value), ...);
+  }
+
+  template <size_t... Is>
+  void move_element(size_t from, size_t to, index_sequence<Is...>) {
+    ((at<Is>(to) = move(at<Is>(from))), ...);
+  }
+
+  Columns                columns_;
+  AlignedVector<ColdRow> cold_;
+  size_t                 size_ = 0;
+};
+
+}  // namespace imp
+
+using imp::AlignedAllocator;
+using imp::AlignedVector;
+using imp::SoaCold;
+using imp::SoaVector;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,219 @@
+// Tref: sort reflected objects by fields.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_SORT_H
+#define TREF_SORT_H
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <numeric>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefValue.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// radix sort
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename M>
+constexpr auto is_radix_key_v =
+    is_enum_v<M> ||
+    (is_arithmetic_v<M> && !is_same_v<M, long double> && sizeof(M) <= 8);
+
+// Map the key to unsigned integer with the same order.
+template <typename M>
+auto radix_key(M v) {
+  if constexpr (is_enum_v<M>) {
+    return radix_key(static_cast<underlying_type_t<M>>(v));
+  } else if constexpr (is_same_v<M, bool>) {
+    return static_cast<uint8_t>(v);
+  } else if constexpr (is_floating_point_v<M>) {
+    using U = conditional_t<sizeof(M) == 4, uint32_t, uint64_t>;
+    constexpr auto sign = U{1} << (sizeof(U) * 8 - 1);
+    U              u;
+    if (v == 0)
+      v = 0;  // -0.0 equals +0.0 as in the comparison sort.
+    memcpy(&u, &v, sizeof(u));
+    return (u & sign) ? static_cast<U>(~u) : static_cast<U>(u | sign);
+  } else if constexpr (is_signed_v<M>) {
+    using U = make_unsigned_t<M>;
+    return static_cast<U>(static_cast<U>(v) ^
+                          (U{1} << (sizeof(U) * 8 - 1)));
+  } else {
+    return v;
+  }
+}
+
+// Stable LSD radix sort of the indices by keys, 8 bits per pass, passes with
+// the same byte for all keys are skipped.
+template <typename K>
+void radix_sort(vector<K>& keys, vector<uint32_t>& idx) {
+  constexpr auto passes = sizeof(K);
+  auto           n = keys.size();
+
+  vector<size_t> hist(passes * 256);
+  for (auto k : keys) {
+    for (size_t p = 0; p < passes; p++)
+      hist[p * 256 + ((k >> (p * 8)) & 0xff)]++;
+  }
+
+  vector<K>        keys2(n);
+  vector<uint32_t> idx2(n);
+  for (size_t p = 0; p < passes; p++) {
+    auto h = &hist[p * 256];
+    if (h[(keys[0] >> (p * 8)) & 0xff] == n)
+      continue;
+    size_t sum = 0;
+    for (size_t b = 0; b < 256; b++) {
+      auto c = h[b];
+      h[b] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < n; i++) {
+      auto pos = h[(keys[i] >> (p * 8)) & 0xff]++;
+      keys2[pos] = keys[i];
+      idx2[pos] = idx[i];
+    }
+    keys.swap(keys2);
+    idx.swap(idx2);
+  }
+}
+
+// below this size the comparison sort is faster.
+constexpr size_t radix_sort_threshold = 256;
+
+// Stable sort the indices by the field.
+template <typename T, typename M, typename C>
+void sort_indices_by(const T* objs, vector<uint32_t>& idx, M C::*ptr) {
+  if constexpr (is_radix_key_v<M>) {
+    if (idx.size() >= radix_sort_threshold) {
+      using K = decltype(radix_key(declval<M>()));
+      vector<K> keys(idx.size());
+      for (size_t i = 0; i < idx.size(); i++)
+        keys[i] = radix_key(objs[idx[i]].*ptr);
+      radix_sort(keys, idx);
+      return;
+    }
+  }
+  stable_sort(idx.begin(), idx.end(), [&](uint32_t a, uint32_t b) {
+    return Less<M>{}(objs[a].*ptr, objs[b].*ptr);
+  });
+}
+
+template <typename T>
+void apply_order(T* objs, const vector<uint32_t>& idx) {
+  vector<T> sorted;
+  sorted.reserve(idx.size());
+  for (auto i : idx)
+    sorted.push_back(move(objs[i]));
+  move(sorted.begin(), sorted.end(), objs);
+}
+
+template <typename C>
+using range_value_t =
+    remove_reference_t<decltype(*declval<C&>().data())>;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// sort by fields
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Stable sort by the fields, e.g. sort_by<&T::level, &T::name>(vec).
+// Integer, float & enum fields are sorted by radix sort, others by comparison
+// with the generated ordering.
+// @param c: contiguous container of reflected objects, e.g. vector & Span.
+template <auto... Ptrs, typename C>
+void sort_by(C&& c) {
+  static_assert(sizeof...(Ptrs) > 0, "need at least one field");
+  using T = range_value_t<C>;
+  auto             objs = c.data();
+  vector<uint32_t> idx(c.size());
+  iota(idx.begin(), idx.end(), 0);
+
+  // sort by the least significant key first.
+  using SortFn = void (*)(const T*, vector<uint32_t>&);
+  SortFn keys[] = {[](const T* o, vector<uint32_t>& i) {
+    sort_indices_by(o, i, Ptrs);
+  }...};
+  for (auto i = sizeof...(Ptrs); i > 0; i--)
+    keys[i - 1](objs, idx);
+  apply_order(objs, idx);
+}
+
+template <typename T, size_t... Is>
+bool sort_indices_by_name(const T*          objs,
+                          vector<uint32_t>& idx,
+                          string_view       name,
+                          index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  auto           found = false;
+  (
+      [&] {
+        if (!found && get<Is>(fields).name == name) {
+          found = true;
+          sort_indices_by(objs, idx, get<Is>(fields).value);
+        }
+      }(),
+      ...);
+  return found;
+}
+
+// Stable sort by the fields specified by names.
+// @return false if any field is not found, the container is not changed.
+template <typename C>
+bool sort_by(C&& c, initializer_list<string_view> names) {
+  using T = range_value_t<C>;
+  constexpr auto fields = tuple_size_v<decltype(data_fields<T>())>;
+
+  vector<uint32_t> idx(c.size());
+  iota(idx.begin(), idx.end(), 0);
+  for (auto i = names.end(); i != names.begin();) {
+    --i;
+    if (!sort_indices_by_name(c.data(), idx, *i,
+                              make_index_sequence<fields>{}))
+      return false;
+  }
+  apply_order(c.data(), idx);
+  return true;
+}
+
+template <typename C>
+bool sort_by(C&& c, string_view name) {
+  return sort_by(forward<C>(c), {name});
+}
+
+}  // namespace imp
+
+using imp::radix_sort;
+using imp::sort_by;
+
+}  // namespace tref
+#endif
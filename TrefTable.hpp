@@ -0,0 +1,631 @@
+// Tref: in-memory table of reflected records indexed by key metas.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_TABLE_H
+#define TREF_TABLE_H
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefValue.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// key metas
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field metas of the Table, e.g. TrefFieldWithMeta(id, MetaPrimaryKey{}).
+// A meta derived from both MetaUnique & MetaIndexed gets both indexes.
+
+// unique hash index, for point lookups.
+struct MetaUnique {};
+struct MetaPrimaryKey : MetaUnique {};
+
+// sorted index allowing duplicates, for point & range lookups.
+struct MetaIndexed {};
+
+using RowId = uint32_t;
+constexpr RowId invalid_row = ~RowId{0};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Slab
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Rows never move once inserted, erased slots are reused.
+template <typename T>
+class Slab {
+ public:
+  static constexpr RowId block_size = 256;
+
+  Slab() = default;
+  Slab(const Slab&) = delete;
+  Slab& operator=(const Slab&) = delete;
+  ~Slab() { clear(); }
+
+  template <typename... Args>
+  RowId emplace(Args&&... args) {
+    if (free_.empty() && used_ == blocks_.size() * block_size) {
+      auto b = make_unique<Slot[]>(block_size);
+      for (RowId i = 0; i < block_size; i++)
+        b[i].id = used_ + i;
+      blocks_.push_back(move(b));
+    }
+    auto  id = free_.empty() ? used_ : free_.back();
+    auto& s = slot(id);
+    new (s.buf) T(forward<Args>(args)...);
+    s.live = true;
+    free_.empty() ? void(used_++) : free_.pop_back();
+    size_++;
+    return id;
+  }
+
+  void erase(RowId id) {
+    auto& s = slot(id);
+    s.get()->~T();
+    s.live = false;
+    free_.push_back(id);
+    size_--;
+  }
+
+  void clear() {
+    for (RowId i = 0; i < used_; i++) {
+      if (slot(i).live)
+        erase(i);
+    }
+    free_.clear();
+    used_ = 0;
+  }
+
+  bool live(RowId id) const { return id < used_ && slot(id).live; }
+
+  T&       operator[](RowId id) { return *slot(id).get(); }
+  const T& operator[](RowId id) const { return *slot(id).get(); }
+
+  // @param p: a row of this slab.
+  static RowId id_of(const T* p) {
+    auto s = reinterpret_cast<const unsigned char*>(p) - offsetof(Slot, buf);
+    return reinterpret_cast<const Slot*>(s)->id;
+  }
+
+  size_t size() const { return size_; }
+
+  // @param f: [](RowId id, T& row)
+  template <typename F>
+  void each(F&& f) const {
+    for (RowId i = 0; i < used_; i++) {
+      if (slot(i).live)
+        f(i, *slot(i).get());
+    }
+  }
+
+ private:
+  struct Slot {
+    RowId id;
+    bool  live;
+    alignas(T) unsigned char buf[sizeof(T)];
+
+    T* get() const {
+      return launder(reinterpret_cast<T*>(const_cast<unsigned char*>(buf)));
+    }
+  };
+
+  Slot& slot(RowId id) const {
+    return blocks_[id / block_size][id % block_size];
+  }
+
+  vector<unique_ptr<Slot[]>> blocks_;
+  vector<RowId>              free_;
+  RowId                      used_ = 0;
+  size_t                     size_ = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// indexes
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct NoIndex {};
+
+// Open addressing with linear probing, slots hold row ids, the keys are read
+// from the rows by the accessor: [](RowId id) -> const M&.
+template <typename M>
+class HashIndex {
+ public:
+  template <typename Key>
+  RowId find(const M& v, Key&& key) const {
+    if (slots_.empty())
+      return invalid_row;
+    auto mask = slots_.size() - 1;
+    for (auto s = hash(v) & mask; slots_[s] != empty_slot;
+         s = (s + 1) & mask) {
+      auto id = slots_[s];
+      if (id != tomb_slot && equal(key(id), v))
+        return id;
+    }
+    return invalid_row;
+  }
+
+  // NOTE: the key must not exist.
+  template <typename Key>
+  void insert(const M& v, RowId id, Key&& key) {
+    if ((count_ + tombs_ + 1) * 2 > slots_.size())
+      rehash(key);
+    auto mask = slots_.size() - 1;
+    auto s = hash(v) & mask;
+    while (slots_[s] != empty_slot && slots_[s] != tomb_slot)
+      s = (s + 1) & mask;
+    tombs_ -= slots_[s] == tomb_slot;
+    slots_[s] = id;
+    count_++;
+  }
+
+  void erase(const M& v, RowId id) {
+    auto mask = slots_.size() - 1;
+    for (auto s = hash(v) & mask; slots_[s] != empty_slot;
+         s = (s + 1) & mask) {
+      if (slots_[s] == id) {
+        slots_[s] = tomb_slot;
+        tombs_++;
+        count_--;
+        return;
+      }
+    }
+  }
+
+  void clear() {
+    slots_.clear();
+    count_ = tombs_ = 0;
+  }
+
+ private:
+  static constexpr RowId empty_slot = invalid_row;
+  static constexpr RowId tomb_slot = invalid_row - 1;
+
+  template <typename Key>
+  void rehash(Key&& key) {
+    size_t cap = 16;
+    while (cap < (count_ + 1) * 4)
+      cap *= 2;
+    vector<RowId> old(cap, empty_slot);
+    old.swap(slots_);
+    for (auto id : old) {
+      if (id == empty_slot || id == tomb_slot)
+        continue;
+      auto s = hash(key(id)) & (cap - 1);
+      while (slots_[s] != empty_slot)
+        s = (s + 1) & (cap - 1);
+      slots_[s] = id;
+    }
+    tombs_ = 0;
+  }
+
+  vector<RowId> slots_;
+  size_t        count_ = 0;
+  size_t        tombs_ = 0;
+};
+
+// Keys are copied into a sorted array for cache friendly binary searching,
+// equal keys are ordered by row ids.
+// Single inserts shift the array, bulk loads append the entries & merge them
+// by one sort instead.
+template <typename M>
+class SortedIndex {
+ public:
+  using Entry = pair<M, RowId>;
+
+  void insert(const M& v, RowId id) {
+    auto e = Entry{v, id};
+    auto it = lower_bound(entries_.begin(), entries_.end(), e, entry_less);
+    entries_.insert(it, move(e));
+  }
+
+  // Append the entry unsorted, call merge() after the last one before any
+  // other operation.
+  void append(const M& v, RowId id) {
+    if (pending_ == npos)
+      pending_ = entries_.size();
+    entries_.emplace_back(v, id);
+  }
+
+  // Sort the appended entries & merge them into the sorted ones.
+  void merge() {
+    if (pending_ == npos)
+      return;
+    auto mid = entries_.begin() + static_cast<ptrdiff_t>(pending_);
+    sort(mid, entries_.end(), entry_less);
+    inplace_merge(entries_.begin(), mid, entries_.end(), entry_less);
+    pending_ = npos;
+  }
+
+  void erase(const M& v, RowId id) {
+    auto e = Entry{v, id};
+    auto it = lower_bound(entries_.begin(), entries_.end(), e, entry_less);
+    if (it != entries_.end() && it->second == id)
+      entries_.erase(it);
+  }
+
+  // @param f: [](RowId id) -> bool, return false to stop the iterating.
+  template <typename F>
+  bool each_equal(const M& v, F&& f) const {
+    for (auto it = lower(v); it != entries_.end() && !key_less(v, it->first);
+         ++it) {
+      if (!f(it->second))
+        return false;
+    }
+    return true;
+  }
+
+  // Rows of keys in [lo, hi).
+  template <typename F>
+  bool each_range(const M& lo, const M& hi, F&& f) const {
+    for (auto it = lower(lo); it != entries_.end() && key_less(it->first, hi);
+         ++it) {
+      if (!f(it->second))
+        return false;
+    }
+    return true;
+  }
+
+  void clear() {
+    entries_.clear();
+    pending_ = npos;
+  }
+
+ private:
+  static constexpr size_t npos = ~size_t(0);
+
+  static bool key_less(const M& a, const M& b) { return Less<M>{}(a, b); }
+
+  static bool entry_less(const Entry& a, const Entry& b) {
+    if (auto c = compare(a.first, b.first))
+      return c < 0;
+    return a.second < b.second;
+  }
+
+  auto lower(const M& v) const {
+    return lower_bound(
+        entries_.begin(), entries_.end(), v,
+        [](const Entry& e, const M& k) { return key_less(e.first, k); });
+  }
+
+  vector<Entry> entries_;
+  size_t        pending_ = npos;  // first appended entry.
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Table
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Rows stored in a stable slab with indexes maintained by the key metas of the
+// reflected fields, rows are read-only outside to keep the indexes valid, use
+// update to modify them.
+template <typename T>
+class Table {
+  static constexpr auto fields_ = data_fields<T>();
+  static constexpr auto N = tuple_size_v<decltype(fields_)>;
+  using Indices = make_index_sequence<N>;
+
+  template <size_t I>
+  using member_at_t =
+      typename remove_reference_t<decltype(get<I>(fields_))>::member_t;
+
+  template <size_t I>
+  static constexpr auto is_unique_v =
+      is_base_of_v<MetaUnique, decltype(get<I>(fields_).meta)>;
+
+  template <size_t I>
+  static constexpr auto is_indexed_v =
+      is_base_of_v<MetaIndexed, decltype(get<I>(fields_).meta)>;
+
+  template <size_t... Is>
+  static auto hash_indexes(index_sequence<Is...>)
+      -> tuple<conditional_t<is_unique_v<Is>,
+                             HashIndex<member_at_t<Is>>,
+                             NoIndex>...>;
+
+  template <size_t... Is>
+  static auto sorted_indexes(index_sequence<Is...>)
+      -> tuple<conditional_t<is_indexed_v<Is>,
+                             SortedIndex<member_at_t<Is>>,
+                             NoIndex>...>;
+
+ public:
+  Table() = default;
+  Table(const Table&) = delete;
+  Table& operator=(const Table&) = delete;
+
+  // @return nullptr if any unique key exists.
+  const T* insert(T row) {
+    if (conflicts(row, invalid_row, Indices{}))
+      return nullptr;
+    auto id = rows_.emplace(move(row));
+    index(id, Indices{});
+    return &rows_[id];
+  }
+
+  // Bulk insert, the sorted indexes are sorted once for all the rows instead
+  // of an array insert per row.
+  // @return count of the inserted rows, rows with existing unique keys(also
+  // those inserted before in the same call) are skipped.
+  template <typename It>
+  size_t insert(It first, It last) {
+    size_t n = 0;
+    for (; first != last; ++first) {
+      T row = *first;
+      if (conflicts(row, invalid_row, Indices{}))
+        continue;
+      auto id = rows_.emplace(move(row));
+      index<true>(id, Indices{});
+      n++;
+    }
+    merge(Indices{});
+    return n;
+  }
+
+  // Modify the copy of the row by f: [](T& row), the changed keys are
+  // re-indexed.
+  // @return false if any unique key of the modified row exists, the row
+  // is not changed.
+  template <typename F>
+  bool update(const T* row, F&& f) {
+    auto id = Slab<T>::id_of(row);
+    T    v = *row;
+    f(v);
+    if (conflicts(v, id, Indices{}))
+      return false;
+    auto changed = unindex_changed(id, v, Indices{});
+    rows_[id] = move(v);
+    index_changed(id, changed, Indices{});
+    return true;
+  }
+
+  void erase(const T* row) {
+    auto id = Slab<T>::id_of(row);
+    unindex(id, Indices{});
+    rows_.erase(id);
+  }
+
+  void clear() {
+    clear(Indices{});
+    rows_.clear();
+  }
+
+  // Point lookup by unique or indexed field.
+  // @return the first matched row or nullptr.
+  template <auto Ptr>
+  const T* find(const member_t<decltype(Ptr)>& v) const {
+    constexpr auto I = field_index<Ptr>();
+    if constexpr (is_unique_v<I>) {
+      auto id = get<I>(hash_).find(v, key<I>());
+      return id == invalid_row ? nullptr : &rows_[id];
+    } else {
+      static_assert(is_indexed_v<I>, "field is not unique or indexed");
+      const T* r = nullptr;
+      get<I>(sorted_).each_equal(v, [&](RowId id) {
+        r = &rows_[id];
+        return false;
+      });
+      return r;
+    }
+  }
+
+  // @param f: [](const T& row) -> bool, return false to stop the iterating.
+  template <auto Ptr, typename F>
+  bool each_equal(const member_t<decltype(Ptr)>& v, F&& f) const {
+    constexpr auto I = field_index<Ptr>();
+    if constexpr (is_indexed_v<I>) {
+      return get<I>(sorted_).each_equal(
+          v, [&](RowId id) { return f(rows_[id]); });
+    } else {
+      auto r = find<Ptr>(v);
+      return !r || f(*r);
+    }
+  }
+
+  // Iterate rows of the field in [lo, hi) in the order of the field.
+  template <auto Ptr, typename F>
+  bool each_range(const member_t<decltype(Ptr)>& lo,
+                  const member_t<decltype(Ptr)>& hi,
+                  F&&                            f) const {
+    constexpr auto I = field_index<Ptr>();
+    static_assert(is_indexed_v<I>, "range lookup needs MetaIndexed");
+    return get<I>(sorted_).each_range(
+        lo, hi, [&](RowId id) { return f(rows_[id]); });
+  }
+
+  // Full scan in the slab order.
+  // @param f: [](const T& row)
+  template <typename F>
+  void each(F&& f) const {
+    rows_.each([&](RowId, const T& row) { f(row); });
+  }
+
+  size_t size() const { return rows_.size(); }
+  bool   empty() const { return rows_.size() == 0; }
+
+ private:
+  template <typename M, typename C>
+  static constexpr size_t index_of(M C::*ptr) {
+    size_t idx = N;
+    find_index(ptr, idx, Indices{});
+    return idx;
+  }
+
+  template <typename M, typename C, size_t... Is>
+  static constexpr void find_index(M C::*ptr,
+                                   size_t&  idx,
+                                   index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (is_same_v<decltype(get<Is>(fields_).value), M C::*>) {
+            if (get<Is>(fields_).value == ptr)
+              idx = Is;
+          }
+        }(),
+        ...);
+  }
+
+  template <auto Ptr>
+  static constexpr size_t field_index() {
+    constexpr auto idx = index_of(Ptr);
+    static_assert(idx != N, "not a reflected data member of T");
+    return idx;
+  }
+
+  template <size_t I>
+  auto key() const {
+    return [this](RowId id) -> const member_at_t<I>& {
+      return rows_[id].*get<I>(fields_).value;
+    };
+  }
+
+  template <size_t... Is>
+  bool conflicts(const T& row, RowId self, index_sequence<Is...>) const {
+    return ([&] {
+      if constexpr (is_unique_v<Is>) {
+        auto id = get<Is>(hash_).find(row.*get<Is>(fields_).value, key<Is>());
+        return id != invalid_row && id != self;
+      } else {
+        return false;
+      }
+    }() || ...);
+  }
+
+  // @param Bulk: append to the sorted indexes, merge() them at the end.
+  template <size_t I, bool Bulk = false>
+  void index_field(RowId id) {
+    auto& v = rows_[id].*get<I>(fields_).value;
+    if constexpr (is_unique_v<I>)
+      get<I>(hash_).insert(v, id, key<I>());
+    if constexpr (is_indexed_v<I>) {
+      if constexpr (Bulk)
+        get<I>(sorted_).append(v, id);
+      else
+        get<I>(sorted_).insert(v, id);
+    }
+  }
+
+  template <size_t I>
+  void unindex_field(RowId id) {
+    auto& v = rows_[id].*get<I>(fields_).value;
+    if constexpr (is_unique_v<I>)
+      get<I>(hash_).erase(v, id);
+    if constexpr (is_indexed_v<I>)
+      get<I>(sorted_).erase(v, id);
+  }
+
+  template <bool Bulk = false, size_t... Is>
+  void index(RowId id, index_sequence<Is...>) {
+    (index_field<Is, Bulk>(id), ...);
+  }
+
+  template <size_t... Is>
+  void merge(index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (is_indexed_v<Is>)
+            get<Is>(sorted_).merge();
+        }(),
+        ...);
+  }
+
+  template <size_t... Is>
+  void unindex(RowId id, index_sequence<Is...>) {
+    (unindex_field<Is>(id), ...);
+  }
+
+  // @return bit mask of the changed key fields.
+  template <size_t... Is>
+  uint64_t unindex_changed(RowId id, const T& v, index_sequence<Is...>) {
+    uint64_t changed = 0;
+    (
+        [&] {
+          if constexpr (is_unique_v<Is> || is_indexed_v<Is>) {
+            static_assert(Is < 64, "too many fields");
+            auto ptr = get<Is>(fields_).value;
+            if (!equal(rows_[id].*ptr, v.*ptr)) {
+              unindex_field<Is>(id);
+              changed |= uint64_t{1} << Is;
+            }
+          }
+        }(),
+        ...);
+    return changed;
+  }
+
+  template <size_t... Is>
+  void index_changed(RowId id, uint64_t changed, index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (is_unique_v<Is> || is_indexed_v<Is>) {
+            if (changed & (uint64_t{1} << Is))
+              index_field<Is>(id);
+          }
+        }(),
+        ...);
+  }
+
+  template <size_t... Is>
+  void clear(index_sequence<Is...>) {
+    (
+        [&] {
+          if constexpr (is_unique_v<Is>)
+            get<Is>(hash_).clear();
+          if constexpr (is_indexed_v<Is>)
+            get<Is>(sorted_).clear();
+        }(),
+        ...);
+  }
+
+  Slab<T>                             rows_;
+  decltype(hash_indexes(Indices{}))   hash_;
+  decltype(sorted_indexes(Indices{})) sorted_;
+};
+
+}  // namespace imp
+
+using imp::HashIndex;
+using imp::invalid_row;
+using imp::MetaIndexed;
+using imp::MetaPrimaryKey;
+using imp::MetaUnique;
+using imp::RowId;
+using imp::Slab;
+using imp::SortedIndex;
+using imp::Table;
+
+}  // namespace tref
+#endif
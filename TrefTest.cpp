@@ -1,9 +1,42 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include "Tref.hpp"
+#include "TrefFactory.hpp"
+#include "TrefRegistry.hpp"
+#include "TrefSoa.hpp"
+#include "TrefBatch.hpp"
+#include "TrefValue.hpp"
+#include "TrefSort.hpp"
+#include "TrefTable.hpp"
+#include "TrefFilter.hpp"
+#include "TrefValidate.hpp"
+#include "TrefArrow.hpp"
+#include "TrefLog.hpp"
+#include "TrefCsv.hpp"
+#include "TrefLoader.hpp"
+#include "TrefInvoke.hpp"
+#define TREF_TRACE
+#include "TrefTrace.hpp"
+#include "TrefLayout.hpp"
+#include "TrefMemory.hpp"
+#include "TrefFormat.hpp"
+#include "TrefConfig.hpp"
+#include "TrefCompact.hpp"
+#include "TrefEcs.hpp"
+#include "TrefClone.hpp"
+#include "TrefEnumMap.hpp"
 
 using namespace std;
 using namespace tref;
@@ -99,6 +132,18 @@ struct SubTypeB : TempType<float> {
 static_assert(is_same_v<TrefBaseOf(SubTypeB), TempType<float>>);
 static_assert(!is_same_v<TrefBaseOf(SubTypeB), TempType<int>>);
 
+// full name & id to distinguish the template instances.
+
+static_assert(class_info<TempType<int>>().full_name == "TempType<int>");
+static_assert(class_info<TempType<float>>().full_name == "TempType<float>");
+static_assert(class_info<TypeA>().full_name == "TypeA");
+static_assert(class_info<TempType<int>>().id == type_id_v<TempType<int>>);
+static_assert(class_info<TempType<int>>().id !=
+              class_info<TempType<float>>().id);
+static_assert(class_info<TempType<float>>().id !=
+              class_info<TempType<double>>().id);
+static_assert(type_name_v<SubTypeA> == "SubTypeA");
+
 //////////////////////////////
 // class meta
 
@@ -209,6 +254,9 @@ static_assert(class_info<TestInnerTemplate::InnerTemplate<int>>().each_field(
       return info.name == "a";
     }));
 
+static_assert(class_info<TestInnerTemplate::InnerTemplate<int>>().full_name ==
+              "TestInnerTemplate::InnerTemplate<int>");
+
 static_assert(class_info<TestInnerTemplate>().each_member_type([](auto info,
                                                                   int) {
   using MT = typename decltype(info.value)::type;
@@ -426,7 +474,9 @@ static_assert([] {
 
 template <typename T>
 void DumpEnum() {
-  printf("========= Enum Members of %s ======\n", enum_info<T>().name.data());
+  constexpr auto name = enum_info<T>().name;
+  printf("========= Enum Members of %.*s ======\n", (int)name.size(),
+         name.data());
   enum_info<T>().each_item([](auto info) {
     printf("name: %.*s, val: %d\n", (int)info.name.size(), info.name.data(),
            (int)info.value);
@@ -465,14 +515,15 @@ constexpr bool hasSubclass(string_view name) {
 
 template <class T>
 void dumpTree() {
-  printf("===== All Subclass of %s ====\n", class_info<T>().name.data());
+  constexpr auto name = class_info<T>().name;
+  printf("===== All Subclass of %.*s ====\n", (int)name.size(), name.data());
 
   class_info<T>().each_subclass([&](auto info, int level) {
     for (int i = 0; i < 4 * level; i++)
       printf(" ");
 
     assert(info.name.size() > 0);
-    printf("%s (rtti: %s)\n", info.name.data(),
+    printf("%.*s (rtti: %s)\n", (int)info.name.size(), info.name.data(),
            typeid(typename decltype(info)::class_t).name());
     return true;
   });
@@ -482,7 +533,8 @@ void dumpTree() {
 template <typename T>
 void dumpDetails() {
   constexpr auto clsInfo = class_info<T>();
-  printf("==== subclass details of %s ====\n", clsInfo.name.data());
+  printf("==== subclass details of %.*s ====\n", (int)clsInfo.name.size(),
+         clsInfo.name.data());
 
   constexpr auto memName = "baseVal";
   constexpr auto index = clsInfo.get_field_index(memName);
@@ -497,8 +549,9 @@ void dumpDetails() {
     }
 
     printf("==================\n");
-    printf("type: %6s, parent: %6s, size: %d\n", info.name.data(),
-           parent.data(), (int)info.size);
+    printf("type: %6.*s, parent: %6.*s, size: %d\n", (int)info.name.size(),
+           info.name.data(), (int)parent.size(), parent.data(),
+           (int)info.size);
     printf("--- members ---\n");
 
     int preLv = 0;
@@ -506,12 +559,12 @@ void dumpDetails() {
       if (lv != preLv) {
         auto owner =
             class_info<typename decltype(info)::enclosing_class_t>().name;
-        printf("--- from %s ---\n", owner.data());
+        printf("--- from %.*s ---\n", (int)owner.size(), owner.data());
       }
       preLv = lv;
 
-      printf("%-2d:%-12s: type: %s", info.index, info.name.data(),
-             typeid(info.value).name());
+      printf("%-2d:%-12.*s: type: %s", info.index, (int)info.name.size(),
+             info.name.data(), typeid(info.value).name());
 
       if constexpr (std::is_base_of_v<::Meta, decltype(info.meta)>) {
         printf(", meta: %s\n", info.meta.to_string().c_str());
@@ -545,7 +598,7 @@ struct MetaExportedClass {
     printf("===== All Exported Class ====\n");
     class_info<T>().each_subclass([&](auto info, int) {
       if constexpr (is_base_of_v<MetaExportedClass, decltype(info.meta)>) {
-        printf("%s\n", info.name.data());
+        printf("%.*s\n", (int)info.name.size(), info.name.data());
       }
       return true;
     });
@@ -732,10 +785,2018 @@ static_assert(hasSubclass<Base>("SubChildOfTempSubChild3"));
 static_assert(hasSubclass<SubChild>("ExternalData"));
 static_assert(hasSubclass<Base>("ExternalData"));
 
+//////////////////////////////////////////////////////////////////////////
+// factory
+
+struct FactoryPlain {
+  TrefType(FactoryPlain);
+
+  int b = 0;
+  TrefField(b);
+};
+
+struct FactoryVirtual : FactoryPlain {
+  TrefType(FactoryVirtual);
+  virtual ~FactoryVirtual() = default;
+
+  string s = "virtual";
+  TrefField(s);
+};
+TrefSubType(FactoryVirtual);
+
+void TestFactory() {
+  printf("======== Test Factory =========\n");
+  Factory<Base> factory{256};
+
+  // template instances are only accessible by full name or id.
+  assert(factory.find("Data") == nullptr);
+  assert(factory.find("Data<int, void>") != nullptr);
+  assert(factory.find("TempSubChild<float>")->id ==
+         class_info<TempSubChild<float>>().id);
+
+  for (int i = 0; i < 100; i++) {
+    auto c = factory.create("Child");
+    assert(c && static_cast<Child*>(c)->name == "boo");
+    c->baseVal = i;
+  }
+  auto d = factory.create("Data<int, void>");
+  assert(d);
+  auto s = factory.create(class_info<SubChild>().id);
+  assert(s && static_cast<SubChild*>(s)->subVal == 99);
+  auto e = factory.create<ExternalData>();
+  assert(e->subVal == 99);
+  assert(factory.create("NotExists") == nullptr);
+
+  for (auto& t : factory.types()) {
+    if (t.count)
+      printf("%.*s: %d\n", (int)t.full_name.size(), t.full_name.data(),
+             (int)t.count);
+  }
+  assert(factory.find("Child")->count == 100);
+  assert(factory.find("ExternalData")->count == 1);
+
+  auto cap = factory.arena().capacity();
+  factory.reset();
+  assert(factory.find("Child")->count == 0);
+  factory.create("Child");
+  assert(factory.arena().capacity() == cap);
+
+  // the base is not at offset 0 of the subclass adding a vptr.
+  Factory<FactoryPlain> plain;
+  auto p = plain.create(class_info<FactoryVirtual>().id);
+  assert(p && static_cast<FactoryVirtual*>(p)->s == "virtual");
+  assert(static_cast<void*>(p) != static_cast<FactoryVirtual*>(p));
+  plain.reset();
+  printf("====================\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// runtime registry
+
+struct RegistryExtra {
+  TrefType(RegistryExtra);
+
+  int x = 0;
+  TrefField(x);
+};
+
+void TestRegistry() {
+  printf("======== Test Registry =========\n");
+  Registry registry;
+  static const int pluginA = 0, pluginB = 0;
+
+  registry.add_hierarchy<Base>(&pluginA);
+  registry.add<ExternalData>(&pluginB);  // already added
+  registry.add<TypeB>(&pluginB);
+  registry.add<TypeA>(&pluginB);
+
+  atomic<bool> stop{false};
+  atomic<int>  lookups{0};
+  vector<thread> workers;
+  for (int i = 0; i < 4; i++) {
+    workers.emplace_back([&] {
+      while (!stop) {
+        auto r = registry.read();
+        if (auto c = r.find("Child")) {
+          alignas(max_align_t) char mem[sizeof(Child)];
+          auto b = r.construct_as<Base>(c->id, mem);
+          assert(b && static_cast<Child*>(b)->name == "boo");
+          c->destroy(mem);
+        }
+        lookups++;
+      }
+    });
+  }
+
+  {
+    auto r = registry.read();
+    auto c = r.find(class_info<Child>().id);
+    assert(c && c->name == "Child" && c->size == sizeof(Child));
+    assert(r.find(c->base_id)->full_name == "Data<int, void>");
+    assert(c->fields.size() == 1 && c->fields[0].name == "z");
+    Child child;
+    assert(c->fields[0].offset == size_t((char*)&child.z - (char*)&child));
+    assert(r.find("TypeB")->base_id == class_info<TypeA>().id);
+    assert(r.is_base_of(class_info<Base>().id, class_info<ExternalData>().id));
+
+    auto subclasses = 0;
+    r.each_subclass(class_info<SubChild>().id, [&](const RuntimeClass& s) {
+      printf("subclass of SubChild: %s\n", s.full_name.c_str());
+      subclasses++;
+      return true;
+    });
+    assert(subclasses == 7);
+  }
+
+  while (lookups < 1000)
+    this_thread::yield();
+
+  // a reader pinned to an older snapshot blocks the removal.
+  auto pinned = make_unique<Registry::Reader>(registry);
+  static const int pluginC = 0;
+  registry.add<RegistryExtra>(&pluginC);
+  atomic<bool> removed{false};
+  thread       remover([&] {
+    registry.remove_module(&pluginB);
+    removed = true;
+  });
+  this_thread::sleep_for(chrono::milliseconds(20));
+  assert(!removed && pinned->find("TypeB"));
+  pinned.reset();
+  remover.join();
+  assert(removed && !registry.read().find("TypeB"));
+  assert(registry.remove_module(&pluginC) == 1);
+
+  assert(registry.remove_module(&pluginA) > 0);
+  assert(!registry.read().find("Child"));
+  stop = true;
+  for (auto& w : workers)
+    w.join();
+  printf("====================\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// structure of arrays
+
+struct Particle {
+  TrefType(Particle);
+
+  float px = 0, py = 0;
+  TrefField(px);
+  TrefField(py);
+
+  float vx = 0, vy = 0;
+  TrefField(vx);
+  TrefField(vy);
+
+  string tag;
+  TrefFieldWithMeta(tag, SoaCold{});
+
+  int owner = 0;
+  TrefFieldWithMeta(owner, SoaCold{});
+};
+
+struct TaggedParticle : Particle {
+  TrefType(TaggedParticle);
+
+  int id = 0;
+  TrefField(id);
+
+  bool alive = true;
+  TrefField(alive);
+};
+
+static_assert(SoaVector<Particle>::column_count() == 6);
+static_assert(SoaVector<TaggedParticle>::field_index<&TaggedParticle::id>() ==
+              6);
+static_assert(SoaVector<Particle>::is_cold_v<4>);
+
+void TestSoaVector() {
+  SoaVector<TaggedParticle> ps;
+  ps.reserve(100);
+  for (int i = 0; i < 100; i++) {
+    TaggedParticle p;
+    p.px = (float)i;
+    p.vx = 1;
+    p.tag = "p" + to_string(i);
+    p.id = i;
+    ps.push_back(p);
+  }
+  auto e = ps.emplace_back();
+  e.field<&TaggedParticle::id>() = 100;
+  e.field<&Particle::tag>() = "last";
+
+  auto px = ps.column<&Particle::px>();
+  auto vx = ps.column<&Particle::vx>();
+  assert(px.size() == 101);
+  assert(reinterpret_cast<uintptr_t>(px.data()) % 64 == 0);
+  for (size_t i = 0; i < px.size(); i++)
+    px[i] += vx[i];
+
+  ps.each_column([](auto info, auto column) {
+    assert(info.name != "tag" && info.name != "owner");
+    assert(reinterpret_cast<uintptr_t>(column.data()) % 64 == 0);
+  });
+
+  TaggedParticle p = ps[10];
+  assert(p.px == 11 && p.tag == "p10" && p.id == 10);
+  assert(ps[100].get<4>() == "last");
+
+  ps.swap_remove(10);
+  assert(ps.size() == 100);
+  assert(ps[10].field<&TaggedParticle::id>() == 100);
+  assert(ps[10].field<&Particle::tag>() == "last");
+
+  p.id = 42;
+  ps[0] = p;
+  auto sum = 0;
+  for (auto r : ps)
+    sum += r.field<&TaggedParticle::id>();
+  assert(sum == 5050 - 10 + 42);
+
+  // bool is stored one per byte, not packed as vector<bool>.
+  ps[3].field<&TaggedParticle::alive>() = false;
+  auto alive = ps.column<&TaggedParticle::alive>();
+  assert(alive.size() == 100 && !alive[3] && alive[4]);
+  TaggedParticle dead = ps[3];
+  assert(!dead.alive && ps[4].get<7>());
+}
+
+//////////////////////////////////////////////////////////////////////////
+// batch kernels
+
+struct Vec3 {
+  TrefType(Vec3);
+
+  float x = 0, y = 0, z = 0;
+  TrefField(x);
+  TrefField(y);
+  TrefField(z);
+};
+
+struct Motion {
+  TrefType(Motion);
+
+  Vec3 pos, vel;
+  TrefField(pos);
+  TrefField(vel);
+};
+
+struct Avatar {
+  TrefType(Avatar);
+
+  Motion motion;
+  TrefField(motion);
+
+  int hp = 0;
+  TrefFieldWithMeta(hp, (MetaRange<int>{0, 100}));
+
+  double speed = 0;
+  TrefFieldWithMeta(speed, (MetaNumber{"speed", 0.0, 10.0}));
+
+  EnumA state = EnumA::Ass;
+  TrefField(state);
+
+  string name;
+  TrefField(name);
+};
+
+static_assert(is_flat_of_v<Motion, float>);
+static_assert(!is_flat_of_v<Avatar, float>);
+
+void TestBatch() {
+  vector<Motion> a(37), b(37), out(37);
+  for (int i = 0; i < 37; i++) {
+    a[i].pos = {0, float(i), 2};
+    b[i].pos = {10, float(i) * 3, 2};
+    b[i].vel.z = 4;
+  }
+  lerp(a.data(), b.data(), 0.5, out.data(), out.size());
+  for (int i = 0; i < 37; i++) {
+    assert(out[i].pos.x == 5 && out[i].pos.y == i * 2 && out[i].pos.z == 2);
+    assert(out[i].vel.z == 2);
+  }
+  axpy(2.0, b.data(), a.data(), a.size());
+  assert(a[36].pos.y == 36 * 7 && a[36].vel.z == 8);
+
+  vector<Avatar> x(3), y(3), z(3);
+  x[1] = {{}, 10, 1.0, EnumA::Ass, "x"};
+  y[1] = {{}, 300, 20.0, EnumA::Ban, "y"};
+  y[1].motion.pos.x = 8;
+  lerp(x.data(), y.data(), 0.5, z.data(), z.size());
+  assert(z[1].hp == 155 && z[1].speed == 10.5 && z[1].motion.pos.x == 4);
+  assert(z[1].state == EnumA::Ass && z[1].name == "x");
+  clamp_by_meta(z.data(), z.size());
+  assert(z[1].hp == 100 && z[1].speed == 10.0);
+
+  SoaVector<Avatar> soa;
+  to_soa(z.data(), z.size(), soa);
+  assert(soa.size() == 3 && soa[1].field<&Avatar::hp>() == 100);
+  vector<Avatar> back(3);
+  to_aos(soa, back.data());
+  assert(back[1].name == "x" && back[1].motion.pos.x == 4);
+  axpy(1.0, y.data(), back.data(), back.size());
+  assert(back[1].hp == 400 && back[1].motion.pos.x == 12);
+  assert(back[1].state == EnumA::Ass && back[1].name == "x");
+
+  SoaVector<Avatar> from, to;
+  to_soa(x.data(), x.size(), from);
+  to_soa(y.data(), y.size(), to);
+  auto mid = from;
+  lerp(from, to, 0.5, mid);
+  assert(mid[1].field<&Avatar::hp>() == 155);
+  assert(mid[1].field<&Avatar::motion>().pos.x == 4);
+  assert(mid[1].field<&Avatar::name>() == "x");
+  axpy(1.0, to, mid);
+  assert(mid[1].field<&Avatar::speed>() == 30.5);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// hash
+
+struct RequestKey {
+  TrefType(RequestKey);
+
+  int   id = 0;
+  short shard = 0;
+  TrefField(id);
+  TrefField(shard);
+
+  string name;
+  TrefField(name);
+
+  vector<Vec3> points;
+  TrefField(points);
+
+  EnumA kind = EnumA::Ass;
+  TrefField(kind);
+
+  double weight = 0;
+  TrefField(weight);
+
+  optional<int> limit;
+  TrefField(limit);
+
+  int cacheHits = 0;
+  TrefFieldWithMeta(cacheHits, MetaNoHash{});
+};
+TrefStdHash(RequestKey);
+
+struct PlainKey {
+  TrefType(PlainKey);
+
+  int a = 0, b = 0;
+  TrefField(a);
+  TrefField(b);
+};
+
+// the base is not at offset 0 because of the vptr of the derived class.
+struct HashBase {
+  TrefType(HashBase);
+
+  int a = 0, b = 0;
+  TrefField(a);
+  TrefField(b);
+};
+
+struct HashDerived : HashBase {
+  TrefType(HashDerived);
+  virtual ~HashDerived() = default;
+
+  int c = 0;
+  TrefField(c);
+};
+
+struct HashInner {
+  TrefType(HashInner);
+
+  int x = 0;
+  TrefField(x);
+
+  int cache = 0;
+  TrefFieldWithMeta(cache, MetaNoHash{});
+};
+
+struct HashOuter {
+  TrefType(HashOuter);
+
+  HashInner inner;
+  TrefField(inner);
+
+  vector<HashInner> inners;
+  TrefField(inners);
+};
+
+void TestHash() {
+  RequestKey a;
+  a.id = 1;
+  a.name = "req";
+  a.points = {{1, 2, 3}};
+  auto b = a;
+  b.cacheHits = 100;
+  b.weight = -0.0;
+  assert(tref::hash(a) == tref::hash(b));
+  assert(std::hash<RequestKey>{}(a) == Hash<RequestKey>{}(b));
+
+  for (auto change : {0, 1, 2, 3, 4, 5}) {
+    auto c = a;
+    switch (change) {
+      case 0: c.shard = 1; break;
+      case 1: c.name = "req2"; break;
+      case 2: c.points[0].z = 4; break;
+      case 3: c.kind = EnumA::Ban; break;
+      case 4: c.weight = 1; break;
+      case 5: c.limit = 0; break;
+    }
+    assert(tref::hash(a) != tref::hash(c));
+  }
+
+  // padding free object is hashed as a memory block.
+  PlainKey p{1, 2};
+  assert(tref::hash(p) == hash_bytes(&p, sizeof(p), 0));
+
+  HashDerived d1, d2;
+  d2.b = 1;
+  assert(offset_of<HashDerived>(&HashBase::b) ==
+         static_cast<size_t>(reinterpret_cast<char*>(&d1.b) -
+                             reinterpret_cast<char*>(&d1)));
+  assert(tref::hash(d1) != tref::hash(d2));
+
+  // skipped fields of the nested memory blocks are not hashed.
+  HashOuter o1, o2;
+  o1.inners.resize(2);
+  o2.inners.resize(2);
+  o2.inner.cache = 1;
+  o2.inners[1].cache = 1;
+  assert(tref::hash(o1) == tref::hash(o2));
+  o2.inners[1].x = 1;
+  assert(tref::hash(o1) != tref::hash(o2));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// equality & ordering
+
+struct Record : PlainKey {
+  TrefType(Record);
+
+  string name;
+  TrefField(name);
+
+  float score = 0;
+  TrefField(score);
+
+  vector<int> tags;
+  TrefField(tags);
+
+  int version = 0;
+  TrefFieldWithMeta(version, MetaNoCompare{});
+};
+
+struct CompareInner {
+  TrefType(CompareInner);
+
+  int x = 0;
+  TrefField(x);
+
+  int stamp = 0;
+  TrefFieldWithMeta(stamp, MetaNoCompare{});
+};
+
+struct CompareHandler {
+  TrefType(CompareHandler);
+
+  int id = 0;
+  TrefField(id);
+
+  CompareInner inner;
+  TrefField(inner);
+
+  vector<CompareInner> inners;
+  TrefField(inners);
+
+  function<void()> callback;
+  TrefFieldWithMeta(callback, MetaNoCompare{});
+};
+
+void TestCompare() {
+  Record a, b;
+  a.a = b.a = 1;
+  a.name = b.name = "rec";
+  a.tags = b.tags = {1, 2, 3};
+  b.version = 10;
+  assert(equal(a, b) && compare(a, b) == 0);
+  assert(tref::hash(a) == tref::hash(b));
+
+  // inherited fields are compared first, by value instead of bytes.
+  a.b = 256;
+  b.b = 1;
+  b.name = "z";
+  assert(!equal(a, b) && compare(a, b) > 0 && compare(b, a) < 0);
+  a.b = 1;
+  assert(compare(a, b) < 0);
+  b.name = a.name;
+  a.name = b.name;
+  a.tags.push_back(0);
+  assert(compare(a, b) > 0);
+  a.tags.pop_back();
+  a.score = -0.0f;
+  assert(equal(a, b));
+
+  vector<Record> rs(3, a);
+  rs[0].a = 3;
+  rs[1].a = 2;
+  sort(rs.begin(), rs.end(), Less<Record>{});
+  assert(rs[0].a == 1 && rs[2].a == 3);
+  assert(Equal<Record>{}(rs[0], a));
+
+  // the skipped fields need no operator== & are skipped in nested blocks.
+  CompareHandler h1, h2;
+  h2.callback = [] {};
+  h1.inners.resize(1);
+  h2.inners.resize(1);
+  h2.inner.stamp = 1;
+  h2.inners[0].stamp = 1;
+  assert(equal(h1, h2) && compare(h1, h2) == 0);
+  assert(tref::hash(h1) == tref::hash(h2));
+  h2.inners[0].x = 1;
+  assert(!equal(h1, h2) && compare(h1, h2) < 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// sort by fields
+
+void TestSort() {
+  // large enough to use the radix sort.
+  vector<Record> rs(1000);
+  unsigned       seed = 1;
+  for (auto& r : rs) {
+    seed = seed * 1103515245 + 12345;
+    r.a = static_cast<int>(seed >> 16) % 7 - 3;
+    r.score = static_cast<float>(static_cast<int>(seed >> 8) % 200 - 100) / 8;
+    r.name = to_string(seed % 13);
+  }
+
+  auto expect = rs;
+  stable_sort(expect.begin(), expect.end(), [](auto& x, auto& y) {
+    return x.a != y.a ? x.a < y.a : x.score < y.score;
+  });
+  auto got = rs;
+  sort_by<&Record::a, &Record::score>(got);
+  assert(equal(got.begin(), got.end(), expect.begin(), Equal<Record>{}));
+
+  got = rs;
+  assert(sort_by(Span<Record>{got}, {"a", "score"}));
+  assert(equal(got.begin(), got.end(), expect.begin(), Equal<Record>{}));
+
+  // strings fall back to comparison sort.
+  stable_sort(expect.begin(), expect.end(),
+              [](auto& x, auto& y) { return x.name < y.name; });
+  sort_by<&Record::name>(got);
+  assert(equal(got.begin(), got.end(), expect.begin(), Equal<Record>{}));
+
+  assert(!sort_by(got, "none"));
+  assert(equal(got.begin(), got.end(), expect.begin(), Equal<Record>{}));
+
+  // -0.0 equals +0.0 whatever the size, so the order is kept.
+  vector<Record> zeros(256);
+  for (size_t i = 0; i < zeros.size(); i++) {
+    zeros[i].a = static_cast<int>(i);
+    zeros[i].score = i % 2 ? -0.0f : 0.0f;
+  }
+  sort_by<&Record::score>(zeros);
+  for (size_t i = 0; i < zeros.size(); i++)
+    assert(zeros[i].a == static_cast<int>(i));
+
+  vector<Avatar> as(3);
+  as[0].state = EnumA::Ban;
+  as[1].state = EnumA::Ass;
+  as[2].state = EnumA::Ban;
+  as[2].name = "last";
+  assert(sort_by(as, "state"));
+  assert(as[0].state == EnumA::Ass && as[2].name == "last");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// indexed table
+
+struct Player {
+  TrefType(Player);
+
+  int id = 0;
+  TrefFieldWithMeta(id, MetaPrimaryKey{});
+
+  string name;
+  TrefFieldWithMeta(name, MetaUnique{});
+
+  int level = 0;
+  TrefFieldWithMeta(level, MetaIndexed{});
+
+  string guild;
+  TrefFieldWithMeta(guild, MetaIndexed{});
+
+  float exp = 0;
+  TrefField(exp);
+};
+
+void TestTable() {
+  Table<Player> t;
+  vector<const Player*> rows;
+  for (int i = 0; i < 1000; i++) {
+    auto r = t.insert(Player{i, "p" + to_string(i), i % 50,
+                             i % 2 ? "odd" : "even", 0});
+    assert(r && r->id == i);
+    rows.push_back(r);
+  }
+  assert(t.size() == 1000);
+
+  // unique keys are checked.
+  assert(!t.insert(Player{1, "new", 0, "", 0}));
+  assert(!t.insert(Player{1000, "p1", 0, "", 0}));
+  assert(t.size() == 1000);
+
+  // rows are not moved by growing.
+  assert(t.find<&Player::id>(10) == rows[10]);
+  assert(t.find<&Player::name>("p999") == rows[999]);
+  assert(!t.find<&Player::id>(1000));
+
+  int cnt = 0;
+  t.each_equal<&Player::level>(7, [&](const Player& p) {
+    assert(p.level == 7);
+    return ++cnt > 0;
+  });
+  assert(cnt == 20);
+
+  cnt = 0;
+  int last = 0;
+  t.each_range<&Player::level>(10, 20, [&](const Player& p) {
+    assert(p.level >= 10 && p.level < 20 && p.level >= last);
+    last = p.level;
+    return ++cnt > 0;
+  });
+  assert(cnt == 200);
+
+  // changed keys are re-indexed.
+  assert(t.update(rows[3], [](Player& p) {
+    p.level = 100;
+    p.name = "renamed";
+  }));
+  assert(t.find<&Player::name>("renamed") == rows[3]);
+  assert(!t.find<&Player::name>("p3"));
+  assert(t.find<&Player::level>(100) == rows[3]);
+  assert(!t.update(rows[4], [](Player& p) { p.id = 5; }));
+  assert(rows[4]->id == 4);
+
+  for (int i = 0; i < 1000; i += 2)
+    t.erase(rows[i]);
+  assert(t.size() == 500);
+  assert(!t.find<&Player::id>(10) && t.find<&Player::id>(11) == rows[11]);
+  cnt = 0;
+  t.each_equal<&Player::guild>("even", [&](const Player&) { return ++cnt; });
+  assert(cnt == 0);
+
+  // erased slots are reused.
+  auto r = t.insert(Player{2000, "p2000", 0, "", 0});
+  assert(find(rows.begin(), rows.end(), r) != rows.end());
+  assert(t.find<&Player::id>(2000) == r);
+
+  t.clear();
+  assert(t.empty() && !t.find<&Player::id>(11));
+
+  // bulk loading merges into the existing sorted entries.
+  t.insert(Player{-1, "first", 25, "odd", 0});
+  vector<Player> bulk;
+  for (int i = 999; i >= 0; i--)
+    bulk.push_back({i, "p" + to_string(i), i % 50, i % 2 ? "odd" : "even", 0});
+  bulk.push_back({5, "dup", 0, "", 0});
+  assert(t.insert(bulk.begin(), bulk.end()) == 1000 && t.size() == 1001);
+  cnt = 0;
+  last = 0;
+  t.each_range<&Player::level>(20, 30, [&](const Player& p) {
+    assert(p.level >= 20 && p.level < 30 && p.level >= last);
+    last = p.level;
+    return ++cnt > 0;
+  });
+  assert(cnt == 201);
+  assert(t.find<&Player::level>(25)->id == -1);
+  assert(t.find<&Player::name>("p5")->id == 5 && !t.find<&Player::name>("dup"));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// filter
+
+struct Hero {
+  TrefType(Hero);
+
+  int level = 0;
+  TrefField(level);
+
+  EnumA faction = EnumA::Ass;
+  TrefField(faction);
+
+  float power = 0;
+  TrefField(power);
+
+  bool online = false;
+  TrefFieldWithMeta(online, SoaCold{});
+
+  string name;
+  TrefFieldWithMeta(name, SoaCold{});
+};
+
+void TestFilter() {
+  vector<Hero>   hs(3000);
+  SoaVector<Hero> soa;
+  for (int i = 0; i < 3000; i++) {
+    auto& h = hs[i];
+    h.level = i % 37;
+    h.faction = i % 3 ? EnumA::Ass : EnumA::Ban;
+    h.power = static_cast<float>(i % 101) / 4 - 5;
+    h.online = i % 5 == 0;
+    h.name = (i % 2 ? "alice" : "bob") + to_string(i);
+    soa.push_back(h);
+  }
+
+  auto check = [&](string_view expr, auto pred) {
+    auto f = Filter<Hero>::compile(expr);
+    assert(f);
+    auto aos = f.select(hs);
+    auto col = f.select(soa);
+    assert(aos.size == hs.size() && aos.bits == col.bits);
+    size_t n = 0;
+    for (size_t i = 0; i < hs.size(); i++) {
+      assert(aos.test(i) == pred(hs[i]));
+      n += pred(hs[i]);
+    }
+    assert(aos.count() == n);
+    aos.each([&](size_t i) { assert(pred(hs[i])); });
+  };
+
+  check("level >= 10 && faction == Ban && name startswith \"a\"",
+        [](const Hero& h) {
+          return h.level >= 10 && h.faction == EnumA::Ban &&
+                 h.name[0] == 'a';
+        });
+  check("power < -2.5 || !(level != 3) || name endswith '99'",
+        [](const Hero& h) {
+          auto n = h.name.size();
+          return h.power < -2.5 || h.level == 3 || h.name.substr(n - 2) == "99";
+        });
+  check("online && name contains \"ice1\" && faction != 1", [](const Hero& h) {
+    return h.online && h.name.find("ice1") != string::npos &&
+           h.faction != EnumA::Ass;
+  });
+  check("!online || level <= 2 && power > 0", [](const Hero& h) {
+    return !h.online || (h.level <= 2 && h.power > 0);
+  });
+
+  assert(Filter<Hero>::compile("level > 1").match(hs[2]));
+  assert(!Filter<Hero>::compile("").error().empty());
+  assert(!Filter<Hero>::compile("rank > 1"));
+  assert(!Filter<Hero>::compile("faction == Red"));
+  assert(!Filter<Hero>::compile("level > 1.5"));
+  assert(!Filter<Hero>::compile("level startswith \"1\""));
+  assert(!Filter<Hero>::compile("(level > 1"));
+  assert(!Filter<Hero>::compile("level > 1 ||"));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// validation
+
+bool is_email(const string& s) {
+  return s.find('@') != string::npos;
+}
+
+struct Account : Base {
+  TrefType(Account);
+
+  int level = 1;
+  TrefFieldWithMeta(level, (MetaRange<int>{1, 100}));
+
+  string name;
+  TrefFieldWithMeta(name, MetaNonEmpty{});
+
+  string email;
+  TrefFieldWithMeta(email,
+                    (Metas{MetaNonEmpty{}, MetaValidator<string>{is_email}}));
+
+  double balance = 0;
+  TrefFieldWithMeta(balance, (MetaNumber{"balance", 0.0, 1e6}));
+
+  vector<int> items;
+  TrefField(items);
+};
+
+static_assert(validation_rules<Account>().size() == 5);
+static_assert(validation_rules<Account>()[2].field == "email");
+static_assert(validation_rules<Account>()[3].kind == ValidationKind::Custom);
+static_assert(is_same_v<ValidationResult<Account>::Mask, uint8_t>);
+
+void TestValidate() {
+  vector<Account> as(20000);
+  for (size_t i = 0; i < as.size(); i++) {
+    as[i].name = "a";
+    as[i].email = "a@b";
+  }
+  as[5].level = 0;
+  as[7].name.clear();
+  as[9].email = "ab";
+  as[11].email.clear();
+  as[13].balance = -1;
+  as[19999].level = 101;
+
+  auto r = validate(as);
+  assert(r.errors.size() == as.size() && r.invalid == 6 && !r.ok());
+  assert(r.errors[5] == 1 && r.errors[7] == 2 && r.errors[9] == 8);
+  assert(r.errors[11] == 12 && r.errors[13] == 16 && r.errors[19999] == 1);
+
+  vector<string> errors;
+  r.each_error([&](size_t row, const ValidationRule& rule) {
+    errors.push_back(to_string(row) + ":" + string{rule.field});
+  });
+  assert((errors == vector<string>{"5:level", "7:name", "9:email", "11:email",
+                                   "11:email", "13:balance", "19999:level"}));
+
+  // single threaded gives the same result.
+  auto r1 = validate(Span<const Account>{as}, 1);
+  assert(r1.errors == r.errors && r1.invalid == r.invalid);
+  assert(validate(vector<Account>{}).ok());
+}
+
+//////////////////////////////////////////////////////////////////////////
+// arrow
+
+struct Trade {
+  TrefType(Trade);
+
+  int64_t id = 0;
+  TrefField(id);
+
+  Vec3 pos;
+  TrefField(pos);
+
+  EnumA side = EnumA::Ass;
+  TrefField(side);
+
+  string symbol;
+  TrefField(symbol);
+
+  bool filled = false;
+  TrefField(filled);
+
+  uint16_t qty = 0;
+  TrefField(qty);
+
+  vector<int> unmapped;
+  TrefField(unmapped);
+};
+
+void TestArrow() {
+  vector<Trade> ts(100);
+  for (int i = 0; i < 100; i++) {
+    auto& t = ts[i];
+    t.id = int64_t{1} << 40 | i;
+    t.pos = {i * 0.5f, -i * 1.0f, 2};
+    t.side = i % 3 ? EnumA::Ass : EnumA::Ban;
+    t.symbol = i % 2 ? "" : "SYM" + to_string(i);
+    t.filled = i % 5 == 1;
+    t.qty = static_cast<uint16_t>(i * 600);
+    t.unmapped = {i};
+  }
+
+  for (auto fmt : {ArrowFormat::Stream, ArrowFormat::File}) {
+    ostringstream out;
+    {
+      ArrowWriter<Trade> w{out, fmt};
+      w.write(Span<const Trade>{ts.data(), 60});
+      w.write(Span<const Trade>{ts.data() + 60, 40});
+    }
+    auto data = out.str();
+    assert(data.size() % 8 == (fmt == ArrowFormat::File ? 2 : 0));
+
+    vector<Trade> back;
+    string        err;
+    assert(read_arrow(data, back, &err) && err.empty());
+    assert(back.size() == ts.size());
+    for (size_t i = 0; i < ts.size(); i++) {
+      auto& a = ts[i];
+      auto& b = back[i];
+      assert(a.id == b.id && a.pos.x == b.pos.x && a.pos.y == b.pos.y &&
+             a.pos.z == b.pos.z && a.side == b.side && a.symbol == b.symbol &&
+             a.filled == b.filled && a.qty == b.qty && b.unmapped.empty());
+    }
+
+    // truncated data is rejected without crashing.
+    back.clear();
+    assert(!read_arrow(string_view{data}.substr(0, data.size() / 2), back,
+                       &err) ||
+           back.size() < ts.size());
+  }
+
+  // fields are matched by names.
+  ostringstream out;
+  write_arrow(out, Span<const Vec3>{&ts[3].pos, 1});
+  vector<Motion> ms;
+  assert(read_arrow(out.str(), ms) && ms.size() == 1 && ms[0].pos.x == 0);
+  vector<Vec3> vs;
+  assert(read_arrow(out.str(), vs) && vs.size() == 1 && vs[0].x == 1.5f);
+
+  // corrupted bytes, e.g. a bit width of 128, are rejected without crashing.
+  ostringstream small;
+  write_arrow(small, Span<const Trade>{ts.data(), 4});
+  auto good = small.str();
+  for (size_t i = 0; i < good.size(); i++) {
+    for (auto c : {'\x80', '\xff'}) {
+      auto bad = good;
+      bad[i] = c;
+      vector<Trade> got;
+      read_arrow(bad, got);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// log
+
+struct Tick {
+  TrefType(Tick);
+
+  uint32_t frame = 0;
+  TrefField(frame);
+
+  int64_t score = 0;
+  TrefField(score);
+
+  bool alive = true;
+  TrefField(alive);
+
+  EnumA state = EnumA::Ass;
+  TrefField(state);
+
+  Vec3 pos;
+  TrefField(pos);
+
+  double hp = 100;
+  TrefField(hp);
+
+  string name;
+  TrefField(name);
+
+  vector<int> unlogged;
+  TrefField(unlogged);
+};
+
+void TestLog() {
+  auto path = (filesystem::temp_directory_path() / "tref_test.log").string();
+  filesystem::remove(path);
+
+  vector<Tick> ts(10000);
+  for (size_t i = 0; i < ts.size(); i++) {
+    auto& t = ts[i];
+    t.frame = static_cast<uint32_t>(i);
+    t.score = i % 7 == 0 ? -static_cast<int64_t>(i) : static_cast<int64_t>(i);
+    t.alive = i < 9000;
+    t.state = i % 100 < 50 ? EnumA::Ass : EnumA::Ban;
+    t.pos = {i * 0.25f, 1, -2};
+    t.hp = 100 - i * 0.01;
+    t.name = "unit" + to_string(i / 1000);
+  }
+
+  // appended by two writers, the tail of the 1st one is flushed on close.
+  {
+    LogWriter<Tick> w{path, 1000};
+    assert(w);
+    w.append(Span<const Tick>{ts.data(), 4500});
+  }
+  {
+    LogWriter<Tick> w{path, 1000};
+    w.append(Span<const Tick>{ts.data() + 4500, 5500});
+  }
+  assert(filesystem::file_size(path) < ts.size() * sizeof(Tick) / 4);
+
+  LogReader<Tick> r{path};
+  assert(r && r.size() == ts.size() && r.keyframes() == 11);
+
+  vector<Tick> back(ts.size());
+  assert(r.read(0, ts.size(), back.data()) == ts.size());
+  for (size_t i = 0; i < ts.size(); i++) {
+    auto& a = ts[i];
+    auto& b = back[i];
+    assert(a.frame == b.frame && a.score == b.score && a.alive == b.alive &&
+           a.state == b.state && a.pos.x == b.pos.x && a.pos.y == b.pos.y &&
+           a.pos.z == b.pos.z && a.hp == b.hp && a.name == b.name);
+  }
+
+  // seek into the middle of a block, decode the selected columns only.
+  vector<Tick> part(2000);
+  assert(r.read(4321, 2000, part.data(), {"frame", "pos"}) == 2000);
+  assert(part[0].frame == 4321 && part[1999].frame == 6320);
+  assert(part[5].pos.x == ts[4326].pos.x && part[5].pos.z == -2);
+  assert(part[5].hp == 100 && part[5].name.empty() && part[5].score == 0);
+  assert(r.read(9990, 100, part.data()) == 10 && part[9].frame == 9999);
+
+  // a truncated block is dropped on reopening.
+  filesystem::resize_file(path, filesystem::file_size(path) - 3);
+  assert(LogReader<Tick>{path}.size() == 9500);
+  {
+    LogWriter<Tick> w{path};
+    w.append(ts[0]);
+  }
+  assert(LogReader<Tick>{path}.size() == 9501);
+
+  // columns are matched by names.
+  LogReader<Motion> m{path};
+  assert(m && m.size() == 9501);
+  Motion mo;
+  assert(m.read(3, 1, &mo) == 1 && mo.pos.x == 0.75f && mo.vel.x == 0);
+  assert(!LogWriter<Motion>{path});
+  filesystem::remove(path);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// csv
+
+struct Item {
+  TrefType(Item);
+
+  int id = 0;
+  TrefField(id);
+
+  string name;
+  TrefField(name);
+
+  EnumA kind = EnumA::Ass;
+  TrefField(kind);
+
+  float price = 0;
+  TrefField(price);
+
+  Vec3 pos;
+  TrefField(pos);
+
+  bool active = false;
+  TrefField(active);
+};
+
+void TestCsv() {
+  string data = "\xEF\xBB\xBFid,name,kind,unknown,price,pos.x,active\r\n";
+  for (int i = 0; i < 200000; i++) {
+    data += to_string(i) + ",item" + to_string(i) + (i % 2 ? ",Ban" : ",1") +
+            ",?," + to_string(i % 100) + ".5," + to_string(-i) + "," +
+            (i % 3 ? "true" : "0") + "\n";
+  }
+  data += "7,\"a,\"\"b\"\"\",Ban,,1e3, 2 ,1\n\n";
+  data += "8,bad,Cat,,1,2,1\n";
+  data += "9,short\n";
+  data += "x,bad,Ban,,1,2,1";
+
+  auto r = csv::parse<Item>(data, {',', 3});
+  assert(r && r.rows.size() == 200002);
+  for (int i = 0; i < 200000; i += 997) {
+    auto& t = r.rows[i];
+    assert(t.id == i && t.name == "item" + to_string(i) &&
+           t.kind == (i % 2 ? EnumA::Ban : EnumA::Ass) &&
+           t.price == i % 100 + 0.5f && t.pos.x == -i && t.pos.y == 0 &&
+           t.active == (i % 3 != 0));
+  }
+  auto& q = r.rows[200000];
+  assert(q.name == "a,\"b\"" && q.kind == EnumA::Ban && q.price == 1000);
+  assert(q.pos.x == 2 && q.active);
+  assert(r.rows[200001].id == 9 && r.rows[200001].name == "short");
+  assert(r.errors.size() == 2);
+  assert(r.errors[0].line == 200004 && r.errors[0].column == "kind");
+  assert(r.errors[1].line == 200006 && r.errors[1].column == "id");
+
+  // tsv file, a single chunk.
+  auto path = (filesystem::temp_directory_path() / "tref_test.tsv").string();
+  {
+    ofstream out{path, ios::binary};
+    out << "name\tid\n a b \t3\n";
+  }
+  auto t = csv::read<Item>(path);
+  assert(t && t.rows.size() == 1 && t.rows[0].name == " a b ");
+  assert(t.rows[0].id == 3 && t.errors.empty());
+  filesystem::remove(path);
+
+  assert(!csv::read<Item>(path) && !csv::parse<Item>("a,b\n1,2"));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// asset loader
+
+struct Asset {
+  TrefType(Asset);
+  virtual ~Asset() = default;
+
+  int size = 0;
+  TrefField(size);
+};
+
+struct MeshAsset : Asset {
+  TrefType(MeshAsset);
+
+  vector<float> vertices;
+  TrefField(vertices);
+};
+TrefSubType(MeshAsset);
+
+struct SoundAsset : Asset {
+  TrefType(SoundAsset);
+
+  string clip;
+  TrefField(clip);
+};
+TrefSubType(SoundAsset);
+
+void TestLoader() {
+  auto dir = filesystem::temp_directory_path() / "tref_assets";
+  filesystem::create_directories(dir);
+  vector<string> paths;
+  for (int i = 0; i < 100; i++) {
+    paths.push_back((dir / (to_string(i) + ".asset")).string());
+    ofstream out{paths.back(), ios::binary};
+    out << (i % 3 ? "MeshAsset " : "SoundAsset ") << i;
+  }
+  paths.push_back((dir / "missing.asset").string());
+  {
+    ofstream out{(dir / "bad.asset").string(), ios::binary};
+    out << "Texture 1";
+  }
+  paths.push_back((dir / "bad.asset").string());
+
+  // "<type name> <size>"
+  AssetLoader<Asset> loader{
+      [](string_view data, Factory<Asset>& factory) -> Asset* {
+        auto sp = data.find(' ');
+        auto obj = factory.create(data.substr(0, sp));
+        if (obj) {
+          obj->size = stoi(string{data.substr(sp + 1)});
+          if (auto m = dynamic_cast<MeshAsset*>(obj))
+            m->vertices.assign(obj->size, 1);
+        }
+        return obj;
+      },
+      4};
+
+  atomic<size_t> calls{0}, last{0};
+  auto failed = loader.load(paths, [&](size_t done, size_t total) {
+    assert(total == paths.size() && done <= total);
+    calls++;
+    if (done == total)
+      last++;
+  });
+  assert(failed == 2 && calls == paths.size() && last == 1);
+
+  auto& objs = loader.objects();
+  assert(objs.size() == paths.size() && !objs[100] && !objs[101]);
+  for (int i = 0; i < 100; i++) {
+    assert(objs[i]->size == i);
+    if (i % 3)
+      assert(static_cast<MeshAsset*>(objs[i])->vertices.size() == size_t(i));
+    else
+      assert(dynamic_cast<SoundAsset*>(objs[i]));
+  }
+
+  auto stats = loader.stats();
+  assert(stats.size() == 3 && stats[0].name == "Asset" && !stats[0].count);
+  assert(stats[1].name == "MeshAsset" && stats[1].count == 66);
+  assert(stats[2].name == "SoundAsset" && stats[2].count == 34);
+  assert(stats[1].bytes > 66 * 10);
+
+  loader.reset();
+  assert(loader.objects().empty() && loader.stats()[1].count == 0);
+  filesystem::remove_all(dir);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// invoke
+
+struct Calc {
+  TrefType(Calc);
+
+  int base = 10;
+  TrefField(base);
+
+  int add(int a, int b) const { return base + a + b; }
+  TrefField(add);
+
+  string concat(const string& a, string b) { return a + b; }
+  TrefField(concat);
+
+  void reset(int& out) noexcept {
+    out = base;
+    base = 0;
+  }
+  TrefField(reset);
+
+  static double scale(double v) { return v * 2; }
+  TrefField(scale);
+};
+
+static_assert(!decltype(class_info<Calc>().get_field<1>())::is_func_v);
+using CalcAdd = decltype(class_info<Calc>().get_field<2>());
+static_assert(CalcAdd::is_func_v && CalcAdd::args_count == 2);
+static_assert(is_same_v<CalcAdd::ret_t, int>);
+static_assert(is_same_v<CalcAdd::args_t, tuple<int, int>>);
+using CalcScale = decltype(class_info<Calc>().get_field<5>());
+static_assert(CalcScale::is_func_v && !CalcScale::is_member_v);
+static_assert(is_same_v<CalcScale::args_t, tuple<double>>);
+
+struct InvokeBase {
+  TrefType(InvokeBase);
+
+  int v = 1;
+  TrefField(v);
+
+  int bump(int n) { return v += n; }
+  TrefField(bump);
+};
+
+struct InvokeDerived : InvokeBase {
+  TrefType(InvokeDerived);
+  virtual ~InvokeDerived() = default;
+};
+
+void TestInvoke() {
+  Calc c;
+  auto add = find_invoker<Calc>("add");
+  assert(add && add.is_member() && add.args_count() == 2);
+  assert(add.ret_type() == type_id_v<int> && add.arg_type(1) == type_id_v<int>);
+
+  ArgPack<> args;
+  args.push(1);
+  args.push(2);
+  int r = 0;
+  assert(add(&c, args, &r) && r == 13);
+  assert(add(&c, args) && add.call(&c, args, &r) && r == 13);
+  double d = 0;
+  assert(!add.call(&c, args, &d));
+
+  // argument types must match exactly.
+  args.clear();
+  args.push(1);
+  args.push(2.0f);
+  assert(!add(&c, args, &r));
+  args.clear();
+  args.push(1);
+  assert(!add(&c, args, &r));
+
+  ArgPack<128> sargs;
+  sargs.push(string{"a long string beyond the small string buffer"});
+  sargs.push(string{"!"});
+  string s;
+  assert(find_invoker<Calc>("concat")(&c, sargs, &s) &&
+         s == "a long string beyond the small string buffer!");
+
+  ArgPack<16> refs;
+  refs.push(0);
+  assert(find_invoker<Calc>("reset")(&c, refs) && c.base == 0);
+  // overflow of the fixed buffer is reported.
+  assert(refs.push(1) && refs.push(1.0) && !refs.push(1.0));
+  assert(!refs.push(string{}));
+
+  ArgPack<> sc;
+  sc.push(1.5);
+  assert(find_invoker<Calc>("scale")(nullptr, sc, &d) && d == 3);
+  assert(!find_invoker<Calc>("base") && !find_invoker<Calc>("none"));
+
+  // the base is not at offset 0 of the subclass adding a vptr.
+  InvokeDerived id;
+  ArgPack<>     two;
+  two.push(2);
+  assert(find_invoker<InvokeDerived>("bump")(&id, two, &r) && r == 3);
+  assert(id.v == 3);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// trace
+
+struct Handler {
+  TrefType(Handler);
+
+  int handled = 0;
+
+  int handle(int req) { return handled += req; }
+  TrefFieldWithMeta(handle, MetaTraced{});
+
+  int peek() const { return handled; }
+  TrefField(peek);
+};
+
+static_assert(is_traced_v<&Handler::handle> && !is_traced_v<&Handler::peek>);
+
+void TestTrace() {
+  ostringstream discard;
+  flush_trace(discard);
+
+  Handler h;
+  vector<thread> ts;
+  for (int t = 0; t < 2; t++) {
+    ts.emplace_back([&, t] {
+      Handler local;
+      for (int i = 0; i < 100; i++)
+        trace_call<&Handler::handle>(local, i);
+      assert(trace_call<&Handler::peek>(as_const(local)) == 4950);
+      if (t == 0)
+        trace_call<&Handler::handle>(h, 1);
+    });
+  }
+  for (auto& t : ts)
+    t.join();
+  assert(h.handled == 1);
+
+  ostringstream out;
+  assert(flush_trace(out) == 201);
+  auto json = out.str();
+  assert(json.rfind("{\"traceEvents\":[", 0) == 0);
+  assert(json.find("{\"name\":\"Handler::handle\",\"cat\":\"tref\"") !=
+         string::npos);
+  assert(json.find("peek") == string::npos);
+  // flushed events are not written again.
+  ostringstream again;
+  assert(flush_trace(again) == 0);
+
+  // flushed while the ring is being overwritten.
+  atomic<bool> done{false};
+  thread       writer{[&] {
+    Handler local;
+    for (size_t i = 0; i < 3 * trace_buffer_events; i++)
+      trace_call<&Handler::handle>(local, 1);
+    done = true;
+  }};
+  size_t flushed = 0;
+  while (!done) {
+    ostringstream busy;
+    flushed += flush_trace(busy);
+  }
+  writer.join();
+  ostringstream rest;
+  flushed += flush_trace(rest);
+  assert(flushed >= trace_buffer_events);
+  assert(flushed <= 3 * trace_buffer_events);
+
+  // buffers of the exited threads are reused.
+  auto buffers = trace_buffer_count();
+  for (int i = 0; i < 4; i++) {
+    thread{[] {
+      Handler local;
+      trace_call<&Handler::handle>(local, 1);
+    }}.join();
+  }
+  assert(trace_buffer_count() == buffers);
+  ostringstream reused;
+  assert(flush_trace(reused) == 4);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// layout
+
+struct Padded {
+  TrefType(Padded);
+
+  char a;
+  TrefField(a);
+
+  double b;
+  TrefField(b);
+
+  char c;
+  TrefField(c);
+
+  int d;
+  TrefFieldWithMeta(d, MetaHot{});
+};
+
+static_assert(sizeof(Padded) == 24 && max_padding_v<Padded> == 10);
+static_assert(optimal_size_v<Padded> == 16);
+static_assert(suggested_order<Padded>()[0].name == "b" &&
+              suggested_order<Padded>()[1].name == "d" &&
+              suggested_order<Padded>()[3].name == "c");
+static_assert(max_padding_v<Vec3> == 0 && optimal_size_v<Vec3> == 12);
+
+struct Straddle {
+  TrefType(Straddle);
+
+  char head[62];
+  TrefField(head);
+
+  char key[4];
+  TrefFieldWithMeta(key, MetaHot{});
+
+  char cold[4];
+  TrefField(cold);
+};
+
+struct DerivedPadded : Padded {
+  TrefType(DerivedPadded);
+
+  char e;
+  TrefField(e);
+};
+
+// the fields of the base are not moved out of it.
+struct DerivedPadded2 : Padded {
+  TrefType(DerivedPadded2);
+
+  char e;
+  TrefField(e);
+
+  double f;
+  TrefField(f);
+};
+
+static_assert(suggested_order<DerivedPadded2>()[0].name == "b" &&
+              suggested_order<DerivedPadded2>()[4].name == "f");
+static_assert(optimal_size_v<DerivedPadded2> == 32);
+
+void TestLayout() {
+  auto r = layout_report<Padded>();
+  assert(r.size == 24 && r.padding == 10 && r.optimal_size == 16);
+  assert(r.fields.size() == 4 && r.fields[1].name == "b");
+  assert(r.fields[1].offset == 8 && r.fields[1].hole == 7);
+  assert(r.fields[3].name == "d" && r.fields[3].hole == 3 && r.tail == 0);
+  assert(r.hot_straddles() == 0);
+
+  auto s = layout_report<Straddle>();
+  assert(s.fields[1].offset == 62 && s.fields[1].straddles());
+  assert(s.hot_straddles() == 1 && s.padding == 0);
+
+  auto d = layout_report<DerivedPadded>();
+  assert(d.fields.size() == 5 && d.fields[4].name == "e");
+  assert(d.fields[4].offset == offset_of(&DerivedPadded::e));
+
+  ostringstream out;
+  out << r << s;
+  auto text = out.str();
+  assert(text.find("/* hole 7 */") != string::npos);
+  assert(text.find("suggested order(size 16): b d a c") != string::npos);
+  assert(text.find("key: offset 62, size 4, lines 0-1, hot, STRADDLES") !=
+         string::npos);
+  cout << text;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// memory
+
+struct Bag {
+  TrefType(Bag);
+
+  vector<int> ids;
+  TrefField(ids);
+};
+
+struct Inventory {
+  TrefType(Inventory);
+
+  int gold = 0;
+  TrefField(gold);
+
+  string title = "short";
+  TrefField(title);
+
+  string desc = string(100, 'x');
+  TrefField(desc);
+
+  vector<string> tags;
+  TrefField(tags);
+
+  unique_ptr<Vec3> pos;
+  TrefField(pos);
+
+  Bag bag;
+  TrefField(bag);
+
+  map<int, string> slots;
+  TrefField(slots);
+
+  const char* label = "not owned";
+  TrefField(label);
+};
+
+void TestMemory() {
+  Inventory inv;
+  inv.tags = {"a", string(50, 't')};
+  inv.pos = make_unique<Vec3>();
+  inv.bag.ids.reserve(10);
+  inv.slots = {{1, "a"}, {2, string(1000, 's')}};
+
+  auto m = memory_usage(inv);
+  assert(m.shallow == sizeof(Inventory) && m.fields.size() == 8);
+  assert(m.fields[0].name == "gold" && m.fields[0].heap == 0);
+  assert(m.fields[1].heap == 0 && m.fields[2].heap == 101);
+  assert(m.fields[3].heap == 2 * sizeof(string) + 51);
+  assert(m.fields[4].heap == sizeof(Vec3));
+  assert(m.fields[5].heap == 10 * sizeof(int));
+  assert(m.fields[6].heap >= 2 * sizeof(pair<const int, string>) + 1001);
+  assert(m.fields[7].heap == 0);
+  size_t sum = 0;
+  for (auto& f : m.fields)
+    sum += f.heap;
+  assert(m.heap == sum && m.total() == m.shallow + sum);
+  vector<pair<int, string>> pairs{{1, string(30, 'p')}};
+  assert(heap_bytes(pairs) == sizeof(pairs[0]) + 31);
+
+  MeshAsset mesh;
+  mesh.vertices.resize(100);
+  SoundAsset sound;
+  sound.clip = string(40, 'c');
+  vector<Asset*> assets{&mesh, &sound, &sound, nullptr};
+  auto byType = memory_by_type<Asset>(assets);
+  assert(byType.size() == 3 && byType[1].name == "MeshAsset");
+  assert(byType[0].count == 0 && byType[1].count == 1);
+  assert(byType[1].heap == 100 * sizeof(float));
+  assert(byType[2].count == 2 && byType[2].shallow == 2 * sizeof(SoundAsset));
+  assert(byType[2].heap == 2 * 41);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// format
+
+struct FormatItem {
+  TrefType(FormatItem);
+
+  int id = 7;
+  TrefField(id);
+
+  EnumA kind = EnumA::Ban;
+  TrefField(kind);
+
+  Vec3 pos;
+  TrefField(pos);
+
+  vector<string> tags{"a", "b\"c"};
+  TrefField(tags);
+
+  optional<double> weight;
+  TrefField(weight);
+
+  bool on = true;
+  TrefField(on);
+};
+
+void TestFormat() {
+  FormatItem item;
+  item.pos.x = 1.5f;
+  item.pos.y = -2;
+
+  char buf[256];
+  auto s = format_to(buf, item);
+  assert(s ==
+         "{id: 7, kind: Ban, pos: {x: 1.5, y: -2, z: 0}, tags: [\"a\", "
+         "\"b\\\"c\"], weight: null, on: true}");
+
+  item.weight = 0.25;
+  item.tags.clear();
+  s = format_to(buf, item, FormatMode::Indented);
+  assert(s ==
+         "{\n  id: 7,\n  kind: Ban,\n  pos: {\n    x: 1.5,\n    y: -2,\n"
+         "    z: 0\n  },\n  tags: [],\n  weight: 0.25,\n  on: true\n}");
+
+  vector<Vec3> points(2);
+  assert(format_to(buf, points, FormatMode::Indented) ==
+         "[\n  {\n    x: 0,\n    y: 0,\n    z: 0\n  },\n  {\n    x: 0,\n"
+         "    y: 0,\n    z: 0\n  }\n]");
+
+  item.kind = static_cast<EnumA>(5);
+  char small[20];
+  auto r = format_to(small, small + sizeof(small), item);
+  assert(r.ec == errc::value_too_large && r.ptr == small + sizeof(small));
+  assert(string_view(small, sizeof(small)) == "{id: 7, kind: 5, pos");
+
+  // truncated in the middle of a number.
+  char tiny[10];
+  memset(tiny, '#', sizeof(tiny));
+  item.id = 123456789;
+  r = format_to(tiny, tiny + sizeof(tiny), item);
+  assert(r.ec == errc::value_too_large && r.ptr == tiny + sizeof(tiny));
+  assert(string_view(tiny, sizeof(tiny)) == "{id: 12345");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// config
+
+struct ConfigLimits {
+  TrefType(ConfigLimits);
+
+  int conns = 10;
+  TrefField(conns);
+
+  double rate = 1;
+  TrefField(rate);
+};
+
+struct ServerConfig {
+  TrefType(ServerConfig);
+
+  string_view host = "localhost";
+  TrefField(host);
+
+  unsigned short port = 80;
+  TrefField(port);
+
+  bool verbose = false;
+  TrefField(verbose);
+
+  EnumA mode = EnumA::Ass;
+  TrefField(mode);
+
+  array<int, 3> weights{};
+  TrefField(weights);
+
+  ConfigLimits limits;
+  TrefField(limits);
+};
+
+constexpr auto jsonConfig = config::json<ServerConfig>(R"({
+  "host": "example.com",
+  "port": 8080,
+  "mode": "Ban",
+  "weights": [1, -2, 3],
+  "limits": {"conns": 100, "rate": 2.5e-1}
+})");
+static_assert(jsonConfig.host == "example.com" && jsonConfig.port == 8080);
+static_assert(!jsonConfig.verbose && jsonConfig.mode == EnumA::Ban);
+static_assert(jsonConfig.weights[1] == -2);
+static_assert(jsonConfig.limits.conns == 100 &&
+              jsonConfig.limits.rate == 0.25);
+
+constexpr auto iniConfig = config::ini<ServerConfig>(R"(
+; comment
+host = example.com
+verbose = true
+
+[limits]
+rate = -1.5
+)");
+static_assert(iniConfig.host == "example.com" && iniConfig.port == 80);
+static_assert(iniConfig.verbose && iniConfig.limits.conns == 10);
+static_assert(iniConfig.limits.rate == -1.5);
+
+static_assert(config::parse_json<ServerConfig>(R"({"prot": 1})").error ==
+              ConfigError::UnknownKey);
+static_assert(config::parse_json<ServerConfig>(R"({"port": 70000})").error ==
+              ConfigError::OutOfRange);
+static_assert(config::parse_json<ServerConfig>(R"({"port": "80"})").error ==
+              ConfigError::TypeMismatch);
+static_assert(config::parse_json<ServerConfig>(R"({"weights": [1]})").error ==
+              ConfigError::ArraySize);
+static_assert(config::parse_json<ServerConfig>(R"({"mode": "Nope"})").error ==
+              ConfigError::OutOfRange);
+static_assert(config::parse_json<ServerConfig>(R"({"port": 1,})").error ==
+              ConfigError::Syntax);
+static_assert(config::parse_ini<ServerConfig>("[limits]\nconns = x").pos ==
+              17);
+static_assert(config::parse_ini<ServerConfig>("[limit]\nconns = 1").error ==
+              ConfigError::UnknownKey);
+static_assert(config::parse_ini<ServerConfig>("port.x = 1").error ==
+              ConfigError::TypeMismatch);
+
+void TestConfig() {
+  // The same parsing at runtime.
+  string text = R"({"port": 443, "limits": {"conns": -7, "rate": 1e3}})";
+  auto   r = config::parse_json<ServerConfig>(text);
+  assert(r && r.value.port == 443 && r.value.host == "localhost");
+  assert(r.value.limits.conns == -7 && r.value.limits.rate == 1000);
+
+  r = config::parse_json<ServerConfig>(R"({"limits": {"conns": 1e3}})");
+  assert(!r && r.error == ConfigError::TypeMismatch && r.pos == 21);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// compact
+
+void TestCompact() {
+  using Names = vector<pair<string_view, int>>;
+  Names expected, got;
+  class_info<SubChild>().each_field([&](auto info, int level) {
+    if constexpr (decltype(info)::is_data_member_v)
+      expected.push_back({info.name, level});
+    return true;
+  });
+  auto& sub = type_desc<SubChild>();
+  sub.each_field([&](const FieldDesc& f, int level) {
+    got.push_back({f.name, level});
+    return true;
+  });
+  assert(got == expected && got.size() == 8);
+
+  expected.clear();
+  got.clear();
+  class_info<Base>().each_subclass([&](auto info, int level) {
+    expected.push_back({info.name, level});
+    return true;
+  });
+  type_desc<Base>().each_subclass([&](const TypeDesc& t, int level) {
+    got.push_back({t.name, level});
+    return true;
+  });
+  assert(got == expected && !got.empty());
+  assert(type_desc<Base>().is_base_of(sub));
+  assert(!sub.is_base_of(type_desc<Base>()));
+
+  SubChild obj;
+  obj.zz = 3;
+  auto zz = sub.find_field("zz");
+  assert(zz && zz->kind == FieldKind::Float && zz->size == sizeof(float));
+  assert(*static_cast<float*>(zz->get(&obj)) == 3);
+  auto baseVal = sub.find_field("baseVal");
+  assert(baseVal && baseVal->kind == FieldKind::Int);
+  *static_cast<int*>(baseVal->get(&obj)) = 5;
+  assert(obj.baseVal == 5 && !sub.find_field("none"));
+
+  // the base is not at offset 0 of the subclass adding a vptr.
+  FactoryVirtual fv;
+  fv.b = 7;
+  auto& vd = type_desc<FactoryVirtual>();
+  auto  b = vd.find_field("b");
+  assert(b && *static_cast<int*>(b->get(&fv)) == 7);
+  vd.each_field([&](const FieldDesc& f, int level) {
+    assert(level == 1 || f.name == "s");
+    if (level == 1)
+      assert(*static_cast<const int*>(f.get(&as_const(fv))) == 7);
+    return true;
+  });
+
+  auto pos = type_desc<Motion>().find_field("pos");
+  assert(pos && pos->kind == FieldKind::Object);
+  assert(pos->type == &type_desc<Vec3>() && pos->type->fields.size() == 3);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ecs
+
+struct EcsPos {
+  TrefType(EcsPos);
+
+  float x = 0, y = 0;
+  TrefField(x);
+  TrefField(y);
+};
+
+struct EcsVel {
+  TrefType(EcsVel);
+
+  float dx = 1, dy = 2;
+  TrefField(dx);
+  TrefField(dy);
+};
+
+struct EcsName {
+  TrefType(EcsName);
+
+  string name;
+  TrefField(name);
+};
+
+struct EcsFrozen {
+  TrefType(EcsFrozen);
+};
+
+struct EcsBody {
+  TrefType(EcsBody);
+
+  float mass = 0;
+  TrefField(mass);
+};
+
+// the inherited field is not at offset 0 because of the vptr.
+struct EcsRigid : EcsBody {
+  TrefType(EcsRigid);
+  virtual ~EcsRigid() = default;
+
+  float drag = 0;
+  TrefField(drag);
+};
+
+void TestEcs() {
+  EcsWorld          world;
+  vector<EcsEntity> es;
+  for (int i = 0; i < 1000; i++) {
+    es.push_back(world.create(EcsPos{static_cast<float>(i), 0}, EcsVel{}));
+    if (i % 10 == 1)
+      world.add(es.back(), EcsName{"entity " + to_string(i)});
+  }
+  assert(world.size() == 1000 && world.archetype_count() == 3);
+  assert((world.count<EcsPos, EcsVel>() == 1000));
+  assert(world.count<EcsName>() == 100);
+
+  size_t chunks = 0;
+  world.each_chunk<EcsPos, EcsVel>([&](EcsChunk& c) {
+    assert(c.size() <= ecs_chunk_bytes / (sizeof(EcsEntity) + 16));
+    chunks++;
+  });
+  assert(chunks == 3);
+
+  world.par_each_chunk<EcsPos, EcsVel>(
+      [](EcsChunk& c) {
+        auto x = c.column<&EcsPos::x>();
+        auto y = c.column<&EcsPos::y>();
+        auto dx = c.column<&EcsVel::dx>();
+        auto dy = c.column<&EcsVel::dy>();
+        for (size_t i = 0; i < c.size(); i++) {
+          x[i] += dx[i];
+          y[i] += dy[i];
+        }
+      },
+      4);
+  auto p = world.get<EcsPos>(es[501]);
+  assert(p.x == 502 && p.y == 2);
+  assert(world.get<EcsName>(es[501]).name == "entity 501");
+
+  // Moves between archetypes keep the values.
+  world.add(es[7], EcsFrozen{}, EcsName{"seven"});
+  assert(world.has<EcsFrozen>(es[7]) && world.archetype_count() == 4);
+  world.remove<EcsVel>(es[7]);
+  assert(!world.has<EcsVel>(es[7]) && world.get<EcsPos>(es[7]).x == 8);
+  assert(world.get<EcsName>(es[7]).name == "seven");
+  world.field<&EcsPos::y>(es[7]) = 42;
+  assert(world.get<EcsPos>(es[7]).y == 42);
+  world.add(es[7], EcsName{"renamed"});
+  assert(world.get<EcsName>(es[7]).name == "renamed");
+
+  // Destroying fills the holes with the last rows.
+  for (size_t i = 0; i < es.size(); i += 2)
+    world.destroy(es[i]);
+  assert(!world.alive(es[0]) && world.alive(es[1]) && world.size() == 500);
+  for (size_t i = 1; i < es.size(); i += 2) {
+    assert(world.get<EcsPos>(es[i]).x == i + 1);
+    if (i % 10 == 1)
+      assert(world.get<EcsName>(es[i]).name == "entity " + to_string(i));
+  }
+  auto reused = world.create(EcsPos{});
+  assert(reused.index == es[998].index && reused != es[998]);
+  assert(world.count<EcsPos>() == 501);
+
+  EcsRigid rigid;
+  rigid.mass = 3;
+  rigid.drag = 4;
+  auto body = world.create(rigid);
+  assert(world.get<EcsRigid>(body).mass == 3);
+  assert(world.get<EcsRigid>(body).drag == 4);
+  assert((world.field<&EcsRigid::mass, EcsRigid>(body) == 3));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// clone
+
+struct CloneShape {
+  TrefType(CloneShape);
+  virtual ~CloneShape() = default;
+
+  int id = 0;
+  TrefField(id);
+};
+
+struct CloneCircle : CloneShape {
+  TrefType(CloneCircle);
+
+  float radius = 1;
+  TrefField(radius);
+};
+TrefSubType(CloneCircle);
+
+struct CloneGroup : CloneShape {
+  TrefType(CloneGroup);
+
+  string                         label;
+  float                          matrix[4] = {};
+  vector<unique_ptr<CloneShape>> children;
+  unique_ptr<CloneCircle>        bounds;
+  TrefField(label);
+  TrefField(matrix);
+  TrefField(children);
+  TrefField(bounds);
+};
+TrefSubType(CloneGroup);
+
+void TestClone() {
+  CloneGroup g;
+  g.id = 1;
+  g.label = "root";
+  g.matrix[3] = 4;
+  g.bounds = make_unique<CloneCircle>();
+  g.bounds->radius = 10;
+  auto c = make_unique<CloneCircle>();
+  c->id = 2;
+  c->radius = 3;
+  g.children.push_back(move(c));
+  auto sub = make_unique<CloneGroup>();
+  sub->id = 3;
+  sub->children.push_back(make_unique<CloneShape>());
+  g.children.push_back(move(sub));
+
+  const CloneShape& shape = g;
+  auto              r = clone(shape);
+  auto              rg = dynamic_cast<CloneGroup*>(r.get());
+  assert(rg && rg->id == 1 && rg->label == "root" && rg->matrix[3] == 4);
+  assert(rg->bounds && rg->bounds != g.bounds && rg->bounds->radius == 10);
+  assert(rg->children.size() == 2 && rg->children[0] != g.children[0]);
+  auto rc = dynamic_cast<CloneCircle*>(rg->children[0].get());
+  assert(rc && rc->id == 2 && rc->radius == 3);
+  auto rs = dynamic_cast<CloneGroup*>(rg->children[1].get());
+  assert(rs && rs->id == 3 && rs->children.size() == 1 && !rs->bounds);
+
+  // Copyable classes are cloned by the copy constructor.
+  CloneCircle circle;
+  circle.radius = 5;
+  auto rcircle = clone(static_cast<const CloneShape&>(circle));
+  assert(dynamic_cast<CloneCircle*>(rcircle.get())->radius == 5);
+
+  Arena arena;
+  auto  a = clone(shape, arena);
+  assert(arena.capacity() > 0);
+  assert(static_cast<CloneGroup*>(a)->children.size() == 2);
+  arena.reset();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// enum map
+
+TrefEnum(EmColor, Red, Green, Blue);
+TrefEnum(EmLevel, Low = 10, High = 12, Mid = 11, Default = 10);
+TrefEnum(EmStatus, Ok = 0, NotFound = 404, Timeout = 408, Internal = 500);
+
+static_assert(EnumIndex<EmColor>::identity);
+static_assert(EnumIndex<EmLevel>::ranged && EnumIndex<EmLevel>::has_alias);
+static_assert(!EnumIndex<EmStatus>::ranged && !EnumIndex<EmStatus>::identity);
+static_assert(enum_slot(EmLevel::Mid) == 2 && enum_slot(EmLevel::Default) == 0);
+static_assert(enum_slot(EmStatus::Timeout) == 2);
+static_assert(enum_slot(static_cast<EmStatus>(405)) ==
+              EnumIndex<EmStatus>::npos);
+static_assert(enum_set<EmColor>{EmColor::Red, EmColor::Blue}.size() == 2);
+static_assert(!enum_set<EmLevel>{EmLevel::Low}.contains(EmLevel::High));
+static_assert(enum_set<EmLevel>::all().size() == 3);
+static_assert(enum_map<EmStatus, int>::size() == 4);
+static_assert([] {
+  enum_map<EmStatus, int> m;
+  m[EmStatus::Internal] += 2;
+  m[EmStatus::Ok]++;
+  return m[EmStatus::Internal] == 2 && m[EmStatus::Ok] == 1 &&
+         !m.find(static_cast<EmStatus>(1));
+}());
+
+void TestEnumMap() {
+  enum_map<EmStatus, int> counts;
+  for (int i = 0; i < 100; i++)
+    counts[i % 3 ? EmStatus::Ok : EmStatus::Timeout]++;
+  string keys;
+  for (auto e : counts)
+    keys += string(e.name) + "=" + to_string(e.value) + " ";
+  assert(keys == "Ok=66 NotFound=0 Timeout=34 Internal=0 ");
+  counts.each([](EmStatus, string_view, int& v) {
+    v = 0;
+    return true;
+  });
+  assert((counts == enum_map<EmStatus, int>{}));
+
+  // The slot of an alias is not iterated.
+  enum_map<EmLevel, string> levels{"x"};
+  levels[EmLevel::Default] = "low";
+  size_t n = 0;
+  for (auto e : levels) {
+    assert(e.name != "Default");
+    n++;
+  }
+  assert(n == 3 && levels[EmLevel::Low] == "low");
+
+  enum_set<EmStatus> s{EmStatus::Internal, EmStatus::Ok};
+  s.insert(EmStatus::NotFound);
+  assert(!s.insert(static_cast<EmStatus>(1)));
+  vector<EmStatus> items(s.begin(), s.end());
+  assert((items == vector{EmStatus::Ok, EmStatus::NotFound,
+                          EmStatus::Internal}));
+  assert(s.erase(EmStatus::Ok) && !s.erase(EmStatus::Ok));
+  assert((s & enum_set<EmStatus>{EmStatus::Internal}).size() == 1);
+  assert((enum_set<EmStatus>::all() - s).size() == 2);
+}
+
 void TrefTest() {
   TestEnum();
   dumpTree<Base>();
   dumpDetails<Child2>();
   MetaExportedClass::dumpAll<Base>();
   TestHookable();
+  TestFactory();
+  TestRegistry();
+  TestSoaVector();
+  TestBatch();
+  TestHash();
+  TestCompare();
+  TestSort();
+  TestTable();
+  TestFilter();
+  TestValidate();
+  TestArrow();
+  TestLog();
+  TestCsv();
+  TestLoader();
+  TestInvoke();
+  TestTrace();
+  TestLayout();
+  TestMemory();
+  TestFormat();
+  TestConfig();
+  TestCompact();
+  TestEcs();
+  TestClone();
+  TestEnumMap();
 }
@@ -0,0 +1,319 @@
+// Tref: tracing of reflected member function calls in Chrome trace format.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_TRACE_H
+#define TREF_TRACE_H
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Tref.hpp"
+
+// Define TREF_TRACE before including this header to enable the tracing,
+// otherwise trace_call is a plain call.
+
+namespace tref {
+namespace imp {
+
+// Field meta: trace the calls of the member function made by trace_call.
+struct MetaTraced {};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// buffers
+//
+//////////////////////////////////////////////////////////////////////////
+
+// events kept per thread, the oldest ones are overwritten when full.
+constexpr size_t trace_buffer_events = 1 << 14;
+
+struct TraceEvent {
+  uint32_t name;
+  uint64_t begin;  // ns since the tracer started.
+  uint64_t end;
+};
+
+// Slot of the ring, read by the flush while its thread may overwrite it.
+// seq is 2 * i + 1 while the i-th event is written and 2 * i + 2 once done,
+// so a reader can tell a torn or newer event apart(seqlock).
+struct TraceSlot {
+  atomic<uint64_t> seq{0};
+  atomic<uint32_t> name{0};
+  atomic<uint64_t> begin{0};
+  atomic<uint64_t> end{0};
+};
+
+// Single producer ring buffer, written by its thread only.
+struct TraceBuffer {
+  array<TraceSlot, trace_buffer_events> slots;
+  atomic<uint64_t>                      head{0};
+  uint64_t                              read = 0;  // by the flush.
+  uint32_t                              tid;
+
+  void push(const TraceEvent& e) {
+    auto  h = head.load(memory_order_relaxed);
+    auto& s = slots[h % trace_buffer_events];
+    s.seq.store(2 * h + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s.name.store(e.name, memory_order_relaxed);
+    s.begin.store(e.begin, memory_order_relaxed);
+    s.end.store(e.end, memory_order_relaxed);
+    s.seq.store(2 * h + 2, memory_order_release);
+    head.store(h + 1, memory_order_release);
+  }
+
+  // Copy the i-th event.
+  // @return false if it is being or has been overwritten.
+  bool load(uint64_t i, TraceEvent& e) const {
+    auto& s = slots[i % trace_buffer_events];
+    auto  seq = s.seq.load(memory_order_acquire);
+    if (seq != 2 * i + 2)
+      return false;
+    e.name = s.name.load(memory_order_relaxed);
+    e.begin = s.begin.load(memory_order_relaxed);
+    e.end = s.end.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return s.seq.load(memory_order_relaxed) == seq;
+  }
+};
+
+// Returns the buffer of the thread to the tracer when the thread exits.
+struct TraceLease {
+  TraceBuffer* buf = nullptr;
+
+  ~TraceLease();
+};
+
+// Buffers of the exited threads are reused by the new threads, so their
+// count is the peak of the threads tracing at the same time.
+class Tracer {
+ public:
+  static Tracer& get() {
+    static Tracer t;
+    return t;
+  }
+
+  uint64_t now() const {
+    return static_cast<uint64_t>(
+        chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start_)
+            .count());
+  }
+
+  TraceBuffer& buffer() {
+    thread_local TraceLease lease;
+    if (!lease.buf)
+      lease.buf = acquire();
+    return *lease.buf;
+  }
+
+  // The events not flushed yet are kept, the next thread taking the buffer
+  // writes after them under the same tid.
+  void release(TraceBuffer* buf) {
+    lock_guard<mutex> lock{mutex_};
+    free_.push_back(buf);
+  }
+
+  size_t buffer_count() {
+    lock_guard<mutex> lock{mutex_};
+    return buffers_.size();
+  }
+
+  uint32_t add_name(string name) {
+    lock_guard<mutex> lock{mutex_};
+    names_.push_back(move(name));
+    return static_cast<uint32_t>(names_.size() - 1);
+  }
+
+  // Write the events recorded since the last flush as Chrome trace JSON,
+  // which can be opened by chrome://tracing or Perfetto.
+  // Events overwritten while being flushed are dropped.
+  size_t flush(ostream& out) {
+    lock_guard<mutex> lock{mutex_};
+    size_t            n = 0;
+    out << "{\"traceEvents\":[";
+    for (auto& b : buffers_) {
+      auto h = b->head.load(memory_order_acquire);
+      auto from = max(b->read, h > trace_buffer_events
+                                   ? h - trace_buffer_events
+                                   : uint64_t{0});
+      for (auto i = from; i < h; i++) {
+        TraceEvent e;
+        if (!b->load(i, e))
+          continue;
+        char ts[64];
+        snprintf(ts, sizeof(ts), "\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+                 static_cast<unsigned long long>(e.begin / 1000),
+                 static_cast<unsigned>(e.begin % 1000),
+                 static_cast<unsigned long long>((e.end - e.begin) / 1000),
+                 static_cast<unsigned>((e.end - e.begin) % 1000));
+        out << (n++ ? ",\n" : "\n") << "{\"name\":\"" << names_[e.name]
+            << "\",\"cat\":\"tref\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+            << "," << ts << "}";
+      }
+      b->read = h;
+    }
+    out << "\n]}\n";
+    return n;
+  }
+
+ private:
+  Tracer() : start_{chrono::steady_clock::now()} {}
+
+  TraceBuffer* acquire() {
+    lock_guard<mutex> lock{mutex_};
+    if (!free_.empty()) {
+      auto buf = free_.back();
+      free_.pop_back();
+      return buf;
+    }
+    buffers_.push_back(make_unique<TraceBuffer>());
+    auto buf = buffers_.back().get();
+    buf->tid = static_cast<uint32_t>(buffers_.size());
+    return buf;
+  }
+
+  chrono::steady_clock::time_point start_;
+  mutex                            mutex_;
+  vector<unique_ptr<TraceBuffer>>  buffers_;
+  vector<string>                   names_;
+  vector<TraceBuffer*>             free_;
+};
+
+inline TraceLease::~TraceLease() {
+  if (buf)
+    Tracer::get().release(buf);
+}
+
+// Record the duration of the scope.
+class TraceScope {
+ public:
+  explicit TraceScope(uint32_t name)
+      : buf_{Tracer::get().buffer()},
+        name_{name},
+        begin_{Tracer::get().now()} {}
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+  ~TraceScope() { buf_.push({name_, begin_, Tracer::get().now()}); }
+
+ private:
+  TraceBuffer& buf_;
+  uint32_t     name_;
+  uint64_t     begin_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// calls
+//
+//////////////////////////////////////////////////////////////////////////
+
+struct TracedFunc {
+  bool        traced;
+  string_view name;
+};
+
+// Name & meta of the reflected member function.
+template <auto Ptr>
+constexpr TracedFunc traced_func_info() {
+  using C = enclosing_class_t<decltype(Ptr)>;
+  TracedFunc r{false, {}};
+  class_info<C>().each_field([&](auto info, int) {
+    if constexpr (is_same_v<decltype(info.value), decltype(Ptr)>) {
+      if (info.value == Ptr) {
+        r.traced = is_base_of_v<MetaTraced, decltype(info.meta)>;
+        r.name = info.name;
+        return false;
+      }
+    }
+    return true;
+  });
+  return r;
+}
+
+template <auto Ptr>
+constexpr auto is_traced_v = traced_func_info<Ptr>().traced;
+
+template <auto Ptr>
+uint32_t trace_name_id() {
+  using C = enclosing_class_t<decltype(Ptr)>;
+  static const auto id = Tracer::get().add_name(
+      string{class_info<C>().name} + "::" +
+      string{traced_func_info<Ptr>().name});
+  return id;
+}
+
+// The enabled & disabled variants live in different inline namespaces, so
+// translation units disagreeing on TREF_TRACE do not break the ODR.
+#ifdef TREF_TRACE
+inline namespace trace_on {
+constexpr bool trace_enabled = true;
+#else
+inline namespace trace_off {
+constexpr bool trace_enabled = false;
+#endif
+
+// Call the member function, the call is recorded if the function is reflected
+// with MetaTraced and TREF_TRACE is defined.
+template <auto Ptr, typename C, typename... A>
+decltype(auto) trace_call(C&& obj, A&&... args) {
+  if constexpr (trace_enabled && is_traced_v<Ptr>) {
+    TraceScope scope{trace_name_id<Ptr>()};
+    return (forward<C>(obj).*Ptr)(forward<A>(args)...);
+  } else {
+    return (forward<C>(obj).*Ptr)(forward<A>(args)...);
+  }
+}
+
+}  // namespace trace_on/trace_off
+
+// Write the recorded calls of all the threads as Chrome trace JSON.
+// @return count of the events written.
+inline size_t flush_trace(ostream& out) {
+  return Tracer::get().flush(out);
+}
+
+// Count of the per-thread buffers allocated so far.
+inline size_t trace_buffer_count() {
+  return Tracer::get().buffer_count();
+}
+
+}  // namespace imp
+
+using imp::flush_trace;
+using imp::is_traced_v;
+using imp::MetaTraced;
+using imp::trace_buffer_count;
+using imp::trace_buffer_events;
+using imp::trace_call;
+
+}  // namespace tref
+#endif
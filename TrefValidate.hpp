@@ -0,0 +1,273 @@
+// Tref: batch validation of reflected objects by field metas.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_VALIDATE_H
+#define TREF_VALIDATE_H
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Tref.hpp"
+#include "TrefBatch.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// rules
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field meta: the field(string or container) must not be empty.
+struct MetaNonEmpty {};
+
+// Field meta: custom check of the field value, any meta with a validate
+// member callable with the field value is accepted as well.
+template <typename M>
+struct MetaValidator {
+  bool (*validate)(const M& v);
+};
+
+// Combine the metas, e.g.
+//   TrefFieldWithMeta(name, (Metas{MetaNonEmpty{}, MetaValidator<string>{f}}));
+
+enum class ValidationKind { Range, NonEmpty, Custom };
+
+struct ValidationRule {
+  string_view    field;
+  ValidationKind kind;
+};
+
+template <typename Meta, typename M, typename = void>
+struct has_validate_meta : false_type {};
+
+template <typename Meta, typename M>
+struct has_validate_meta<
+    Meta,
+    M,
+    void_t<decltype(bool(declval<const Meta&>().validate(
+        declval<const M&>())))>>
+    : true_type {};
+
+template <typename F>
+constexpr auto is_range_rule_v =
+    is_arithmetic_v<typename F::member_t> &&
+    has_range_meta<decltype(declval<F>().meta)>::value;
+
+template <typename F>
+constexpr auto is_non_empty_rule_v =
+    is_base_of_v<MetaNonEmpty, decltype(declval<F>().meta)>;
+
+template <typename F>
+constexpr auto is_custom_rule_v =
+    has_validate_meta<decltype(declval<F>().meta),
+                      typename F::member_t>::value;
+
+template <typename F>
+constexpr size_t rule_count_v = is_range_rule_v<F> + is_non_empty_rule_v<F> +
+                                is_custom_rule_v<F>;
+
+template <typename T, size_t... Is>
+constexpr auto make_rules(index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  constexpr auto n = (rule_count_v<tuple_element_t<Is, decltype(fields)>> +
+                      ... + 0);
+  array<ValidationRule, n> rules{};
+  size_t                   i = 0;
+  auto                     add = [&](auto f) {
+    using F = decltype(f);
+    if constexpr (is_range_rule_v<F>)
+      rules[i++] = {f.name, ValidationKind::Range};
+    if constexpr (is_non_empty_rule_v<F>)
+      rules[i++] = {f.name, ValidationKind::NonEmpty};
+    if constexpr (is_custom_rule_v<F>)
+      rules[i++] = {f.name, ValidationKind::Custom};
+  };
+  (add(get<Is>(fields)), ...);
+  return rules;
+}
+
+// Rules of the data fields of T, in the order of the error bits.
+template <typename T>
+constexpr auto validation_rules() {
+  constexpr auto n = tuple_size_v<decltype(data_fields<T>())>;
+  return make_rules<T>(make_index_sequence<n>{});
+}
+
+template <size_t N>
+using validation_mask_for_t =
+    conditional_t<(N <= 8),
+                  uint8_t,
+                  conditional_t<(N <= 16),
+                                uint16_t,
+                                conditional_t<(N <= 32), uint32_t, uint64_t>>>;
+
+// Error bits of a row, bit i is set if the rule i failed.
+template <typename T>
+using validation_mask_t =
+    validation_mask_for_t<validation_rules<T>().size()>;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// kernels
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Check the rules of field I for n rows, one rule at a time in a branch free
+// loop.
+template <typename T, size_t I, size_t Bit, typename Mask>
+void validate_field(const T* rows, size_t n, Mask* out) {
+  constexpr auto f = get<I>(data_fields<T>());
+  using F = decltype(f);
+  using M = typename F::member_t;
+  constexpr auto ptr = f.value;
+  auto           bit = Bit;
+
+  if constexpr (is_range_rule_v<F>) {
+    auto lo = static_cast<M>(f.meta.minV);
+    auto hi = static_cast<M>(f.meta.maxV);
+    for (size_t i = 0; i < n; i++) {
+      auto& v = rows[i].*ptr;
+      out[i] |= static_cast<Mask>(!((lo <= v) & (v <= hi))) << bit;
+    }
+    bit++;
+  }
+  if constexpr (is_non_empty_rule_v<F>) {
+    for (size_t i = 0; i < n; i++)
+      out[i] |= static_cast<Mask>((rows[i].*ptr).empty()) << bit;
+    bit++;
+  }
+  if constexpr (is_custom_rule_v<F>) {
+    for (size_t i = 0; i < n; i++)
+      out[i] |= static_cast<Mask>(!f.meta.validate(rows[i].*ptr)) << bit;
+  }
+}
+
+template <typename T, size_t... Is>
+constexpr auto rule_offsets(index_sequence<Is...>) {
+  constexpr auto fields = data_fields<T>();
+  array<size_t, sizeof...(Is) + 1> r{};
+  size_t                           i = 0;
+  ((r[i + 1] = r[i] + rule_count_v<tuple_element_t<Is, decltype(fields)>>,
+    i++),
+   ...);
+  return r;
+}
+
+template <typename T, typename Mask, size_t... Is>
+void validate_rows(const T* rows, size_t n, Mask* out, index_sequence<Is...>) {
+  constexpr auto offsets = rule_offsets<T>(index_sequence<Is...>{});
+  (validate_field<T, Is, offsets[Is]>(rows, n, out), ...);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// validate
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct ValidationResult {
+  using Mask = validation_mask_t<T>;
+  static constexpr auto rules = validation_rules<T>();
+
+  vector<Mask> errors;       // per row.
+  size_t       invalid = 0;  // count of rows with errors.
+
+  bool ok() const { return invalid == 0; }
+
+  // @param f: [](size_t row, const ValidationRule& rule)
+  template <typename F>
+  void each_error(F&& f) const {
+    for (size_t i = 0; i < errors.size(); i++) {
+      for (size_t r = 0; r < rules.size(); r++) {
+        if ((errors[i] >> r) & 1)
+          f(i, rules[r]);
+      }
+    }
+  }
+};
+
+// rows per task, the error masks of a task stay in cache among the fields.
+constexpr size_t validate_chunk_rows = 4096;
+
+// Check the range, non-empty & custom rules of the fields for all the rows,
+// the rows are split into chunks validated by multiple threads.
+// NOTE: custom validators should be thread safe.
+// @param rows: contiguous container of reflected objects, e.g. vector & Span.
+// @param threads: 0 for the count of hardware threads.
+template <typename C>
+auto validate(const C& rows, unsigned threads = 0) {
+  using T = remove_const_t<remove_pointer_t<decltype(rows.data())>>;
+  static_assert(validation_rules<T>().size() <= 64, "too many rules");
+  constexpr auto fields = tuple_size_v<decltype(data_fields<T>())>;
+
+  ValidationResult<T> r;
+  auto                n = rows.size();
+  r.errors.resize(n);
+  if constexpr (validation_rules<T>().size() > 0) {
+    auto chunks = (n + validate_chunk_rows - 1) / validate_chunk_rows;
+    if (!threads)
+      threads = max(thread::hardware_concurrency(), 1u);
+    threads = static_cast<unsigned>(min<size_t>(threads, chunks));
+
+    atomic<size_t> next{0}, invalid{0};
+    auto           work = [&] {
+      size_t bad = 0;
+      for (size_t c; (c = next.fetch_add(1)) < chunks;) {
+        auto b = c * validate_chunk_rows;
+        auto m = min(validate_chunk_rows, n - b);
+        validate_rows(rows.data() + b, m, r.errors.data() + b,
+                      make_index_sequence<fields>{});
+        for (size_t i = b; i < b + m; i++)
+          bad += r.errors[i] != 0;
+      }
+      invalid.fetch_add(bad);
+    };
+
+    vector<thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+      pool.emplace_back(work);
+    work();
+    for (auto& t : pool)
+      t.join();
+    r.invalid = invalid.load();
+  }
+  return r;
+}
+
+}  // namespace imp
+
+using imp::MetaNonEmpty;
+using imp::MetaValidator;
+using imp::validate;
+using imp::validation_rules;
+using imp::ValidationKind;
+using imp::ValidationResult;
+using imp::ValidationRule;
+
+}  // namespace tref
+#endif
@@ -0,0 +1,462 @@
+// Tref: value semantics generated from the reflected fields.
+
+/***********************************************************************
+Copyright 2019-2020 crazybie<soniced@sina.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef TREF_VALUE_H
+#define TREF_VALUE_H
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "Tref.hpp"
+
+namespace tref {
+namespace imp {
+
+//////////////////////////////////////////////////////////////////////////
+//
+// type traits
+//
+//////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename = void>
+struct is_range : false_type {};
+
+template <typename T>
+struct is_range<T,
+                void_t<decltype(std::begin(declval<const T&>())),
+                       decltype(std::end(declval<const T&>()))>>
+    : true_type {};
+
+template <typename T, typename = void>
+struct is_contiguous_range : false_type {};
+
+template <typename T>
+struct is_contiguous_range<T,
+                           void_t<decltype(declval<const T&>().data()),
+                                  decltype(declval<const T&>().size())>>
+    : is_range<T> {};
+
+// Contiguous range of memory blocks, e.g. string, vector<int>.
+template <typename T, typename = void>
+struct is_block_range : false_type {};
+
+template <typename T>
+struct is_block_range<T, enable_if_t<is_contiguous_range<T>::value>>
+    : bool_constant<has_unique_object_representations_v<
+          remove_cv_t<remove_reference_t<decltype(*declval<T&>().data())>>>> {
+};
+
+template <typename T, typename = void>
+struct is_unordered_range : false_type {};
+
+template <typename T>
+struct is_unordered_range<T, void_t<typename T::hasher>> : is_range<T> {};
+
+template <typename T>
+struct is_pair : false_type {};
+
+template <typename A, typename B>
+struct is_pair<pair<A, B>> : true_type {};
+
+template <typename T>
+struct is_optional : false_type {};
+
+template <typename T>
+struct is_optional<optional<T>> : true_type {};
+
+// Types can be processed as raw bytes: trivially copyable without padding.
+template <typename T>
+constexpr auto is_memory_block_v = has_unique_object_representations_v<T>;
+
+// The memory block type or its nested reflected types have fields whose meta
+// derives from Skip.
+template <typename T, typename Skip>
+constexpr bool has_skipped_fields() {
+  if constexpr (is_array_v<T>) {
+    return has_skipped_fields<remove_all_extents_t<T>, Skip>();
+  } else if constexpr (is_reflected_v<T>) {
+    return apply(
+        [](auto... fs) {
+          return ((is_base_of_v<Skip, decltype(fs.meta)> ||
+                   has_skipped_fields<typename decltype(fs)::member_t,
+                                      Skip>()) ||
+                  ... || false);
+        },
+        data_fields<T>());
+  } else {
+    return false;
+  }
+}
+
+// Memory block without skipped fields inside.
+template <typename T, typename Skip>
+constexpr bool is_value_block() {
+  if constexpr (is_memory_block_v<T>)
+    return !has_skipped_fields<T, Skip>();
+  else
+    return false;
+}
+
+// Contiguous range of memory blocks without skipped fields inside.
+template <typename T, typename Skip>
+constexpr bool is_value_block_range() {
+  if constexpr (is_block_range<T>::value) {
+    using E = remove_cv_t<remove_reference_t<decltype(*declval<T&>().data())>>;
+    return !has_skipped_fields<E, Skip>();
+  } else {
+    return false;
+  }
+}
+
+template <typename T>
+constexpr size_t data_field_count_v =
+    tuple_size_v<decltype(data_fields<T>())>;
+
+// A sequence of steps to process the fields in FieldInfo::index order, the
+// adjacent padding free fields are merged into a single memory block.
+struct FieldRun {
+  size_t offset;
+  size_t size;
+
+  // range of the fields, index into data_fields<T>().
+  int first;
+  int count;
+
+  bool block;  // processed as raw memory.
+};
+
+// @param Skip: skip the fields whose meta derives from it.
+template <typename T, typename Skip, size_t... Is>
+vector<FieldRun> make_field_runs(index_sequence<Is...>) {
+  constexpr auto   fields = data_fields<T>();
+  vector<FieldRun> runs;
+  (
+      [&] {
+        constexpr auto info = get<Is>(fields);
+        using M = typename decltype(info)::member_t;
+        if constexpr (!is_base_of_v<Skip, decltype(info.meta)>) {
+          constexpr auto idx = static_cast<int>(Is);
+          if constexpr (is_value_block<M, Skip>()) {
+            auto  off = offset_of<T>(info.value);
+            auto* last = runs.empty() ? nullptr : &runs.back();
+            if (last && last->block && last->offset + last->size == off &&
+                last->first + last->count == idx) {
+              last->size += sizeof(M);
+              last->count++;
+            } else {
+              runs.push_back({off, sizeof(M), idx, 1, true});
+            }
+          } else {
+            runs.push_back({0, 0, idx, 1, false});
+          }
+        }
+      }(),
+      ...);
+  return runs;
+}
+
+template <typename T, typename Skip>
+const vector<FieldRun>& field_runs() {
+  static const auto runs = make_field_runs<T, Skip>(
+      make_index_sequence<data_field_count_v<T>>{});
+  return runs;
+}
+
+template <typename T, typename F, typename Skip, size_t I>
+constexpr auto field_handler() {
+  using Fn = decltype(&F::template apply<0>);
+  using Meta = decltype(get<I>(data_fields<T>()).meta);
+  if constexpr (is_base_of_v<Skip, Meta>)
+    return Fn{nullptr};
+  else
+    return Fn{&F::template apply<I>};
+}
+
+// Dispatch the run of field to the handler generated for it, no handler is
+// generated for the skipped fields, which may not support the operation.
+template <typename T, typename F, typename Skip, size_t... Is>
+constexpr auto make_field_dispatcher(index_sequence<Is...>) {
+  using Fn = decltype(&F::template apply<0>);
+  return array<Fn, sizeof...(Is)>{field_handler<T, F, Skip, Is>()...};
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// hash
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field meta: exclude the field from hashing.
+struct MetaNoHash {};
+
+constexpr uint64_t hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+constexpr uint64_t hash_combine(uint64_t seed, uint64_t v) {
+  return hash_mix(seed ^ (v + 0x9e3779b97f4a7c15ull + (seed << 6)));
+}
+
+// Hash the memory block 8 bytes per step.
+inline uint64_t hash_bytes(const void* p, size_t n, uint64_t seed) {
+  auto     s = static_cast<const unsigned char*>(p);
+  uint64_t h = seed ^ (n * 0x9e3779b97f4a7c15ull);
+  for (; n >= 8; n -= 8, s += 8) {
+    uint64_t w;
+    memcpy(&w, s, 8);
+    h = (h ^ (w * 0x87c37b91114253d5ull)) * 0x4cf5ad432745937full;
+    h = (h << 31) | (h >> 33);
+  }
+  if (n) {
+    uint64_t w = 0;
+    memcpy(&w, s, n);
+    h = (h ^ (w * 0x87c37b91114253d5ull)) * 0x4cf5ad432745937full;
+  }
+  return hash_mix(h);
+}
+
+template <typename T>
+uint64_t hash(const T& v, uint64_t seed = 0);
+
+template <typename T>
+struct FieldHasher {
+  template <size_t I>
+  static uint64_t apply(const T& o, uint64_t seed) {
+    return hash(o.*get<I>(data_fields<T>()).value, seed);
+  }
+};
+
+// Hash of the reflected object, fields are hashed recursively in
+// FieldInfo::index order(base class first), fields with the MetaNoHash meta
+// are skipped.
+// Also support arithmetic, enum, string, STL containers, pair, optional and
+// any type with std::hash.
+template <typename T>
+uint64_t hash(const T& v, uint64_t seed) {
+  if constexpr (is_reflected_v<T>) {
+    constexpr auto n = data_field_count_v<T>;
+    static constexpr auto dispatch =
+        make_field_dispatcher<T, FieldHasher<T>, MetaNoHash>(
+            make_index_sequence<n>{});
+    auto base = reinterpret_cast<const char*>(&v);
+    for (auto& r : field_runs<T, MetaNoHash>()) {
+      seed = r.block ? hash_bytes(base + r.offset, r.size, seed)
+                     : dispatch[r.first](v, seed);
+    }
+    return seed;
+  } else if constexpr (is_floating_point_v<T>) {
+    // +0.0 and -0.0 are equal.
+    auto x = v == 0 ? T{} : v;
+    return hash_bytes(&x, sizeof(x), seed);
+  } else if constexpr (is_value_block<T, MetaNoHash>()) {
+    return hash_bytes(&v, sizeof(v), seed);
+  } else if constexpr (is_pair<T>::value) {
+    return hash(v.second, hash(v.first, seed));
+  } else if constexpr (is_optional<T>::value) {
+    return v ? hash(*v, hash_combine(seed, 1)) : hash_combine(seed, 0);
+  } else if constexpr (is_unordered_range<T>::value) {
+    // iterating order is unspecified, combine the element hashes by sum.
+    uint64_t sum = 0;
+    for (auto& e : v)
+      sum += hash(e, 0);
+    return hash_combine(seed, sum + v.size());
+  } else if constexpr (is_value_block_range<T, MetaNoHash>()) {
+    return hash_bytes(v.data(), v.size() * sizeof(*v.data()), seed);
+  } else if constexpr (is_range<T>::value) {
+    size_t cnt = 0;
+    for (auto& e : v) {
+      seed = hash(e, seed);
+      cnt++;
+    }
+    return hash_combine(seed, cnt);
+  } else {
+    return hash_combine(seed, std::hash<T>{}(v));
+  }
+}
+
+// Hash functor, e.g. unordered_map<Key, Value, tref::Hash<Key>>.
+template <typename T>
+struct Hash {
+  size_t operator()(const T& v) const { return static_cast<size_t>(hash(v)); }
+};
+
+// Specialize std::hash for reflected type, use it at global namespace.
+#define ZTrefStdHash(T)                 \
+  template <>                           \
+  struct std::hash<ZTrefRemoveParen(T)> \
+      : tref::imp::Hash<ZTrefRemoveParen(T)> {}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// equality & ordering
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Field meta: exclude the field from comparing, also from hashing to keep
+// equal objects having the same hash.
+struct MetaNoCompare : MetaNoHash {};
+
+template <typename T>
+bool equal(const T& a, const T& b);
+
+template <typename T>
+int compare(const T& a, const T& b);
+
+template <typename T>
+struct FieldEqual {
+  template <size_t I>
+  static bool apply(const T& a, const T& b) {
+    auto ptr = get<I>(data_fields<T>()).value;
+    return equal(a.*ptr, b.*ptr);
+  }
+};
+
+template <typename T>
+struct FieldCompare {
+  template <size_t I>
+  static int apply(const T& a, const T& b) {
+    auto ptr = get<I>(data_fields<T>()).value;
+    return compare(a.*ptr, b.*ptr);
+  }
+};
+
+// Compare the reflected objects field by field recursively(base class
+// first), adjacent padding free fields are compared by a single memcmp.
+// Fields with the MetaNoCompare meta are skipped.
+template <typename T>
+bool equal(const T& a, const T& b) {
+  if constexpr (is_reflected_v<T>) {
+    constexpr auto n = data_field_count_v<T>;
+    static constexpr auto dispatch =
+        make_field_dispatcher<T, FieldEqual<T>, MetaNoCompare>(
+            make_index_sequence<n>{});
+    auto pa = reinterpret_cast<const char*>(&a);
+    auto pb = reinterpret_cast<const char*>(&b);
+    for (auto& r : field_runs<T, MetaNoCompare>()) {
+      if (r.block ? memcmp(pa + r.offset, pb + r.offset, r.size) != 0
+                  : !dispatch[r.first](a, b))
+        return false;
+    }
+    return true;
+  } else if constexpr (is_value_block<T, MetaNoCompare>()) {
+    return memcmp(&a, &b, sizeof(T)) == 0;
+  } else if constexpr (is_pair<T>::value) {
+    return equal(a.first, b.first) && equal(a.second, b.second);
+  } else if constexpr (is_optional<T>::value) {
+    return a.has_value() == b.has_value() && (!a || equal(*a, *b));
+  } else if constexpr (is_unordered_range<T>::value) {
+    return a == b;
+  } else if constexpr (is_value_block_range<T, MetaNoCompare>()) {
+    return a.size() == b.size() &&
+           (a.size() == 0 ||
+            memcmp(a.data(), b.data(), a.size() * sizeof(*a.data())) == 0);
+  } else if constexpr (is_range<T>::value) {
+    auto i = std::begin(a), ie = std::end(a);
+    auto j = std::begin(b), je = std::end(b);
+    for (; i != ie && j != je; ++i, ++j) {
+      if (!equal(*i, *j))
+        return false;
+    }
+    return i == ie && j == je;
+  } else {
+    return a == b;
+  }
+}
+
+// Three-way compare in lexicographical order of the fields.
+// @return negative if a < b, 0 if a == b, positive if a > b.
+template <typename T>
+int compare(const T& a, const T& b) {
+  if constexpr (is_reflected_v<T>) {
+    constexpr auto n = data_field_count_v<T>;
+    static constexpr auto dispatch =
+        make_field_dispatcher<T, FieldCompare<T>, MetaNoCompare>(
+            make_index_sequence<n>{});
+    auto pa = reinterpret_cast<const char*>(&a);
+    auto pb = reinterpret_cast<const char*>(&b);
+    for (auto& r : field_runs<T, MetaNoCompare>()) {
+      // byte order is not the value order, find the different field.
+      if (r.block && memcmp(pa + r.offset, pb + r.offset, r.size) == 0)
+        continue;
+      for (auto i = r.first; i < r.first + r.count; i++) {
+        if (auto c = dispatch[i](a, b))
+          return c;
+      }
+    }
+    return 0;
+  } else if constexpr (is_pair<T>::value) {
+    if (auto c = compare(a.first, b.first))
+      return c;
+    return compare(a.second, b.second);
+  } else if constexpr (is_optional<T>::value) {
+    if (!a || !b)
+      return static_cast<int>(a.has_value()) - static_cast<int>(b.has_value());
+    return compare(*a, *b);
+  } else if constexpr (is_range<T>::value && !is_unordered_range<T>::value) {
+    auto i = std::begin(a), ie = std::end(a);
+    auto j = std::begin(b), je = std::end(b);
+    for (; i != ie && j != je; ++i, ++j) {
+      if (auto c = compare(*i, *j))
+        return c;
+    }
+    return i != ie ? 1 : (j != je ? -1 : 0);
+  } else {
+    return a < b ? -1 : (b < a ? 1 : 0);
+  }
+}
+
+template <typename T>
+struct Equal {
+  bool operator()(const T& a, const T& b) const { return equal(a, b); }
+};
+
+template <typename T>
+struct Less {
+  bool operator()(const T& a, const T& b) const { return compare(a, b) < 0; }
+};
+
+}  // namespace imp
+
+using imp::compare;
+using imp::Equal;
+using imp::equal;
+using imp::Hash;
+using imp::hash;
+using imp::hash_bytes;
+using imp::Less;
+using imp::MetaNoCompare;
+using imp::MetaNoHash;
+
+#define TrefStdHash ZTrefStdHash
+
+}  // namespace tref
+#endif